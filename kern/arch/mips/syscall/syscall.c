@@ -31,15 +31,417 @@
 #include <kern/errno.h>
 #include <kern/syscall.h>
 #include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <platform/maxcpus.h>
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
+#include <proc.h>
 #include <syscall.h>
 #include <file.h>
 #include <copyinout.h>
 #include <endian.h>
+#include <trace.h>
 
 
+/*
+ * System call table.
+ *
+ * Each system call is described by a struct syscall_desc giving its
+ * name, the shape of its arguments (one SCARG_WORD per 32-bit
+ * argument, one SCARG_DWORD per 64-bit argument), whether it returns
+ * a 64-bit value, and the handler to call once the arguments have
+ * been decoded. The table is indexed by call number; empty slots are
+ * unknown system calls.
+ *
+ * The handlers below are thin adapters from the decoded argument
+ * array to the real sys_* functions, which keep their ordinary C
+ * prototypes.
+ *
+ * The table is sized by its largest entry, so every call number in
+ * it fits by construction.
+ *
+ * Each cpu keeps its own counters of calls, failed calls, and cycles
+ * spent in the handler, in a row of syscall_cpustats indexed by call
+ * number. A row is only ever touched by the cpu it belongs to, with
+ * interrupts off, so no lock is needed; rows are aligned to
+ * SYSCALL_STATS_ALIGN so that no two cpus' counters share a cache
+ * line.
+ */
+
+#define SYSCALL_STATS_ALIGN	64	/* at least a cache line */
+
+struct syscall_stats {
+	uint64_t ss_count;
+	uint64_t ss_errors;
+	uint64_t ss_cycles;
+};
+
+struct syscall_desc {
+	const char *sd_name;
+	int (*sd_handler)(const union syscall_arg *args,
+			  int32_t *retval, off_t *retval64);
+	unsigned sd_nargs;
+	unsigned char sd_argtypes[SYSCALL_MAXARGS];
+	bool sd_ret64;
+};
+
+static
+int
+sc_reboot(const union syscall_arg *a, int32_t *retval, off_t *retval64)
+{
+	(void)retval;
+	(void)retval64;
+	return sys_reboot(a[0].sa_word);
+}
+
+static
+int
+sc_time(const union syscall_arg *a, int32_t *retval, off_t *retval64)
+{
+	(void)retval;
+	(void)retval64;
+	return sys___time((userptr_t)a[0].sa_word, (userptr_t)a[1].sa_word);
+}
+
+static
+int
+sc_open(const union syscall_arg *a, int32_t *retval, off_t *retval64)
+{
+	(void)retval64;
+	return sys_open((const_userptr_t)a[0].sa_word, a[1].sa_word,
+			a[2].sa_word, retval);
+}
+
+static
+int
+sc_pipe(const union syscall_arg *a, int32_t *retval, off_t *retval64)
+{
+	(void)retval64;
+	return sys_pipe((userptr_t)a[0].sa_word, retval);
+}
+
+static
+int
+sc_dup2(const union syscall_arg *a, int32_t *retval, off_t *retval64)
+{
+	(void)retval64;
+	return sys_dup2((int)a[0].sa_word, (int)a[1].sa_word, retval);
+}
+
+static
+int
+sc_close(const union syscall_arg *a, int32_t *retval, off_t *retval64)
+{
+	(void)retval64;
+	return sys_close((int)a[0].sa_word, retval);
+}
+
+static
+int
+sc_read(const union syscall_arg *a, int32_t *retval, off_t *retval64)
+{
+	(void)retval64;
+	return sys_read((int)a[0].sa_word, (userptr_t)a[1].sa_word,
+			(size_t)a[2].sa_word, retval);
+}
+
+static
+int
+sc_write(const union syscall_arg *a, int32_t *retval, off_t *retval64)
+{
+	(void)retval64;
+	return sys_write((int)a[0].sa_word, (userptr_t)a[1].sa_word,
+			 (size_t)a[2].sa_word, retval);
+}
+
+static
+int
+sc_pread(const union syscall_arg *a, int32_t *retval, off_t *retval64)
+{
+	(void)retval64;
+	return sys_pread((int)a[0].sa_word, (userptr_t)a[1].sa_word,
+			 (size_t)a[2].sa_word, (off_t)a[3].sa_dword, retval);
+}
+
+static
+int
+sc_pwrite(const union syscall_arg *a, int32_t *retval, off_t *retval64)
+{
+	(void)retval64;
+	return sys_pwrite((int)a[0].sa_word, (userptr_t)a[1].sa_word,
+			  (size_t)a[2].sa_word, (off_t)a[3].sa_dword, retval);
+}
+
+static
+int
+sc_readv(const union syscall_arg *a, int32_t *retval, off_t *retval64)
+{
+	(void)retval64;
+	return sys_readv((int)a[0].sa_word, (userptr_t)a[1].sa_word,
+			 (int)a[2].sa_word, retval);
+}
+
+static
+int
+sc_writev(const union syscall_arg *a, int32_t *retval, off_t *retval64)
+{
+	(void)retval64;
+	return sys_writev((int)a[0].sa_word, (userptr_t)a[1].sa_word,
+			  (int)a[2].sa_word, retval);
+}
+
+static
+int
+sc_preadv(const union syscall_arg *a, int32_t *retval, off_t *retval64)
+{
+	(void)retval64;
+	return sys_preadv((int)a[0].sa_word, (userptr_t)a[1].sa_word,
+			  (int)a[2].sa_word, (off_t)a[3].sa_dword, retval);
+}
+
+static
+int
+sc_pwritev(const union syscall_arg *a, int32_t *retval, off_t *retval64)
+{
+	(void)retval64;
+	return sys_pwritev((int)a[0].sa_word, (userptr_t)a[1].sa_word,
+			   (int)a[2].sa_word, (off_t)a[3].sa_dword, retval);
+}
+
+static
+int
+sc_copy_file_range(const union syscall_arg *a, int32_t *retval,
+		   off_t *retval64)
+{
+	(void)retval64;
+	return sys_copy_file_range((int)a[0].sa_word, (userptr_t)a[1].sa_word,
+				   (int)a[2].sa_word, (userptr_t)a[3].sa_word,
+				   (size_t)a[4].sa_word, retval);
+}
+
+static
+int
+sc_getdirentries(const union syscall_arg *a, int32_t *retval,
+		 off_t *retval64)
+{
+	(void)retval64;
+	return sys_getdirentries((int)a[0].sa_word, (userptr_t)a[1].sa_word,
+				 (size_t)a[2].sa_word, (int)a[3].sa_word,
+				 retval);
+}
+
+static
+int
+sc_fbatch_setup(const union syscall_arg *a, int32_t *retval, off_t *retval64)
+{
+	(void)retval64;
+	return sys_fbatch_setup((userptr_t)a[0].sa_word, a[1].sa_word, retval);
+}
+
+static
+int
+sc_fbatch_enter(const union syscall_arg *a, int32_t *retval, off_t *retval64)
+{
+	(void)retval64;
+	return sys_fbatch_enter(a[0].sa_word, retval);
+}
+
+static
+int
+sc_lseek(const union syscall_arg *a, int32_t *retval, off_t *retval64)
+{
+	(void)retval;
+	return sys_lseek((int)a[0].sa_word, a[1].sa_dword,
+			 (int)a[2].sa_word, retval64);
+}
+
+#define W SCARG_WORD
+#define D SCARG_DWORD
+#define SC(sym, fn, ret64, n, ...) \
+	[sym] = { #fn, sc_##fn, n, { __VA_ARGS__ }, ret64 }
+
+static const struct syscall_desc syscall_table[] = {
+	SC(SYS_reboot,		reboot,		false, 1, W),
+	SC(SYS___time,		time,		false, 2, W, W),
+	SC(SYS_open,		open,		false, 3, W, W, W),
+	SC(SYS_pipe,		pipe,		false, 1, W),
+	SC(SYS_dup2,		dup2,		false, 2, W, W),
+	SC(SYS_close,		close,		false, 1, W),
+	SC(SYS_read,		read,		false, 3, W, W, W),
+	SC(SYS_write,		write,		false, 3, W, W, W),
+	SC(SYS_pread,		pread,		false, 4, W, W, W, D),
+	SC(SYS_pwrite,		pwrite,		false, 4, W, W, W, D),
+	SC(SYS_readv,		readv,		false, 3, W, W, W),
+	SC(SYS_writev,		writev,		false, 3, W, W, W),
+	SC(SYS_preadv,		preadv,		false, 4, W, W, W, D),
+	SC(SYS_pwritev,		pwritev,	false, 4, W, W, W, D),
+	SC(SYS_copy_file_range,	copy_file_range, false, 5, W, W, W, W, W),
+	SC(SYS_getdirentries,	getdirentries,	false, 4, W, W, W, W),
+	SC(SYS___fbatch_setup,	fbatch_setup,	false, 2, W, W),
+	SC(SYS___fbatch_enter,	fbatch_enter,	false, 1, W),
+	SC(SYS_lseek,		lseek,		true,  3, W, D, W),
+};
+
+#undef SC
+#undef D
+#undef W
+
+#define SYSCALL_TABLESIZE	ARRAYCOUNT(syscall_table)
+
+struct syscall_cpustats {
+	struct syscall_stats sc_stats[SYSCALL_TABLESIZE];
+} __ALIGNED(SYSCALL_STATS_ALIGN);
+
+static struct syscall_cpustats syscall_cpustats[MAXCPUS];
+
+/*
+ * Read the cp0 count register, which ticks once per cycle. It is 32
+ * bits wide and wraps, so only differences of nearby readings (taken
+ * as uint32_t) mean anything.
+ */
+static
+inline
+uint32_t
+syscall_cycles(void)
+{
+	uint32_t count;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow mips32 instructions */
+		"mfc0 %0, $9;"		/* read cp0 count */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
+/*
+ * Fetch argument word SLOT. Slots 0-3 are the registers a0-a3; the
+ * rest live on the user stack, where slot N is at sp+4*N (the first
+ * 16 bytes are the home slots for the registerized values).
+ */
+static
+int
+syscall_getword(const struct trapframe *tf, unsigned slot, uint32_t *ret)
+{
+	switch (slot) {
+	    case 0: *ret = tf->tf_a0; return 0;
+	    case 1: *ret = tf->tf_a1; return 0;
+	    case 2: *ret = tf->tf_a2; return 0;
+	    case 3: *ret = tf->tf_a3; return 0;
+	}
+	return copyin((const_userptr_t)(tf->tf_sp + 4 * slot), ret,
+		      sizeof(uint32_t));
+}
+
+/*
+ * Decode the arguments of call SD from the trapframe according to
+ * its argument shape. 64-bit arguments start on an even slot.
+ */
+static
+int
+syscall_getargs(const struct trapframe *tf, const struct syscall_desc *sd,
+		union syscall_arg *args)
+{
+	unsigned i, slot;
+	uint32_t hi, lo;
+	int result;
+
+	slot = 0;
+	for (i=0; i<sd->sd_nargs; i++) {
+		if (sd->sd_argtypes[i] == SCARG_DWORD) {
+			slot = (slot + 1) & ~1U;
+			result = syscall_getword(tf, slot, &hi);
+			if (result) {
+				return result;
+			}
+			result = syscall_getword(tf, slot + 1, &lo);
+			if (result) {
+				return result;
+			}
+			join32to64(hi, lo, &args[i].sa_dword);
+			slot += 2;
+		}
+		else {
+			result = syscall_getword(tf, slot, &args[i].sa_word);
+			if (result) {
+				return result;
+			}
+			slot++;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Charge one call to the current cpu's counters.
+ */
+static
+void
+syscall_account(unsigned callno, int err, uint32_t cycles)
+{
+	struct syscall_stats *ss;
+	int spl;
+
+	spl = splhigh();
+	ss = &syscall_cpustats[curcpu->c_number].sc_stats[callno];
+	ss->ss_count++;
+	if (err) {
+		ss->ss_errors++;
+	}
+	ss->ss_cycles += cycles;
+	splx(spl);
+}
+
+/*
+ * Print the per-call counters, summed over all cpus, and optionally
+ * zero them. Called from the kernel menu.
+ *
+ * The sums are not a consistent snapshot: other cpus may be counting
+ * while we read. That's fine for statistics.
+ */
+void
+syscall_stats(bool reset)
+{
+	const struct syscall_desc *sd;
+	struct syscall_stats *ss, tot;
+	unsigned i, j;
+
+	kprintf("%-16s %10s %8s %12s %8s\n",
+		"syscall", "calls", "errors", "cycles", "avg");
+	for (i=0; i<SYSCALL_TABLESIZE; i++) {
+		sd = &syscall_table[i];
+		if (sd->sd_handler == NULL) {
+			continue;
+		}
+		tot.ss_count = tot.ss_errors = tot.ss_cycles = 0;
+		for (j=0; j<MAXCPUS; j++) {
+			ss = &syscall_cpustats[j].sc_stats[i];
+			tot.ss_count += ss->ss_count;
+			tot.ss_errors += ss->ss_errors;
+			tot.ss_cycles += ss->ss_cycles;
+			if (reset) {
+				ss->ss_count = 0;
+				ss->ss_errors = 0;
+				ss->ss_cycles = 0;
+			}
+		}
+		if (tot.ss_count == 0) {
+			continue;
+		}
+		kprintf("%-16s %10llu %8llu %12llu %8llu\n", sd->sd_name,
+			(unsigned long long)tot.ss_count,
+			(unsigned long long)tot.ss_errors,
+			(unsigned long long)tot.ss_cycles,
+			(unsigned long long)(tot.ss_cycles / tot.ss_count));
+	}
+	if (reset) {
+		kprintf("syscall counters reset\n");
+	}
+}
+
 /*
  * System call dispatcher.
  *
@@ -76,7 +478,8 @@
  * If you run out of registers (which happens quickly with 64-bit
  * values) further arguments must be fetched from the user-level
  * stack, starting at sp+16 to skip over the slots for the
- * registerized values, with copyin().
+ * registerized values, with copyin(). syscall_getargs does this
+ * for every call from the shape recorded in the table.
  */
 void
 syscall(struct trapframe *tf)
@@ -84,9 +487,11 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
-	uint64_t offset;
 	off_t retval64;
-	int whence;
+	const struct syscall_desc *sd;
+	union syscall_arg args[SYSCALL_MAXARGS];
+	unsigned nargs;
+	uint32_t start, end;
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
@@ -106,48 +511,27 @@ syscall(struct trapframe *tf)
 	retval = 0;
 	retval64 = 0;
 
-	switch (callno) {
-	    case SYS_reboot:
-		err = sys_reboot(tf->tf_a0);
-		break;
-
-	    case SYS___time:
-		err = sys___time((userptr_t)tf->tf_a0,
-				 (userptr_t)tf->tf_a1);
-		break;
-
-	    /* Add stuff here */
-
-		case SYS_open:
-		err = sys_open((const_userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2, &retval);
-		break;
-
-		case SYS_dup2:
-		err = sys_dup2((int)tf->tf_a0, (int)tf->tf_a1, &retval);
-		break;
-
-		case SYS_close:
-		err = sys_close((int)tf->tf_a0, &retval);
-		break;
-
-		case SYS_read:
-		err = sys_read((int)tf->tf_a0, (userptr_t)tf->tf_a1, (size_t)tf->tf_a2, &retval);
-		break;
-
-		case SYS_write:
-		err = sys_write((int)tf->tf_a0, (userptr_t)tf->tf_a1, (size_t)tf->tf_a2, &retval);
-		break;
-
-		case SYS_lseek:
-		copyin((userptr_t)tf->tf_sp+16, &whence, sizeof(int));
-		join32to64(tf->tf_a2, tf->tf_a3, &offset);
-		err = sys_lseek((int)tf->tf_a0, offset, whence, &retval64);
-		break;
-		
-	    default:
+	if (callno < 0 || (unsigned)callno >= SYSCALL_TABLESIZE ||
+	    syscall_table[callno].sd_handler == NULL) {
 		kprintf("Unknown syscall %d\n", callno);
+		sd = NULL;
 		err = ENOSYS;
-		break;
+	}
+	else {
+		sd = &syscall_table[callno];
+		start = syscall_cycles();
+		err = syscall_getargs(tf, sd, args);
+		nargs = err ? 0 : sd->sd_nargs;
+		if (!err) {
+			err = sd->sd_handler(args, &retval, &retval64);
+		}
+		end = syscall_cycles();
+		syscall_account(callno, err, end - start);
+		if (curproc->p_trace) {
+			trace_syscall(callno, args, sd->sd_argtypes, nargs,
+				      sd->sd_ret64 ? retval64 : retval,
+				      err, start, end);
+		}
 	}
 
 
@@ -162,8 +546,8 @@ syscall(struct trapframe *tf)
 	}
 	else {
 		/* Success. */
-		if (callno == SYS_lseek) {
-			/* save lseek 64-bit return value to two 32-bit registers */
+		if (sd->sd_ret64) {
+			/* 64-bit return value goes in v0/v1 */
 			split64to32(retval64, &tf->tf_v0, &tf->tf_v1);
 		} else {
 			/* general case for 32-bit return value */
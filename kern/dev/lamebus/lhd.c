@@ -36,9 +36,9 @@
 #include <lib.h>
 #include <uio.h>
 #include <membar.h>
-#include <synch.h>
 #include <platform/bus.h>
 #include <vfs.h>
+#include <blkq.h>
 #include <lamebus/lhd.h>
 #include "autoconf.h"
 
@@ -96,15 +96,87 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Start the hardware on the current sector of the current request.
+ */
+static
+void
+lhd_startsector(struct lhd_softc *lh)
+{
+	struct blkreq *req = lh->lh_req;
+	uint32_t statval = LHD_WORKING;
+
+	/*
+	 * Are we writing? If so, transfer the data to the on-card
+	 * buffer.
+	 */
+	if (req->br_iswrite) {
+		memcpy(lh->lh_buf,
+		       (char *)req->br_data + lh->lh_reqpos * LHD_SECTSIZE,
+		       LHD_SECTSIZE);
+		membar_store_store();
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want... */
+	lhd_wreg(lh, LHD_REG_SECT, req->br_block + lh->lh_reqpos);
+
+	/* and start the operation. */
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * Start function for our request queue: begin on a run of requests.
+ * Called with the queue locked.
+ */
+static
+void
+lhd_start(void *vlh, struct blkreq *run)
+{
+	struct lhd_softc *lh = vlh;
+
+	KASSERT(lh->lh_req == NULL);
+	lh->lh_req = run;
+	lh->lh_reqpos = 0;
+	lhd_startsector(lh);
+}
+
+/*
+ * Record that a sector has completed. If reading, transfer the data
+ * out of the on-card buffer. Then go on to the next sector of the
+ * request, or the next request of the run; or, if the run is done,
+ * tell the queue, which will start us on the next one.
  */
 static
 void
 lhd_iodone(struct lhd_softc *lh, int err)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct blkreq *req = lh->lh_req, *next;
+
+	if (req == NULL) {
+		kprintf("lhd%d: Spurious completion\n", lh->lh_unit);
+		return;
+	}
+
+	if (err == 0 && !req->br_iswrite) {
+		membar_load_load();
+		memcpy((char *)req->br_data + lh->lh_reqpos * LHD_SECTSIZE,
+		       lh->lh_buf, LHD_SECTSIZE);
+	}
+
+	lh->lh_reqpos++;
+	if (err == 0 && lh->lh_reqpos < req->br_nblocks) {
+		lhd_startsector(lh);
+		return;
+	}
+
+	/* Can't touch REQ after blkq_done, nor LH_REQ if NEXT is null. */
+	next = req->br_mergenext;
+	lh->lh_req = next;
+	lh->lh_reqpos = 0;
+	blkq_done(lh->lh_queue, req, err);
+	if (next != NULL) {
+		lhd_startsector(lh);
+	}
 }
 
 /*
@@ -180,7 +252,8 @@ lhd_reset(struct lhd_softc *lh)
 #endif
 
 /*
- * I/O function (for both reads and writes)
+ * I/O function (for both reads and writes). The request queue does
+ * the work.
  */
 static
 int
@@ -192,9 +265,6 @@ lhd_io(struct device *d, struct uio *uio)
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
-	int result;
 
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
@@ -207,60 +277,19 @@ lhd_io(struct device *d, struct uio *uio)
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
-	}
+	return blkq_io(lh->lh_queue, uio, LHD_SECTSIZE);
+}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
-
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
-
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			membar_store_store();
-			if (result) {
-				V(lh->lh_clear);
-				return result;
-			}
-		}
-
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
-
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			membar_load_load();
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-		}
-
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
-		if (result) {
-			return result;
-		}
-	}
+/*
+ * Asynchronous I/O function. dev_submit has checked the request.
+ */
+static
+int
+lhd_submit(struct device *d, struct blkreq *req)
+{
+	struct lhd_softc *lh = d->d_data;
 
+	blkq_submit(lh->lh_queue, req, 1);
 	return 0;
 }
 
@@ -268,6 +297,7 @@ static const struct device_ops lhd_devops = {
 	.devop_eachopen = lhd_eachopen,
 	.devop_io = lhd_io,
 	.devop_ioctl = lhd_ioctl,
+	.devop_submit = lhd_submit,
 };
 
 /*
@@ -284,15 +314,11 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
+	/* Create the request queue. */
+	lh->lh_req = NULL;
+	lh->lh_reqpos = 0;
+	lh->lh_queue = blkq_create(name, lhd_start, lh);
+	if (lh->lh_queue == NULL) {
 		return ENOMEM;
 	}
 
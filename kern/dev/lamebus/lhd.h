@@ -32,6 +32,9 @@
 
 #include <device.h>
 
+struct blkq;	/* in <blkq.h> */
+struct blkreq;
+
 /*
  * Our sector size
  */
@@ -51,9 +54,9 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	struct blkq *lh_queue;		/* Requests waiting for us */
+	struct blkreq *lh_req;		/* Request in progress, or NULL */
+	uint32_t lh_reqpos;		/* Sector within it */
 
 	struct device lh_dev;		/* VFS device structure */
 };
@@ -35,39 +35,109 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
-#include <vfs.h>
+#include <synch.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/*
+ * Cached copy of the indirect block.
+ *
+ * Each vnode keeps the block pointers from its indirect block in
+ * sv_idmap once it has needed them, so looking up a block past the
+ * direct ones doesn't have to go through the buffer cache (or, if the
+ * indirect block has been evicted, to disk) every time. The copy is
+ * made from the buffer the first time sfs_bmap reads it, kept up to
+ * date as sfs_bmap allocates blocks, and thrown away by sfs_itrunc,
+ * which is the only other thing that changes the indirect block.
+ *
+ * sfs_bmap may run with the vnode's lock held shared, so two readers
+ * can both go to make the copy; the first to get sv_idmaplock
+ * installs it and the other throws its own away. Otherwise the copy
+ * changes only with the vnode's lock held exclusively.
+ */
+
+static
+uint32_t *
+sfs_bmap_getidmap(struct sfs_vnode *sv)
+{
+	uint32_t *idmap;
+
+	spinlock_acquire(&sv->sv_idmaplock);
+	idmap = sv->sv_idmap;
+	spinlock_release(&sv->sv_idmaplock);
+	return idmap;
+}
+
+/*
+ * Make the copy from IDPTRS, the contents of the indirect block. If
+ * there's no memory for it, do without.
+ */
+static
+void
+sfs_bmap_fillidmap(struct sfs_vnode *sv, const uint32_t *idptrs)
+{
+	uint32_t *idmap;
+
+	idmap = kmalloc(SFS_DBPERIDB * sizeof(uint32_t));
+	if (idmap == NULL) {
+		return;
+	}
+	memcpy(idmap, idptrs, SFS_DBPERIDB * sizeof(uint32_t));
+
+	spinlock_acquire(&sv->sv_idmaplock);
+	if (sv->sv_idmap == NULL) {
+		sv->sv_idmap = idmap;
+		idmap = NULL;
+	}
+	spinlock_release(&sv->sv_idmaplock);
+
+	if (idmap != NULL) {
+		/* someone else got there first */
+		kfree(idmap);
+	}
+}
+
+/*
+ * Throw away the copy. The caller must hold the vnode's lock
+ * exclusively (or be reclaiming it).
+ */
+void
+sfs_bmap_dropidmap(struct sfs_vnode *sv)
+{
+	uint32_t *idmap;
+
+	spinlock_acquire(&sv->sv_idmaplock);
+	idmap = sv->sv_idmap;
+	sv->sv_idmap = NULL;
+	spinlock_release(&sv->sv_idmaplock);
+
+	if (idmap != NULL) {
+		kfree(idmap);
+	}
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
- * allocated.
+ * allocated. The caller must hold the vnode's lock, and must hold it
+ * exclusively if DOALLOC is set.
  */
 int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	 daddr_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *idbuf;
+	uint32_t *idptrs, *idmap;
 	daddr_t block;
 	daddr_t idblock;
 	uint32_t idnum, idoff;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
-
-	/* Since we're using a static buffer, we'd better be locked. */
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(doalloc ? rwlock_do_i_hold_write(sv->sv_lock) :
+		rwlock_is_held(sv->sv_lock));
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -141,7 +211,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * There's no indirect block allocated, but we need to
 		 * allocate a block whose number needs to be stored in
 		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
+		 * indirect block. (sfs_balloc zeroes it.)
 		 */
 		result = sfs_balloc(sfs, &idblock);
 		if (result) {
@@ -153,40 +223,53 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 
 		/* Mark the inode dirty */
 		sv->sv_dirty = true;
+	}
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+	/*
+	 * If we have a copy of the indirect block, use it, unless we
+	 * have to allocate. (If we had to allocate the indirect block
+	 * itself just now, there's no copy.)
+	 */
+	idmap = sfs_bmap_getidmap(sv);
+	if (idmap != NULL && (idmap[idoff] != 0 || !doalloc)) {
+		block = idmap[idoff];
+		goto done;
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
-		}
+
+	/*
+	 * Work on the indirect block in the buffer cache. Our vnode
+	 * lock keeps anyone else from changing it at the same time.
+	 */
+	result = buffer_read(sfs->sfs_device, idblock, SFS_BLOCKSIZE, &idbuf);
+	if (result) {
+		return result;
 	}
+	idptrs = buffer_map(idbuf);
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+	/* Get the block out of the indirect block */
+	block = idptrs[idoff];
 
 	/* If there's no block there, allocate one */
 	if (block==0 && doalloc) {
 		result = sfs_balloc(sfs, &block);
 		if (result) {
+			buffer_release(idbuf);
 			return result;
 		}
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
-
-		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
+		/* Remember the block we allocated; the indirect block is dirty */
+		idptrs[idoff] = block;
+		buffer_mark_dirty(idbuf);
+		if (idmap != NULL) {
+			idmap[idoff] = block;
 		}
 	}
+	if (idmap == NULL) {
+		sfs_bmap_fillidmap(sv, idptrs);
+	}
+	buffer_release(idbuf);
 
+ done:
 	/* Hand back the result and return. */
 	if (block != 0 && !sfs_bused(sfs, block)) {
 		panic("sfs: %s: Data block %u (block %u of file %u) "
@@ -198,20 +281,11 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Called for ftruncate() and from sfs_reclaim, with the vnode locked.
  */
 int
 sfs_itrunc(struct sfs_vnode *sv, off_t len)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 
 	/* Length in blocks (divide rounding up) */
@@ -220,12 +294,15 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	uint32_t i, j;
 	daddr_t block, idblock;
 	uint32_t baseblock, highblock;
+	struct buf *idbuf;
+	uint32_t *idptrs;
 	int result;
 	int hasnonzero, iddirty;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	KASSERT(rwlock_do_i_hold_write(sv->sv_lock));
 
-	vfs_biglock_acquire();
+	/* The indirect block may change; forget our copy of it. */
+	sfs_bmap_dropidmap(sv);
 
 	/*
 	 * Go through the direct blocks. Discard any that are
@@ -252,42 +329,46 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	if (blocklen < highblock && idblock != 0) {
 		/* We're past the proposed EOF; may need to free stuff */
 
-		/* Read the indirect block */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+		/* Get the indirect block */
+		result = buffer_read(sfs->sfs_device, idblock, SFS_BLOCKSIZE,
+				     &idbuf);
 		if (result) {
-			vfs_biglock_release();
 			return result;
 		}
+		idptrs = buffer_map(idbuf);
 
 		hasnonzero = 0;
 		iddirty = 0;
 		for (j=0; j<SFS_DBPERIDB; j++) {
 			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
+			if (blocklen < baseblock+j && idptrs[j] != 0) {
+				sfs_bfree(sfs, idptrs[j]);
+				idptrs[j] = 0;
 				iddirty = 1;
 			}
 			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
+			if (idptrs[j]!=0) {
 				hasnonzero=1;
 			}
 		}
 
 		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
+			/*
+			 * The whole indirect block is empty now; free
+			 * it. Nothing in the buffer is worth writing
+			 * back.
+			 */
+			buffer_release_and_invalidate(idbuf);
 			sfs_bfree(sfs, idblock);
 			sv->sv_i.sfi_indirect = 0;
 			sv->sv_dirty = true;
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
-			if (result) {
-				vfs_biglock_release();
-				return result;
+		else {
+			/* If the indirect block is dirty it's written later */
+			if (iddirty) {
+				buffer_mark_dirty(idbuf);
 			}
+			buffer_release(idbuf);
 		}
 	}
 
@@ -297,7 +378,5 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	/* Mark the inode dirty */
 	sv->sv_dirty = true;
 
-	vfs_biglock_release();
 	return 0;
 }
-
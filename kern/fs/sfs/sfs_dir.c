@@ -36,6 +36,7 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -95,10 +96,359 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_direntry);
 }
 
+////////////////////////////////////////////////////////////
+// Directory index
+//
+// See <kern/sfs.h> for the format. Index and free slot map blocks
+// aren't part of the directory's data, so they are read and written
+// directly through the buffer cache. If an update of the index fails
+// partway, the whole index is thrown away; the directory is then
+// searched linearly until the index is rebuilt.
+
+/*
+ * Does the directory have an index?
+ */
+static
+bool
+sfs_dirindex_present(struct sfs_vnode *sv)
+{
+	return sv->sv_i.sfi_dirfreemap != 0;
+}
+
+static
+uint32_t
+sfs_dirindex_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	while (*name) {
+		h = (h ^ (unsigned char)*name++) * 16777619U;
+	}
+	return h;
+}
+
+/*
+ * Read index entry POS into *ENT.
+ */
+static
+int
+sfs_dirindex_get(struct sfs_vnode *sv, unsigned pos, uint32_t *ent)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
+	daddr_t block;
+	int result;
+
+	block = sv->sv_i.sfi_dirindex[pos / SFS_DIRINDEX_PERBLOCK];
+	if (block == 0) {
+		*ent = SFS_DIRINDEX_EMPTY;
+		return 0;
+	}
+	result = buffer_read(sfs->sfs_device, block, SFS_BLOCKSIZE, &buf);
+	if (result) {
+		return result;
+	}
+	*ent = ((uint32_t *)buffer_map(buf))[pos % SFS_DIRINDEX_PERBLOCK];
+	buffer_release(buf);
+	return 0;
+}
+
+/*
+ * Set index entry POS to ENT, allocating its block if need be.
+ */
+static
+int
+sfs_dirindex_put(struct sfs_vnode *sv, unsigned pos, uint32_t ent)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
+	daddr_t block;
+	unsigned ix;
+	int result;
+
+	ix = pos / SFS_DIRINDEX_PERBLOCK;
+	block = sv->sv_i.sfi_dirindex[ix];
+	if (block == 0) {
+		/* sfs_balloc zeroes it, which makes all entries empty */
+		result = sfs_balloc(sfs, &block);
+		if (result) {
+			return result;
+		}
+		sv->sv_i.sfi_dirindex[ix] = block;
+		sv->sv_dirty = true;
+	}
+	result = buffer_read(sfs->sfs_device, block, SFS_BLOCKSIZE, &buf);
+	if (result) {
+		return result;
+	}
+	((uint32_t *)buffer_map(buf))[pos % SFS_DIRINDEX_PERBLOCK] = ent;
+	buffer_mark_dirty(buf);
+	buffer_release(buf);
+	return 0;
+}
+
+/*
+ * Mark SLOT free or in use in the free slot map.
+ */
+static
+int
+sfs_dirfree_mark(struct sfs_vnode *sv, int slot, bool isfree)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
+	uint8_t *map;
+	int result;
+
+	KASSERT(slot >= 0 && slot < SFS_BITSPERBLOCK);
+	result = buffer_read(sfs->sfs_device, sv->sv_i.sfi_dirfreemap,
+			     SFS_BLOCKSIZE, &buf);
+	if (result) {
+		return result;
+	}
+	map = buffer_map(buf);
+	if (isfree) {
+		map[slot / CHAR_BIT] |= 1 << (slot % CHAR_BIT);
+	}
+	else {
+		map[slot / CHAR_BIT] &= ~(1 << (slot % CHAR_BIT));
+	}
+	buffer_mark_dirty(buf);
+	buffer_release(buf);
+	return 0;
+}
+
+/*
+ * Find the lowest free slot in the free slot map, or -1 if none.
+ */
+static
+int
+sfs_dirfree_find(struct sfs_vnode *sv, int *slot)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
+	uint8_t *map;
+	unsigned i, bit;
+	int result;
+
+	result = buffer_read(sfs->sfs_device, sv->sv_i.sfi_dirfreemap,
+			     SFS_BLOCKSIZE, &buf);
+	if (result) {
+		return result;
+	}
+	map = buffer_map(buf);
+	*slot = -1;
+	for (i=0; i<SFS_BLOCKSIZE; i++) {
+		if (map[i] != 0) {
+			for (bit=0; (map[i] & (1 << bit)) == 0; bit++) {
+				/* nothing */
+			}
+			*slot = i * CHAR_BIT + bit;
+			break;
+		}
+	}
+	buffer_release(buf);
+	return 0;
+}
+
+/*
+ * Throw the index away.
+ */
+void
+sfs_dir_dropindex(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	unsigned i;
+
+	for (i=0; i<SFS_DIRINDEX_NBLOCKS; i++) {
+		if (sv->sv_i.sfi_dirindex[i] != 0) {
+			sfs_bfree(sfs, sv->sv_i.sfi_dirindex[i]);
+			sv->sv_i.sfi_dirindex[i] = 0;
+			sv->sv_dirty = true;
+		}
+	}
+	if (sv->sv_i.sfi_dirfreemap != 0) {
+		sfs_bfree(sfs, sv->sv_i.sfi_dirfreemap);
+		sv->sv_i.sfi_dirfreemap = 0;
+		sv->sv_dirty = true;
+	}
+	if (sv->sv_i.sfi_dirdeleted != 0) {
+		sv->sv_i.sfi_dirdeleted = 0;
+		sv->sv_dirty = true;
+	}
+}
+
+/*
+ * Look NAME up in the index. Returns ENOENT if it isn't there.
+ */
+static
+int
+sfs_dirindex_find(struct sfs_vnode *sv, const char *name,
+		  uint32_t *ino, int *slot)
+{
+	struct sfs_direntry tsd;
+	uint32_t hash, ent;
+	unsigned pos, n;
+	int result;
+
+	hash = sfs_dirindex_hash(name);
+	pos = hash % SFS_DIRINDEX_NENTRIES;
+	for (n=0; n<SFS_DIRINDEX_NENTRIES; n++) {
+		result = sfs_dirindex_get(sv, pos, &ent);
+		if (result) {
+			return result;
+		}
+		if (ent == SFS_DIRINDEX_EMPTY) {
+			break;
+		}
+		if (ent != SFS_DIRINDEX_DELETED &&
+		    SFS_DIRINDEX_TAG(ent) == SFS_DIRINDEX_TAG(hash)) {
+			result = sfs_readdir(sv, SFS_DIRINDEX_SLOT(ent), &tsd);
+			if (result) {
+				return result;
+			}
+			tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+			if (tsd.sfd_ino != SFS_NOINO &&
+			    !strcmp(tsd.sfd_name, name)) {
+				if (slot != NULL) {
+					*slot = SFS_DIRINDEX_SLOT(ent);
+				}
+				if (ino != NULL) {
+					*ino = tsd.sfd_ino;
+				}
+				return 0;
+			}
+		}
+		pos = (pos + 1) % SFS_DIRINDEX_NENTRIES;
+	}
+	return ENOENT;
+}
+
+/*
+ * Add NAME, in slot SLOT, to the index.
+ */
+static
+int
+sfs_dirindex_insert(struct sfs_vnode *sv, const char *name, int slot)
+{
+	uint32_t hash, ent;
+	unsigned pos, n;
+	int result;
+
+	hash = sfs_dirindex_hash(name);
+	pos = hash % SFS_DIRINDEX_NENTRIES;
+	for (n=0; n<SFS_DIRINDEX_NENTRIES; n++) {
+		result = sfs_dirindex_get(sv, pos, &ent);
+		if (result) {
+			return result;
+		}
+		if (ent == SFS_DIRINDEX_DELETED) {
+			KASSERT(sv->sv_i.sfi_dirdeleted > 0);
+			sv->sv_i.sfi_dirdeleted--;
+			sv->sv_dirty = true;
+		}
+		if (ent == SFS_DIRINDEX_EMPTY || ent == SFS_DIRINDEX_DELETED) {
+			return sfs_dirindex_put(sv, pos,
+						SFS_DIRINDEX_ENTRY(hash, slot));
+		}
+		pos = (pos + 1) % SFS_DIRINDEX_NENTRIES;
+	}
+	/* can't happen; there are more entries than directory slots */
+	return ENOSPC;
+}
+
+/*
+ * Take NAME, in slot SLOT, out of the index.
+ */
+static
+int
+sfs_dirindex_remove(struct sfs_vnode *sv, const char *name, int slot)
+{
+	uint32_t hash, ent;
+	unsigned pos, n;
+	int result;
+
+	hash = sfs_dirindex_hash(name);
+	pos = hash % SFS_DIRINDEX_NENTRIES;
+	for (n=0; n<SFS_DIRINDEX_NENTRIES; n++) {
+		result = sfs_dirindex_get(sv, pos, &ent);
+		if (result) {
+			return result;
+		}
+		if (ent == SFS_DIRINDEX_EMPTY) {
+			break;
+		}
+		if (ent == SFS_DIRINDEX_ENTRY(hash, slot)) {
+			sv->sv_i.sfi_dirdeleted++;
+			sv->sv_dirty = true;
+			return sfs_dirindex_put(sv, pos, SFS_DIRINDEX_DELETED);
+		}
+		pos = (pos + 1) % SFS_DIRINDEX_NENTRIES;
+	}
+	/* wasn't there; the index is wrong */
+	return EIO;
+}
+
+/*
+ * Build a fresh index for a directory, replacing any it has.
+ */
+static
+int
+sfs_dirindex_build(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_direntry tsd;
+	daddr_t block;
+	int nentries, i, result;
+
+	sfs_dir_dropindex(sv);
+
+	nentries = sfs_dir_nentries(sv);
+	if (nentries > SFS_BITSPERBLOCK) {
+		/* can't happen with the largest directory SFS allows */
+		return EFBIG;
+	}
+
+	/* sfs_balloc zeroes it, which marks every slot in use */
+	result = sfs_balloc(sfs, &block);
+	if (result) {
+		return result;
+	}
+	sv->sv_i.sfi_dirfreemap = block;
+	sv->sv_dirty = true;
+
+	for (i=0; i<nentries; i++) {
+		result = sfs_readdir(sv, i, &tsd);
+		if (result) {
+			goto fail;
+		}
+		if (tsd.sfd_ino == SFS_NOINO) {
+			result = sfs_dirfree_mark(sv, i, true);
+		}
+		else {
+			tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+			result = sfs_dirindex_insert(sv, tsd.sfd_name, i);
+		}
+		if (result) {
+			goto fail;
+		}
+	}
+	return 0;
+
+ fail:
+	sfs_dir_dropindex(sv);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// Directory operations
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
  * empty directory slot if one is found.
+ *
+ * If the directory has an index and no empty slot is wanted, the
+ * index is used instead of reading every slot.
  */
 int
 sfs_dir_findname(struct sfs_vnode *sv, const char *name,
@@ -107,6 +457,10 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	struct sfs_direntry tsd;
 	int found, nentries, i, result;
 
+	if (emptyslot == NULL && sfs_dirindex_present(sv)) {
+		return sfs_dirindex_find(sv, name, ino, slot);
+	}
+
 	nentries = sfs_dir_nentries(sv);
 
 	/* For each slot... */
@@ -156,9 +510,26 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	int emptyslot = -1;
 	int result;
 	struct sfs_direntry sd;
-
-	/* Look up the name. We want to make sure it *doesn't* exist. */
-	result = sfs_dir_findname(sv, name, NULL, NULL, &emptyslot);
+	bool indexed;
+
+	/*
+	 * Look up the name. We want to make sure it *doesn't* exist.
+	 * With an index that doesn't find us an empty slot, so take
+	 * the lowest one from the free slot map.
+	 */
+	indexed = sfs_dirindex_present(sv);
+	if (indexed) {
+		result = sfs_dirindex_find(sv, name, NULL, NULL);
+		if (result == ENOENT) {
+			result = sfs_dirfree_find(sv, &emptyslot);
+			if (result == 0) {
+				result = ENOENT;
+			}
+		}
+	}
+	else {
+		result = sfs_dir_findname(sv, name, NULL, NULL, &emptyslot);
+	}
 	if (result!=0 && result!=ENOENT) {
 		return result;
 	}
@@ -186,7 +557,26 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	}
 
 	/* Write the entry. */
-	return sfs_writedir(sv, emptyslot, &sd);
+	result = sfs_writedir(sv, emptyslot, &sd);
+	if (result) {
+		return result;
+	}
+
+	/* The name cache may say it doesn't exist */
+	vfs_dcache_remove(&sv->sv_absvn, name);
+
+	/* Keep the index up to date, or make one if it's time */
+	if (indexed) {
+		if (sfs_dirfree_mark(sv, emptyslot, false) ||
+		    sfs_dirindex_insert(sv, name, emptyslot)) {
+			sfs_dir_dropindex(sv);
+		}
+	}
+	else if (sfs_dir_nentries(sv) >= SFS_DIRINDEX_MIN) {
+		/* if this fails we just go on without */
+		(void)sfs_dirindex_build(sv);
+	}
+	return 0;
 }
 
 /*
@@ -195,19 +585,82 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
-	struct sfs_direntry sd;
+	struct sfs_direntry sd, empty;
+	int result;
+
+	/* Get the name, to take it out of the name cache and index */
+	result = sfs_readdir(sv, slot, &sd);
+	if (result) {
+		return result;
+	}
+	sd.sfd_name[sizeof(sd.sfd_name)-1] = 0;
+	vfs_dcache_remove(&sv->sv_absvn, sd.sfd_name);
 
 	/* Initialize a suitable directory entry... */
-	bzero(&sd, sizeof(sd));
-	sd.sfd_ino = SFS_NOINO;
+	bzero(&empty, sizeof(empty));
+	empty.sfd_ino = SFS_NOINO;
 
 	/* ... and write it */
-	return sfs_writedir(sv, slot, &sd);
+	result = sfs_writedir(sv, slot, &empty);
+	if (result) {
+		return result;
+	}
+
+	/*
+	 * Update the index. If it has collected too many deleted
+	 * entries, which make every probe for a name that isn't there
+	 * longer, start it afresh.
+	 */
+	if (sfs_dirindex_present(sv)) {
+		if (sfs_dirindex_remove(sv, sd.sfd_name, slot) ||
+		    sfs_dirfree_mark(sv, slot, true)) {
+			sfs_dir_dropindex(sv);
+		}
+		else if (sv->sv_i.sfi_dirdeleted > SFS_DIRINDEX_MAXDELETED) {
+			/* if this fails we just go on without */
+			(void)sfs_dirindex_build(sv);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Find the first used slot at or after *SLOT and copy its name into
+ * NAME, which must hold SFS_NAMELEN bytes. *SLOT is set to the slot
+ * found, or to -1 if there are no more used slots.
+ */
+int
+sfs_dir_nextname(struct sfs_vnode *sv, int *slot, char *name)
+{
+	struct sfs_direntry tsd;
+	int nentries, i, result;
+
+	nentries = sfs_dir_nentries(sv);
+
+	for (i=*slot; i<nentries; i++) {
+		result = sfs_readdir(sv, i, &tsd);
+		if (result) {
+			return result;
+		}
+		if (tsd.sfd_ino != SFS_NOINO) {
+			/* Ensure null termination, just in case */
+			tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+			strcpy(name, tsd.sfd_name);
+			*slot = i;
+			return 0;
+		}
+	}
+
+	*slot = -1;
+	return 0;
 }
 
 /*
  * Look for a name in a directory and hand back a vnode for the
  * file, if there is one.
+ *
+ * If the caller doesn't want the slot, the name cache is tried first,
+ * and the answer is put in it after searching the directory.
  */
 int
 sfs_lookonce(struct sfs_vnode *sv, const char *name,
@@ -215,10 +668,22 @@ sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		int *slot)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct vnode *vn;
 	uint32_t ino;
 	int result;
 
+	if (slot == NULL && vfs_dcache_lookup(&sv->sv_absvn, name, &vn)) {
+		if (vn == NULL) {
+			return ENOENT;
+		}
+		*ret = vn->vn_data;
+		return 0;
+	}
+
 	result = sfs_dir_findname(sv, name, &ino, slot, NULL);
+	if (result == ENOENT) {
+		vfs_dcache_enter(&sv->sv_absvn, name, NULL);
+	}
 	if (result) {
 		return result;
 	}
@@ -227,6 +692,7 @@ sfs_lookonce(struct sfs_vnode *sv, const char *name,
 	if (result) {
 		return result;
 	}
+	vfs_dcache_enter(&sv->sv_absvn, name, &(*ret)->sv_absvn);
 
 	if ((*ret)->sv_i.sfi_linkcount == 0) {
 		panic("sfs: %s: name %s (inode %u) in dir %u has "
@@ -39,8 +39,10 @@
 #include <array.h>
 #include <bitmap.h>
 #include <uio.h>
+#include <synch.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -112,15 +114,51 @@ static
 int
 sfs_sync_vnodes(struct sfs_fs *sfs)
 {
-	unsigned i, num;
+	struct sfs_vnode **svs, *sv;
+	unsigned i, n;
+	int result;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+	/*
+	 * Syncing an inode needs its vnode lock, which comes before
+	 * sfs_vnlock; so take a reference to each loaded vnode while
+	 * holding the table lock, then let go of it and sync them one
+	 * at a time. (Not with VOP_FSYNC, which would flush the
+	 * buffer cache for each one; sfs_sync does that once at the
+	 * end.)
+	 */
+	lock_acquire(sfs->sfs_vnlock);
+	n = sfs->sfs_nvnodes;
+	if (n == 0) {
+		lock_release(sfs->sfs_vnlock);
+		return 0;
 	}
-	return 0;
+	svs = kmalloc(n * sizeof(struct sfs_vnode *));
+	if (svs == NULL) {
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+	n = 0;
+	for (i=0; i<sfs->sfs_vnhashsize; i++) {
+		for (sv = sfs->sfs_vnhash[i]; sv != NULL;
+		     sv = sv->sv_hashnext) {
+			VOP_INCREF(&sv->sv_absvn);
+			svs[n++] = sv;
+		}
+	}
+	KASSERT(n == sfs->sfs_nvnodes);
+	lock_release(sfs->sfs_vnlock);
+
+	result = 0;
+	for (i=0; i<n; i++) {
+		if (result == 0) {
+			rwlock_acquire_write(svs[i]->sv_lock);
+			result = sfs_sync_inode(svs[i]);
+			rwlock_release_write(svs[i]->sv_lock);
+		}
+		VOP_DECREF(&svs[i]->sv_absvn);
+	}
+	kfree(svs);
+	return result;
 }
 
 /*
@@ -132,13 +170,16 @@ sfs_sync_freemap(struct sfs_fs *sfs)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_freemaplock);
 	if (sfs->sfs_freemapdirty) {
 		result = sfs_freemapio(sfs, UIO_WRITE);
 		if (result) {
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_freemapdirty = false;
 	}
+	lock_release(sfs->sfs_freemaplock);
 
 	return 0;
 }
@@ -174,8 +215,6 @@ sfs_sync(struct fs *fs)
 	struct sfs_fs *sfs;
 	int result;
 
-	vfs_biglock_acquire();
-
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
 	 *
@@ -211,25 +250,27 @@ sfs_sync(struct fs *fs)
 	/* If any vnodes need to be written, write them. */
 	result = sfs_sync_vnodes(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* If the free block map needs to be written, write it. */
 	result = sfs_sync_freemap(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* If the superblock needs to be written, write it. */
 	result = sfs_sync_superblock(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
-	vfs_biglock_release();
+	/* Finally, make sure nothing is left in the buffer cache. */
+	result = buffer_sync(sfs->sfs_device);
+	if (result) {
+		return result;
+	}
+
 	return 0;
 }
 
@@ -243,13 +284,9 @@ const char *
 sfs_getvolname(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	const char *ret;
 
-	vfs_biglock_acquire();
-	ret = sfs->sfs_sb.sb_volname;
-	vfs_biglock_release();
-
-	return ret;
+	/* The superblock doesn't change once mounted; no lock needed */
+	return sfs->sfs_sb.sb_volname;
 }
 
 /*
@@ -262,7 +299,8 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
-	vnodearray_destroy(sfs->sfs_vnodes);
+	lock_destroy(sfs->sfs_freemaplock);
+	sfs_vnhash_cleanup(sfs);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
 }
@@ -270,26 +308,53 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 /*
  * Unmount code.
  *
- * VFS calls FS_SYNC on the filesystem prior to unmounting it.
+ * VFS calls FS_SYNC on the filesystem prior to unmounting it, but
+ * that doesn't keep the volume quiet: a thread that already has a
+ * vnode can still write and close it afterwards, and the close
+ * reclaims it, which writes the inode and can free blocks. Everything
+ * that touches the volume goes through a loaded vnode, though, and
+ * vnodes are only loaded and reclaimed under sfs_vnlock, so once no
+ * vnodes are left, holding sfs_vnlock keeps it that way while the
+ * last of the changes are written out here.
  */
 static
 int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-
-	vfs_biglock_acquire();
+	int result;
 
 	/* Do we have any files open? If so, can't unmount. */
-	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
-		vfs_biglock_release();
+	lock_acquire(sfs->sfs_vnlock);
+	if (sfs->sfs_nvnodes > 0) {
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
 
-	/* We should have just had sfs_sync called. */
+	/* Write out whatever was changed since the sync. */
+	result = sfs_sync_freemap(sfs);
+	if (result) {
+		lock_release(sfs->sfs_vnlock);
+		return result;
+	}
+	result = sfs_sync_superblock(sfs);
+	if (result) {
+		lock_release(sfs->sfs_vnlock);
+		return result;
+	}
+	result = buffer_sync(sfs->sfs_device);
+	if (result) {
+		lock_release(sfs->sfs_vnlock);
+		return result;
+	}
+
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* Forget our blocks, so nothing stale is left once the device is free */
+	buffer_drop(sfs->sfs_device);
+	lock_release(sfs->sfs_vnlock);
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -297,7 +362,6 @@ sfs_unmount(struct fs *fs)
 	sfs_fs_destroy(sfs);
 
 	/* nothing else to do */
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -351,17 +415,22 @@ sfs_fs_create(void)
 	sfs->sfs_device = NULL;
 
 	/* vnode table */
-	sfs->sfs_vnodes = vnodearray_create();
-	if (sfs->sfs_vnodes == NULL) {
+	if (sfs_vnhash_init(sfs)) {
 		goto cleanup_object;
 	}
 
 	/* freemap */
+	sfs->sfs_freemaplock = lock_create("sfs_freemap");
+	if (sfs->sfs_freemaplock == NULL) {
+		goto cleanup_vnhash;
+	}
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
 
 	return sfs;
 
+cleanup_vnhash:
+	sfs_vnhash_cleanup(sfs);
 cleanup_object:
 	kfree(sfs);
 fail:
@@ -388,8 +457,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	int result;
 	struct sfs_fs *sfs;
 
-	vfs_biglock_acquire();
-
 	/* We don't pass any options through mount */
 	(void)options;
 
@@ -402,7 +469,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	 * don't do that in sfs.)
 	 */
 	if (dev->d_blocksize != SFS_BLOCKSIZE) {
-		vfs_biglock_release();
 		kprintf("sfs: Cannot mount on device with blocksize %zu\n",
 			dev->d_blocksize);
 		return ENXIO;
@@ -410,7 +476,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 
 	sfs = sfs_fs_create();
 	if (sfs == NULL) {
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 
@@ -421,9 +486,9 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	result = sfs_readblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
 			       sizeof(sfs->sfs_sb));
 	if (result) {
+		buffer_drop(dev);
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -434,9 +499,9 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			"(0x%x, should be 0x%x)\n",
 			sfs->sfs_sb.sb_magic,
 			SFS_MAGIC);
+		buffer_drop(dev);
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return EINVAL;
 	}
 
@@ -451,23 +516,22 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Load free block bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_FREEMAPBITS(sfs));
 	if (sfs->sfs_freemap == NULL) {
+		buffer_drop(dev);
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 	result = sfs_freemapio(sfs, UIO_READ);
 	if (result) {
+		buffer_drop(dev);
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
-	vfs_biglock_release();
 	return 0;
 }
 
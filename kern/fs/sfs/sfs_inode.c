@@ -35,13 +35,163 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+////////////////////////////////////////////////////////////
+// Table of loaded vnodes
+//
+// A hash table on inode number with chains through sv_hashnext. The
+// number of chains is a power of two and doubles whenever there are
+// more than two vnodes per chain, so lookups stay constant-time no
+// matter how many files are in use. If we can't get memory to grow,
+// we carry on with longer chains. The table is protected by
+// sfs_vnlock, which the functions below expect to be held.
 
 /*
- * Write an on-disk inode structure back out to disk.
+ * Set up an empty table.
+ */
+int
+sfs_vnhash_init(struct sfs_fs *sfs)
+{
+	unsigned i;
+
+	sfs->sfs_vnlock = lock_create("sfs_vnlock");
+	if (sfs->sfs_vnlock == NULL) {
+		return ENOMEM;
+	}
+	sfs->sfs_vnhash = kmalloc(SFS_VNHASH_INITSIZE *
+				  sizeof(struct sfs_vnode *));
+	if (sfs->sfs_vnhash == NULL) {
+		lock_destroy(sfs->sfs_vnlock);
+		sfs->sfs_vnlock = NULL;
+		return ENOMEM;
+	}
+	for (i=0; i<SFS_VNHASH_INITSIZE; i++) {
+		sfs->sfs_vnhash[i] = NULL;
+	}
+	sfs->sfs_vnhashsize = SFS_VNHASH_INITSIZE;
+	sfs->sfs_nvnodes = 0;
+	return 0;
+}
+
+/*
+ * Free the table, which must be empty.
+ */
+void
+sfs_vnhash_cleanup(struct sfs_fs *sfs)
+{
+	KASSERT(sfs->sfs_nvnodes == 0);
+	kfree(sfs->sfs_vnhash);
+	sfs->sfs_vnhash = NULL;
+	sfs->sfs_vnhashsize = 0;
+	lock_destroy(sfs->sfs_vnlock);
+	sfs->sfs_vnlock = NULL;
+}
+
+static
+unsigned
+sfs_vnhash_chain(struct sfs_fs *sfs, uint32_t ino)
+{
+	return ino & (sfs->sfs_vnhashsize - 1);
+}
+
+/*
+ * Find the loaded vnode for INO, or NULL.
+ */
+static
+struct sfs_vnode *
+sfs_vnhash_find(struct sfs_fs *sfs, uint32_t ino)
+{
+	struct sfs_vnode *sv;
+
+	for (sv = sfs->sfs_vnhash[sfs_vnhash_chain(sfs, ino)];
+	     sv != NULL; sv = sv->sv_hashnext) {
+		if (sv->sv_ino == ino) {
+			return sv;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Double the number of chains.
+ */
+static
+void
+sfs_vnhash_grow(struct sfs_fs *sfs)
+{
+	struct sfs_vnode **oldhash, *sv, *next;
+	unsigned oldsize, i, ix;
+
+	oldhash = sfs->sfs_vnhash;
+	oldsize = sfs->sfs_vnhashsize;
+
+	sfs->sfs_vnhash = kmalloc(2 * oldsize * sizeof(struct sfs_vnode *));
+	if (sfs->sfs_vnhash == NULL) {
+		/* keep the old one */
+		sfs->sfs_vnhash = oldhash;
+		return;
+	}
+	sfs->sfs_vnhashsize = 2 * oldsize;
+	for (i=0; i<sfs->sfs_vnhashsize; i++) {
+		sfs->sfs_vnhash[i] = NULL;
+	}
+
+	for (i=0; i<oldsize; i++) {
+		for (sv = oldhash[i]; sv != NULL; sv = next) {
+			next = sv->sv_hashnext;
+			ix = sfs_vnhash_chain(sfs, sv->sv_ino);
+			sv->sv_hashnext = sfs->sfs_vnhash[ix];
+			sfs->sfs_vnhash[ix] = sv;
+		}
+	}
+	kfree(oldhash);
+}
+
+static
+void
+sfs_vnhash_insert(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	unsigned ix;
+
+	if (sfs->sfs_nvnodes >= 2 * sfs->sfs_vnhashsize) {
+		sfs_vnhash_grow(sfs);
+	}
+	ix = sfs_vnhash_chain(sfs, sv->sv_ino);
+	sv->sv_hashnext = sfs->sfs_vnhash[ix];
+	sfs->sfs_vnhash[ix] = sv;
+	sfs->sfs_nvnodes++;
+}
+
+static
+void
+sfs_vnhash_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **svp;
+
+	for (svp = &sfs->sfs_vnhash[sfs_vnhash_chain(sfs, sv->sv_ino)];
+	     *svp != NULL; svp = &(*svp)->sv_hashnext) {
+		if (*svp == sv) {
+			*svp = sv->sv_hashnext;
+			sv->sv_hashnext = NULL;
+			KASSERT(sfs->sfs_nvnodes > 0);
+			sfs->sfs_nvnodes--;
+			return;
+		}
+	}
+	panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
+	      sfs->sfs_sb.sb_volname, sv->sv_ino);
+}
+
+////////////////////////////////////////////////////////////
+// Inodes
+
+/*
+ * Write an on-disk inode structure back out to disk. The caller must
+ * hold the vnode's lock.
  */
 int
 sfs_sync_inode(struct sfs_vnode *sv)
@@ -49,6 +199,8 @@ sfs_sync_inode(struct sfs_vnode *sv)
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	int result;
 
+	KASSERT(rwlock_do_i_hold_write(sv->sv_lock));
+
 	if (sv->sv_dirty) {
 		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
 					sizeof(sv->sv_i));
@@ -70,15 +222,21 @@ sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
 	int result;
 
-	vfs_biglock_acquire();
+	/*
+	 * Hold the vnode table lock throughout, so sfs_loadvnode
+	 * can't find the vnode (or load a second copy of the inode
+	 * from disk) while we're getting rid of it.
+	 */
+	rwlock_acquire_write(sv->sv_lock);
+	lock_acquire(sfs->sfs_vnlock);
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * decision was made to reclaim it. Since sfs_loadvnode takes
+	 * references only while holding sfs_vnlock, once this check
+	 * passes no one else can.
 	 */
 	spinlock_acquire(&v->vn_countlock);
 	if (v->vn_refcount != 1) {
@@ -88,16 +246,21 @@ sfs_reclaim(struct vnode *v)
 		v->vn_refcount--;
 
 		spinlock_release(&v->vn_countlock);
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
+		rwlock_release_write(sv->sv_lock);
 		return EBUSY;
 	}
 	spinlock_release(&v->vn_countlock);
 
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount == 0) {
+		if (sv->sv_i.sfi_type == SFS_TYPE_DIR) {
+			sfs_dir_dropindex(sv);
+		}
 		result = sfs_itrunc(sv, 0);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sfs->sfs_vnlock);
+			rwlock_release_write(sv->sv_lock);
 			return result;
 		}
 	}
@@ -105,7 +268,8 @@ sfs_reclaim(struct vnode *v)
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
+		rwlock_release_write(sv->sv_lock);
 		return result;
 	}
 
@@ -115,25 +279,16 @@ sfs_reclaim(struct vnode *v)
 	}
 
 	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix == num) {
-		panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
-		      sfs->sfs_sb.sb_volname, sv->sv_ino);
-	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
+	sfs_vnhash_remove(sfs, sv);
 
-	vnode_cleanup(&sv->sv_absvn);
+	lock_release(sfs->sfs_vnlock);
+	rwlock_release_write(sv->sv_lock);
 
-	vfs_biglock_release();
+	vnode_cleanup(&sv->sv_absvn);
+	sfs_bmap_dropidmap(sv);
+	spinlock_cleanup(&sv->sv_idmaplock);
+	spinlock_cleanup(&sv->sv_ralock);
+	rwlock_destroy(sv->sv_lock);
 
 	/* Release the storage for the vnode structure itself. */
 	kfree(sv);
@@ -150,42 +305,38 @@ int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops;
-	unsigned i, num;
 	int result;
 
-	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
+	lock_acquire(sfs->sfs_vnlock);
 
+	/* Look in the vnodes table */
+	sv = sfs_vnhash_find(sfs, ino);
+	if (sv != NULL) {
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
 			panic("sfs: %s: Found inode %u in unallocated block\n",
 			      sfs->sfs_sb.sb_volname, sv->sv_ino);
 		}
 
-		if (sv->sv_ino==ino) {
-			/* Found */
+		/* forcetype is only allowed when creating objects */
+		KASSERT(forcetype==SFS_TYPE_INVAL);
 
-			/* forcetype is only allowed when creating objects */
-			KASSERT(forcetype==SFS_TYPE_INVAL);
-
-			VOP_INCREF(&sv->sv_absvn);
-			*ret = sv;
-			return 0;
-		}
+		VOP_INCREF(&sv->sv_absvn);
+		lock_release(sfs->sfs_vnlock);
+		*ret = sv;
+		return 0;
 	}
 
-	/* Didn't have it loaded; load it */
+	/*
+	 * Didn't have it loaded; load it. Keep holding the table lock
+	 * while we do, so no one else loads it at the same time.
+	 */
 
 	sv = kmalloc(sizeof(struct sfs_vnode));
 	if (sv==NULL) {
+		lock_release(sfs->sfs_vnlock);
 		return ENOMEM;
 	}
 
@@ -199,6 +350,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
 	if (result) {
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
@@ -232,23 +384,35 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		      ino, sv->sv_i.sfi_type);
 	}
 
+	sv->sv_lock = rwlock_create("sfs_vnode");
+	if (sv->sv_lock == NULL) {
+		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+		rwlock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
+	spinlock_init(&sv->sv_ralock);
+	sv->sv_ranext = 0;
+	sv->sv_rawindow = 0;
+	sv->sv_raend = 0;
+	spinlock_init(&sv->sv_idmaplock);
+	sv->sv_idmap = NULL;
 
 	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
-	if (result) {
-		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
-		return result;
-	}
+	sfs_vnhash_insert(sfs, sv);
+
+	lock_release(sfs->sfs_vnlock);
 
 	/* Hand it back */
 	*ret = sv;
@@ -296,25 +460,20 @@ sfs_getroot(struct fs *fs, struct vnode **ret)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOTDIR_INO, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		kprintf("sfs: %s: getroot: Cannot load root vnode\n",
 			sfs->sfs_sb.sb_volname);
-		vfs_biglock_release();
 		return result;
 	}
 
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
 		kprintf("sfs: %s: getroot: not directory (type %u)\n",
 			sfs->sfs_sb.sb_volname, sv->sv_i.sfi_type);
-		vfs_biglock_release();
+		VOP_DECREF(&sv->sv_absvn);
 		return EINVAL;
 	}
 
-	vfs_biglock_release();
-
 	*ret = &sv->sv_absvn;
 	return 0;
 }
@@ -38,12 +38,17 @@
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 ////////////////////////////////////////////////////////////
 //
 // Basic block-level I/O routines
+//
+// All SFS I/O goes through the buffer cache. These copy a whole block
+// in or out of it; the file and metadata routines below work on the
+// cached block directly.
 
 /*
  * Note: sfs_readblock is used to read the superblock
@@ -52,83 +57,45 @@
  * except sfs_device.
  */
 
-/*
- * Read or write a block, retrying I/O errors.
- */
-static
-int
-sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
-{
-	int result;
-	int tries=0;
-
-	KASSERT(vfs_biglock_do_i_hold());
-
-	DEBUG(DB_SFS, "sfs: %s %llu\n",
-	      uio->uio_rw == UIO_READ ? "read" : "write",
-	      uio->uio_offset / SFS_BLOCKSIZE);
-
- retry:
-	result = DEVOP_IO(sfs->sfs_device, uio);
-	if (result == EINVAL) {
-		/*
-		 * This means the sector we requested was out of range,
-		 * or the seek address we gave wasn't sector-aligned,
-		 * or a couple of other things that are our fault.
-		 */
-		panic("sfs: %s: DEVOP_IO returned EINVAL\n",
-		      sfs->sfs_sb.sb_volname);
-	}
-	if (result == EIO) {
-		if (tries == 0) {
-			tries++;
-			kprintf("sfs: %s: block %llu I/O error, retrying\n",
-				sfs->sfs_sb.sb_volname,
-				uio->uio_offset / SFS_BLOCKSIZE);
-			goto retry;
-		}
-		else if (tries < 10) {
-			tries++;
-			goto retry;
-		}
-		else {
-			kprintf("sfs: %s: block %llu I/O error, giving up "
-				"after %d retries\n",
-				sfs->sfs_sb.sb_volname,
-				uio->uio_offset / SFS_BLOCKSIZE, tries);
-		}
-	}
-	return result;
-}
-
 /*
  * Read a block.
  */
 int
 sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct buf *buf;
+	int result;
 
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_READ);
-	return sfs_rwblock(sfs, &ku);
+	result = buffer_read(sfs->sfs_device, block, SFS_BLOCKSIZE, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(data, buffer_map(buf), len);
+	buffer_release(buf);
+	return 0;
 }
 
 /*
- * Write a block.
+ * Write a block. It goes to the disk later; see <buf.h>.
  */
 int
 sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct buf *buf;
+	int result;
 
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
-	return sfs_rwblock(sfs, &ku);
+	result = buffer_get(sfs->sfs_device, block, SFS_BLOCKSIZE, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(buffer_map(buf), data, len);
+	buffer_mark_dirty(buf);
+	buffer_release(buf);
+	return 0;
 }
 
 ////////////////////////////////////////////////////////////
@@ -137,8 +104,8 @@ sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 
 /*
  * Do I/O to a block of a file that doesn't cover the whole block.  We
- * need to read in the original block first, even if we're writing, so
- * we don't clobber the portion of the block we're not intending to
+ * need the original block in the cache first, even if we're writing,
+ * so we don't clobber the portion of the block we're not intending to
  * write over.
  *
  * SKIPSTART is the number of bytes to skip past at the beginning of
@@ -150,16 +117,8 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -169,9 +128,6 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
@@ -184,58 +140,57 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		return uiomovezeros(len, uio);
 	}
 
 	/*
-	 * Now perform the requested operation into/out of the buffer.
+	 * Get the block.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = buffer_read(sfs->sfs_device, diskblock, SFS_BLOCKSIZE, &buf);
 	if (result) {
 		return result;
 	}
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * Now perform the requested operation into/out of the buffer.
+	 * If it was a write, mark the block dirty. (Even if the uiomove
+	 * failed partway; part of the block may have changed.)
 	 */
+	result = uiomove((char *)buffer_map(buf) + skipstart, len, uio);
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		buffer_mark_dirty(buf);
 	}
 
-	return 0;
+	buffer_release(buf);
+	return result;
 }
 
 /*
- * Do I/O (either read or write) of a single whole block.
+ * Do I/O (either read or write) of up to MAXBLOCKS whole blocks
+ * starting at the current offset. As many of them as map to
+ * consecutive disk blocks (at most BUFFER_MAXRUN) are done as one run
+ * through the buffer cache, so a read is one device request for the
+ * lot. (Writes just dirty the buffers; the cache writes consecutive
+ * dirty blocks back together later.) Returns the number of blocks
+ * done in *DONE.
  */
 static
 int
-sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
+sfs_blockio(struct sfs_vnode *sv, struct uio *uio, uint32_t maxblocks,
+	    uint32_t *done)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
-	daddr_t diskblock;
-	uint32_t fileblock;
+	struct buf *bufs[BUFFER_MAXRUN];
+	daddr_t diskblock, nextblock;
+	uint32_t fileblock, n, i;
 	int result;
 	bool doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
+
+	KASSERT(maxblocks > 0);
+	*done = 0;
 
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
@@ -254,49 +209,156 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 		 * allocated a block for us.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
+		*done = 1;
 		return uiomovezeros(SFS_BLOCKSIZE, uio);
 	}
 
-	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
-	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
+	/* See how far the disk blocks run on consecutively */
+	if (maxblocks > BUFFER_MAXRUN) {
+		maxblocks = BUFFER_MAXRUN;
+	}
+	for (n=1; n<maxblocks; n++) {
+		result = sfs_bmap(sv, fileblock + n, doalloc, &nextblock);
+		if (result) {
+			return result;
+		}
+		if (nextblock != diskblock + n) {
+			break;
+		}
+	}
+
+	KASSERT(uio->uio_resid >= n * SFS_BLOCKSIZE);
+
+	if (uio->uio_rw == UIO_READ) {
+		result = buffer_read_run(sfs->sfs_device, diskblock, n,
+					 SFS_BLOCKSIZE, bufs);
+		if (result) {
+			return result;
+		}
+		for (i=0; i<n && result == 0; i++) {
+			result = uiomove(buffer_map(bufs[i]), SFS_BLOCKSIZE,
+					 uio);
+		}
+		*done = i;
+		for (i=0; i<n; i++) {
+			buffer_release(bufs[i]);
+		}
+		return result;
+	}
 
 	/*
-	 * Temporarily set the residue to be one block size.
+	 * We're overwriting the whole blocks, so there's no need to
+	 * read them first.
 	 */
-	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
+	result = buffer_get_run(sfs->sfs_device, diskblock, n, SFS_BLOCKSIZE,
+				bufs);
+	if (result) {
+		return result;
+	}
+	for (i=0; i<n && result == 0; i++) {
+		result = uiomove(buffer_map(bufs[i]), SFS_BLOCKSIZE, uio);
+		/*
+		 * If the uiomove failed partway, part of the block may
+		 * have changed; that's worth writing only if the rest
+		 * of it is the block's old contents.
+		 */
+		if (result == 0 || buffer_is_valid(bufs[i])) {
+			buffer_mark_dirty(bufs[i]);
+		}
+	}
+	*done = i;
 
-	result = sfs_rwblock(sfs, uio);
+	for (i=0; i<n; i++) {
+		if (!buffer_is_valid(bufs[i])) {
+			/* Partly filled with user data and partly garbage */
+			buffer_release_and_invalidate(bufs[i]);
+		}
+		else {
+			buffer_release(bufs[i]);
+		}
+	}
+	return result;
+}
+
+/*
+ * Read-ahead. Called after a successful read of file bytes [POS,
+ * ENDPOS). If the read picked up where the last one left off (or in
+ * the last block it touched, for small reads), the window doubles, up
+ * to SFS_RA_MAX blocks; otherwise it drops back to SFS_RA_MIN. Then
+ * we ask the buffer cache to start reading the blocks in the window
+ * past the end of this read that haven't been asked for already.
+ *
+ * Holes are skipped, and nothing is allocated.
+ */
+static
+void
+sfs_readahead(struct sfs_vnode *sv, off_t pos, off_t endpos)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t firstblock, next, start, end, fileblocks, i;
+	daddr_t diskblock;
+
+	firstblock = pos / SFS_BLOCKSIZE;
+	next = DIVROUNDUP(endpos, SFS_BLOCKSIZE);
+	fileblocks = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
 
 	/*
-	 * Now, restore the original uio_offset and uio_resid and update
-	 * them by the amount of I/O done.
+	 * Other readers may be here at the same time, so settle the
+	 * window under sv_ralock and claim the blocks to prefetch by
+	 * moving sv_raend past them before letting go.
 	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+	spinlock_acquire(&sv->sv_ralock);
+	if (sv->sv_rawindow != 0 &&
+	    (firstblock == sv->sv_ranext || firstblock + 1 == sv->sv_ranext)) {
+		sv->sv_rawindow *= 2;
+		if (sv->sv_rawindow > SFS_RA_MAX) {
+			sv->sv_rawindow = SFS_RA_MAX;
+		}
+	}
+	else {
+		sv->sv_rawindow = SFS_RA_MIN;
+		sv->sv_raend = 0;
+	}
+	sv->sv_ranext = next;
 
-	return result;
+	start = next > sv->sv_raend ? next : sv->sv_raend;
+	end = next + sv->sv_rawindow;
+	if (end > fileblocks) {
+		end = fileblocks;
+	}
+	if (end > sv->sv_raend) {
+		sv->sv_raend = end;
+	}
+	spinlock_release(&sv->sv_ralock);
+
+	for (i=start; i<end; i++) {
+		if (sfs_bmap(sv, i, false, &diskblock)) {
+			/* not worth failing the read over */
+			break;
+		}
+		if (diskblock != 0) {
+			buffer_prefetch(sfs->sfs_device, diskblock,
+					SFS_BLOCKSIZE);
+		}
+	}
 }
 
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
+ * The caller must hold the vnode's lock: shared to read, exclusive to
+ * write.
  */
 int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
 	uint32_t blkoff;
-	uint32_t nblocks, i;
+	uint32_t nblocks, done;
 	int result = 0;
 	uint32_t origresid, extraresid = 0;
+	off_t origpos;
 
 	origresid = uio->uio_resid;
+	origpos = uio->uio_offset;
 
 	/*
 	 * If reading, check for EOF. If we can read a partial area,
@@ -352,11 +414,12 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	 */
 	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
 	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
-	for (i=0; i<nblocks; i++) {
-		result = sfs_blockio(sv, uio);
+	while (nblocks > 0) {
+		result = sfs_blockio(sv, uio, nblocks, &done);
 		if (result) {
 			goto out;
 		}
+		nblocks -= done;
 	}
 
 	/*
@@ -381,6 +444,12 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 		sv->sv_dirty = true;
 	}
 
+	/* If reading and it went through, start on what comes next */
+	if (result == 0 && uio->uio_rw == UIO_READ &&
+	    uio->uio_resid != origresid) {
+		sfs_readahead(sv, origpos, uio->uio_offset);
+	}
+
 	/* Add in any extra amount we couldn't read because of EOF */
 	uio->uio_resid += extraresid;
 
@@ -407,6 +476,7 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	   enum uio_rw rw)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
 	off_t endpos;
 	uint32_t vnblock;
 	uint32_t blockoffset;
@@ -414,18 +484,6 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	bool doalloc;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
-
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Figure out which block of the vnode (directory, whatever) this is */
 	vnblock = actualpos / SFS_BLOCKSIZE;
 	blockoffset = actualpos % SFS_BLOCKSIZE;
@@ -446,26 +504,20 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		return 0;
 	}
 
-	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	/* Get the block */
+	result = buffer_read(sfs->sfs_device, diskblock, SFS_BLOCKSIZE, &buf);
 	if (result) {
 		return result;
 	}
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
-		memcpy(data, metaiobuf + blockoffset, len);
+		memcpy(data, (char *)buffer_map(buf) + blockoffset, len);
 	}
 	else {
 		/* Update the selected region */
-		memcpy(metaiobuf + blockoffset, data, len);
-
-		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
-		if (result) {
-			return result;
-		}
+		memcpy((char *)buffer_map(buf) + blockoffset, data, len);
+		buffer_mark_dirty(buf);
 
 		/* Update the vnode size if needed */
 		endpos = actualpos + len;
@@ -475,6 +527,8 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		}
 	}
 
+	buffer_release(buf);
+
 	/* Done */
 	return 0;
 }
@@ -38,7 +38,9 @@
 #include <stat.h>
 #include <lib.h>
 #include <uio.h>
+#include <synch.h>
 #include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -102,9 +104,9 @@ sfs_read(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
-	vfs_biglock_acquire();
+	rwlock_acquire_read(sv->sv_lock);
 	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	rwlock_release_read(sv->sv_lock);
 
 	return result;
 }
@@ -121,13 +123,56 @@ sfs_write(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
-	vfs_biglock_acquire();
+	rwlock_acquire_write(sv->sv_lock);
 	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	rwlock_release_write(sv->sv_lock);
 
 	return result;
 }
 
+/*
+ * Called for getdirentry(). The uio offset is the directory slot to
+ * start at; empty slots are skipped, and on return the offset is the
+ * slot after the one whose name was read. At the end of the directory
+ * nothing is transferred.
+ */
+static
+int
+sfs_getdirentry(struct vnode *v, struct uio *uio)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	char name[SFS_NAMELEN];
+	int slot, result;
+
+	KASSERT(uio->uio_rw==UIO_READ);
+
+	/* the offset is a slot number and must fit in an int */
+	slot = uio->uio_offset;
+	if (slot < 0 || (off_t)slot != uio->uio_offset) {
+		return EINVAL;
+	}
+
+	rwlock_acquire_read(sv->sv_lock);
+	result = sfs_dir_nextname(sv, &slot, name);
+	rwlock_release_read(sv->sv_lock);
+	if (result) {
+		return result;
+	}
+	if (slot < 0) {
+		/* EOF */
+		return 0;
+	}
+
+	/* NAME is our own copy, so the lock isn't needed for this */
+	result = uiomove(name, strlen(name), uio);
+	if (result) {
+		return result;
+	}
+	uio->uio_offset = slot + 1;
+
+	return 0;
+}
+
 /*
  * Called for ioctl()
  */
@@ -164,12 +209,17 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 		return result;
 	}
 
+	rwlock_acquire_read(sv->sv_lock);
 	statbuf->st_size = sv->sv_i.sfi_size;
 	statbuf->st_nlink = sv->sv_i.sfi_linkcount;
+	rwlock_release_read(sv->sv_lock);
 
 	/* We don't support this yet */
 	statbuf->st_blocks = 0;
 
+	/* Whole-block transfers avoid read-modify-write in sfs_io */
+	statbuf->st_blksize = SFS_BLOCKSIZE;
+
 	/* Fill in other fields as desired/possible... */
 
 	return 0;
@@ -185,16 +235,13 @@ sfs_gettype(struct vnode *v, uint32_t *ret)
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
 
-	vfs_biglock_acquire();
-
+	/* The type never changes, so this doesn't need the lock */
 	switch (sv->sv_i.sfi_type) {
 	case SFS_TYPE_FILE:
 		*ret = S_IFREG;
-		vfs_biglock_release();
 		return 0;
 	case SFS_TYPE_DIR:
 		*ret = S_IFDIR;
-		vfs_biglock_release();
 		return 0;
 	}
 	panic("sfs: %s: gettype: Invalid inode type (inode %u, type %u)\n",
@@ -222,13 +269,22 @@ int
 sfs_fsync(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	int result;
 
-	vfs_biglock_acquire();
+	rwlock_acquire_write(sv->sv_lock);
 	result = sfs_sync_inode(sv);
-	vfs_biglock_release();
+	rwlock_release_write(sv->sv_lock);
+	if (result) {
+		return result;
+	}
 
-	return result;
+	/*
+	 * The inode and the file's data may still be only in the
+	 * buffer cache. We don't keep track of which buffers belong
+	 * to which file, so push out the whole volume's.
+	 */
+	return buffer_sync(sfs->sfs_device);
 }
 
 /*
@@ -250,8 +306,13 @@ int
 sfs_truncate(struct vnode *v, off_t len)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	int result;
+
+	rwlock_acquire_write(sv->sv_lock);
+	result = sfs_itrunc(sv, len);
+	rwlock_release_write(sv->sv_lock);
 
-	return sfs_itrunc(sv, len);
+	return result;
 }
 
 /*
@@ -289,18 +350,18 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	uint32_t ino;
 	int result;
 
-	vfs_biglock_acquire();
+	rwlock_acquire_write(sv->sv_lock);
 
 	/* Look up the name */
 	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
 	if (result!=0 && result!=ENOENT) {
-		vfs_biglock_release();
+		rwlock_release_write(sv->sv_lock);
 		return result;
 	}
 
 	/* If it exists and we didn't want it to, fail */
 	if (result==0 && excl) {
-		vfs_biglock_release();
+		rwlock_release_write(sv->sv_lock);
 		return EEXIST;
 	}
 
@@ -308,18 +369,18 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 		/* We got something; load its vnode and return */
 		result = sfs_loadvnode(sfs, ino, SFS_TYPE_INVAL, &newguy);
 		if (result) {
-			vfs_biglock_release();
+			rwlock_release_write(sv->sv_lock);
 			return result;
 		}
 		*ret = &newguy->sv_absvn;
-		vfs_biglock_release();
+		rwlock_release_write(sv->sv_lock);
 		return 0;
 	}
 
 	/* Didn't exist - create it */
 	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
 	if (result) {
-		vfs_biglock_release();
+		rwlock_release_write(sv->sv_lock);
 		return result;
 	}
 
@@ -330,19 +391,19 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
 	if (result) {
 		VOP_DECREF(&newguy->sv_absvn);
-		vfs_biglock_release();
+		rwlock_release_write(sv->sv_lock);
 		return result;
 	}
 
-	/* Update the linkcount of the new file */
+	/* Update the linkcount of the new file, and mark it dirty */
+	rwlock_acquire_write(newguy->sv_lock);
 	newguy->sv_i.sfi_linkcount++;
-
-	/* and consequently mark it dirty. */
 	newguy->sv_dirty = true;
+	rwlock_release_write(newguy->sv_lock);
 
 	*ret = &newguy->sv_absvn;
 
-	vfs_biglock_release();
+	rwlock_release_write(sv->sv_lock);
 	return 0;
 }
 
@@ -361,18 +422,20 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 
 	KASSERT(file->vn_fs == dir->vn_fs);
 
-	vfs_biglock_acquire();
-
 	/* Hard links to directories aren't allowed. */
 	if (f->sv_i.sfi_type == SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return EINVAL;
 	}
 
+	/* Directory first, then the file; see <sfs.h> */
+	rwlock_acquire_write(sv->sv_lock);
+	rwlock_acquire_write(f->sv_lock);
+
 	/* Create the link */
 	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
 	if (result) {
-		vfs_biglock_release();
+		rwlock_release_write(f->sv_lock);
+		rwlock_release_write(sv->sv_lock);
 		return result;
 	}
 
@@ -380,7 +443,8 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 	f->sv_i.sfi_linkcount++;
 	f->sv_dirty = true;
 
-	vfs_biglock_release();
+	rwlock_release_write(f->sv_lock);
+	rwlock_release_write(sv->sv_lock);
 	return 0;
 }
 
@@ -396,16 +460,27 @@ sfs_remove(struct vnode *dir, const char *name)
 	int slot;
 	int result;
 
-	vfs_biglock_acquire();
+	rwlock_acquire_write(sv->sv_lock);
 
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
-		vfs_biglock_release();
+		rwlock_release_write(sv->sv_lock);
 		return result;
 	}
 
+	/*
+	 * Directories (which can only be . and .. here) are for
+	 * rmdir. This also keeps us from locking SV twice.
+	 */
+	if (victim->sv_i.sfi_type == SFS_TYPE_DIR) {
+		VOP_DECREF(&victim->sv_absvn);
+		rwlock_release_write(sv->sv_lock);
+		return EISDIR;
+	}
+
 	/* Erase its directory entry. */
+	rwlock_acquire_write(victim->sv_lock);
 	result = sfs_dir_unlink(sv, slot);
 	if (result==0) {
 		/* If we succeeded, decrement the link count. */
@@ -413,11 +488,16 @@ sfs_remove(struct vnode *dir, const char *name)
 		victim->sv_i.sfi_linkcount--;
 		victim->sv_dirty = true;
 	}
+	rwlock_release_write(victim->sv_lock);
 
-	/* Discard the reference that sfs_lookonce got us */
+	/*
+	 * Discard the reference that sfs_lookonce got us. This may
+	 * reclaim the vnode, which takes its lock, so we can't be
+	 * holding that; the directory's is fine.
+	 */
 	VOP_DECREF(&victim->sv_absvn);
 
-	vfs_biglock_release();
+	rwlock_release_write(sv->sv_lock);
 	return result;
 }
 
@@ -425,7 +505,8 @@ sfs_remove(struct vnode *dir, const char *name)
  * Rename a file.
  *
  * Since we don't support subdirectories, assumes that the two
- * directories passed are the same.
+ * directories passed are the same. That makes the locking easy: lock
+ * the directory once, then the file.
  */
 static
 int
@@ -438,21 +519,23 @@ sfs_rename(struct vnode *d1, const char *n1,
 	int slot1, slot2;
 	int result, result2;
 
-	vfs_biglock_acquire();
-
 	KASSERT(d1==d2);
 	KASSERT(sv->sv_ino == SFS_ROOTDIR_INO);
 
+	rwlock_acquire_write(sv->sv_lock);
+
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
-		vfs_biglock_release();
+		rwlock_release_write(sv->sv_lock);
 		return result;
 	}
 
 	/* We don't support subdirectories */
 	KASSERT(g1->sv_i.sfi_type == SFS_TYPE_FILE);
 
+	rwlock_acquire_write(g1->sv_lock);
+
 	/*
 	 * Link it under the new name.
 	 *
@@ -485,9 +568,10 @@ sfs_rename(struct vnode *d1, const char *n1,
 	g1->sv_dirty = true;
 
 	/* Let go of the reference to g1 */
+	rwlock_release_write(g1->sv_lock);
 	VOP_DECREF(&g1->sv_absvn);
 
-	vfs_biglock_release();
+	rwlock_release_write(sv->sv_lock);
 	return 0;
 
  puke_harder:
@@ -506,8 +590,9 @@ sfs_rename(struct vnode *d1, const char *n1,
 	g1->sv_i.sfi_linkcount--;
  puke:
 	/* Let go of the reference to g1 */
+	rwlock_release_write(g1->sv_lock);
 	VOP_DECREF(&g1->sv_absvn);
-	vfs_biglock_release();
+	rwlock_release_write(sv->sv_lock);
 	return result;
 }
 
@@ -516,7 +601,8 @@ sfs_rename(struct vnode *d1, const char *n1,
  * directory it's in as a vnode.
  *
  * Since we don't support subdirectories, this is very easy -
- * return the root dir and copy the path.
+ * return the root dir and copy the path. Nothing here changes, so
+ * no locking is needed.
  */
 static
 int
@@ -525,15 +611,11 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 {
 	struct sfs_vnode *sv = v->vn_data;
 
-	vfs_biglock_acquire();
-
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
 	if (strlen(path)+1 > buflen) {
-		vfs_biglock_release();
 		return ENAMETOOLONG;
 	}
 	strcpy(buf, path);
@@ -541,7 +623,6 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 	VOP_INCREF(&sv->sv_absvn);
 	*ret = &sv->sv_absvn;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -559,22 +640,18 @@ sfs_lookup(struct vnode *v, char *path, struct vnode **ret)
 	struct sfs_vnode *final;
 	int result;
 
-	vfs_biglock_acquire();
-
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
+	rwlock_acquire_read(sv->sv_lock);
 	result = sfs_lookonce(sv, path, &final, NULL);
+	rwlock_release_read(sv->sv_lock);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	*ret = &final->sv_absvn;
-
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -626,7 +703,7 @@ const struct vnode_ops sfs_dirops = {
 
 	.vop_read = vopfail_uio_isdir,
 	.vop_readlink = vopfail_uio_inval,
-	.vop_getdirentry = vopfail_uio_nosys,
+	.vop_getdirentry = sfs_getdirentry,
 	.vop_write = vopfail_uio_isdir,
 	.vop_ioctl = sfs_ioctl,
 	.vop_stat = sfs_stat,
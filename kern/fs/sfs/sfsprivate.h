@@ -37,6 +37,10 @@
 extern const struct vnode_ops sfs_fileops;
 extern const struct vnode_ops sfs_dirops;
 
+/* Read-ahead window bounds, in blocks (see sfs_readahead in sfs_io.c) */
+#define SFS_RA_MIN	4
+#define SFS_RA_MAX	32
+
 /* Macro for initializing a uio structure */
 #define SFSUIO(iov, uio, ptr, block, rw) \
     uio_kinit(iov, uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
@@ -51,6 +55,7 @@ int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
 int sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		daddr_t *diskblock);
 int sfs_itrunc(struct sfs_vnode *sv, off_t len);
+void sfs_bmap_dropidmap(struct sfs_vnode *sv);
 
 /* Functions in sfs_dir.c */
 int sfs_dir_findname(struct sfs_vnode *sv, const char *name,
@@ -58,11 +63,18 @@ int sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 int sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino,
 		int *slot);
 int sfs_dir_unlink(struct sfs_vnode *sv, int slot);
+int sfs_dir_nextname(struct sfs_vnode *sv, int *slot, char *name);
+void sfs_dir_dropindex(struct sfs_vnode *sv);
 int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		struct sfs_vnode **ret,
 		int *slot);
 
+/* Initial number of chains in the loaded-vnode table (a power of 2) */
+#define SFS_VNHASH_INITSIZE	32
+
 /* Functions in sfs_inode.c */
+int sfs_vnhash_init(struct sfs_fs *sfs);
+void sfs_vnhash_cleanup(struct sfs_fs *sfs);
 int sfs_sync_inode(struct sfs_vnode *sv);
 int sfs_reclaim(struct vnode *v);
 int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
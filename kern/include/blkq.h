@@ -0,0 +1,134 @@
+#ifndef _BLKQ_H_
+#define _BLKQ_H_
+
+/*
+ * Block request queue.
+ *
+ * A block device driver that can only do one thing at a time puts a
+ * queue in front of itself, and the queue decides what goes to the
+ * device next. Requests wait in the queue until the device is free;
+ * then the queue picks the next one using C-LOOK: the one starting at
+ * the lowest block at or past where the last one ended, or, if there
+ * is none, the lowest block of all, so the head sweeps across the disk
+ * in one direction and jumps back. So that requests far from where
+ * the head is working aren't put off forever, one that has been
+ * passed over for BLKQ_DEADLINE dispatches goes next regardless.
+ *
+ * Requests that go in the same direction and start where the chosen
+ * one ends are merged onto it, up to BLKQ_MAXMERGE blocks in all, and
+ * the whole run goes to the driver at once, linked through
+ * br_mergenext.
+ *
+ * The driver supplies a start function, which is called (with the
+ * queue's spinlock held, possibly from the driver's own interrupt
+ * handler) to begin a run. It must not wait for anything, and must not
+ * call back into the queue. As each request in the run finishes the
+ * driver calls blkq_done() for it, in order, from any context; after
+ * the last one, the queue starts the next run. The driver must not
+ * touch a request after calling blkq_done() on it.
+ *
+ * blkq_io() does a uio's worth of I/O through the queue and waits for
+ * it, for use in the driver's devop_io; blkq_submit() puts requests in
+ * without waiting, for the driver's devop_submit (see <device.h>).
+ *
+ * Every request has a callback. The request belongs to the queue (or
+ * device) until the callback is called, once, when it finishes; the
+ * callback then owns it. The callback runs from the driver's interrupt
+ * handler (so it must not sleep) unless br_inthread is set, in which
+ * case it is handed to a worker thread and may do as it likes. Either
+ * way the queue's lock isn't held, so the callback may submit more
+ * requests. A device that isn't driven by a queue, such as one built
+ * on other devices, finishes requests with blkq_complete(), and can
+ * implement its devop_io with blkq_devio() on top of its devop_submit.
+ */
+
+#include <spinlock.h>
+
+struct uio;     /* in <uio.h> */
+struct device;  /* in <device.h> */
+
+/* Most dispatches a request can be passed over for. */
+#define BLKQ_DEADLINE	16
+
+/* Most blocks in one merged run. */
+#define BLKQ_MAXMERGE	64
+
+/*
+ * One request: NBLOCKS blocks starting at BLOCK, to or from the
+ * kernel buffer DATA.
+ */
+struct blkreq {
+	daddr_t br_block;		/* first block */
+	uint32_t br_nblocks;		/* number of blocks */
+	bool br_iswrite;		/* direction */
+	void *br_data;			/* kernel buffer */
+	void (*br_callback)(struct blkreq *req); /* called when done */
+	void *br_cbdata;		/* for the callback */
+	bool br_inthread;		/* run the callback in a thread */
+
+	/* Set by the queue */
+	int br_result;			/* error, once done */
+	unsigned br_seq;		/* dispatch count when queued */
+	struct blkreq *br_next;		/* next waiting, or to call back */
+	struct blkreq *br_mergenext;	/* next request in the same run */
+};
+
+struct blkq {
+	char *bq_name;
+	struct spinlock bq_lock;	/* protects everything below */
+
+	/* The driver */
+	void (*bq_start)(void *data, struct blkreq *run);
+	void *bq_data;
+
+	/* Waiting requests, in the order they came in */
+	struct blkreq *bq_head;
+	struct blkreq *bq_tail;
+
+	struct blkreq *bq_active;	/* request in progress, or NULL */
+	daddr_t bq_pos;			/* block after the last run */
+	unsigned bq_seq;		/* number of runs dispatched */
+
+	/* Statistics */
+	unsigned bq_nreqs;		/* requests queued */
+	unsigned bq_nmerged;		/* requests merged onto another */
+	unsigned bq_nexpired;		/* requests sent for BLKQ_DEADLINE */
+	uint64_t bq_seekdist;		/* blocks between runs, in all */
+
+	struct blkq *bq_nextq;		/* list of all queues */
+};
+
+/* Create a queue for a driver with start function START. */
+struct blkq *blkq_create(const char *name,
+			 void (*start)(void *data, struct blkreq *run),
+			 void *data);
+
+/* Destroy an idle queue. */
+void blkq_destroy(struct blkq *q);
+
+/* Driver: REQ, the oldest in the current run, finished with RESULT. */
+void blkq_done(struct blkq *q, struct blkreq *req, int result);
+
+/* Put N requests in the queue, without waiting. */
+void blkq_submit(struct blkq *q, struct blkreq *reqs, unsigned n);
+
+/* Finish REQ with RESULT: call its callback, or have it called. */
+void blkq_complete(struct blkreq *req, int result);
+
+/*
+ * Do the I/O for UIO, which must start on a block boundary and be a
+ * whole number of blocks of BLOCKSIZE bytes, through the queue. Its
+ * iovecs needn't be whole blocks.
+ */
+int blkq_io(struct blkq *q, struct uio *uio, uint32_t blocksize);
+
+/* Same, but through dev_submit on D, and in D's blocks. */
+int blkq_devio(struct device *d, struct uio *uio);
+
+/* Print statistics for all queues. */
+void blkq_printstats(void);
+
+/* Set up; start the worker thread for callbacks. */
+void blkq_bootstrap(void);
+
+#endif /* _BLKQ_H_ */
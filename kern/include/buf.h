@@ -0,0 +1,115 @@
+#ifndef _BUF_H_
+#define _BUF_H_
+
+/*
+ * Buffer cache.
+ *
+ * Blocks of block devices are cached in memory, keyed by device and
+ * block number. A file system gets a buffer with buffer_read() (which
+ * reads the block if it isn't cached) or buffer_get() (which doesn't,
+ * for when the whole block is about to be overwritten), works on the
+ * data through buffer_map(), and hands it back with buffer_release().
+ * While a buffer is held no one else can get it; a second request
+ * for the same block waits.
+ *
+ * A buffer whose data has been changed must be marked dirty. Dirty
+ * buffers are written back when they are evicted, when buffer_sync()
+ * is called for their device, or right away with buffer_writeout().
+ * Otherwise a flusher thread writes them in the background: any that
+ * have been dirty for BUFFER_FLUSH_AGE seconds, and the least recently
+ * used ones whenever more than BUFFER_DIRTY_BG bytes are dirty. Past
+ * BUFFER_DIRTY_MAX dirty bytes, buffer_release() writes a dirty buffer
+ * back itself before handing it back, which slows writers down to the
+ * speed of the disk.
+ *
+ * Buffers no one holds are kept on an LRU list and the least recently
+ * used one is recycled once the cache is at BUFFER_MAXMEM bytes. (If
+ * every buffer is held, the cache grows past the limit rather than
+ * fail.)
+ *
+ * Runs of consecutive blocks can be got, read, and written out
+ * together with the _run variants, which issue one device request per
+ * stretch of blocks that need I/O rather than one per block. A run is
+ * at most BUFFER_MAXRUN blocks.
+ *
+ * buffer_prefetch() asks for a block to be read into the cache in the
+ * background, for read-ahead. A kernel thread starts asynchronous
+ * reads for the requests without waiting for each, so several can be
+ * in flight. Requests that don't fit in the queue are dropped.
+ */
+
+struct device;
+struct buf;
+
+/* Most memory the cache uses for block data before it recycles buffers. */
+#define BUFFER_MAXMEM	(512 * 1024)
+
+/* Write-back thresholds; see above. */
+#define BUFFER_FLUSH_AGE	5	/* seconds */
+#define BUFFER_DIRTY_BG		(BUFFER_MAXMEM / 4)
+#define BUFFER_DIRTY_MAX	(BUFFER_MAXMEM / 2)
+
+/* Most blocks in one run. */
+#define BUFFER_MAXRUN	16
+
+/* Most prefetch requests waiting at once. */
+#define BUFFER_PREFETCH_MAX	64
+
+/* Get the buffer for BLOCK (of SIZE bytes) on DEV, reading it in if needed. */
+int buffer_read(struct device *dev, daddr_t block, size_t size,
+		struct buf **ret);
+
+/* Same, but without reading; the contents are undefined unless cached. */
+int buffer_get(struct device *dev, daddr_t block, size_t size,
+	       struct buf **ret);
+
+/* Get or read N consecutive blocks from BLOCK into BUFS[0..N-1]. */
+int buffer_get_run(struct device *dev, daddr_t block, unsigned n,
+		   size_t size, struct buf **bufs);
+int buffer_read_run(struct device *dev, daddr_t block, unsigned n,
+		    size_t size, struct buf **bufs);
+
+/* Start reading BLOCK (of SIZE bytes) on DEV into the cache; don't wait. */
+void buffer_prefetch(struct device *dev, daddr_t block, size_t size);
+
+/* Get at the data of a buffer we hold. */
+void *buffer_map(struct buf *b);
+
+/* True if the buffer's data is the block's contents. */
+bool buffer_is_valid(struct buf *b);
+
+/* The data has been filled in (after buffer_get). */
+void buffer_mark_valid(struct buf *b);
+
+/* The data has been changed and must be written back. Implies valid. */
+void buffer_mark_dirty(struct buf *b);
+
+/* Write a held buffer back now, if it is dirty. */
+int buffer_writeout(struct buf *b);
+
+/* Write out the dirty buffers of a held run. */
+int buffer_writeout_run(struct buf **bufs, unsigned n);
+
+/* Hand a buffer back. */
+void buffer_release(struct buf *b);
+
+/* Hand a buffer back and forget its contents, e.g. after a failed fill. */
+void buffer_release_and_invalidate(struct buf *b);
+
+/*
+ * Write back all dirty buffers of DEV (or of every device, if NULL),
+ * including any the flusher is writing at the time. The caller must
+ * not hold any buffers.
+ */
+int buffer_sync(struct device *dev);
+
+/* Forget all buffers of DEV, which must be synced and not in use. */
+void buffer_drop(struct device *dev);
+
+/* Print cache statistics. */
+void buffer_printstats(void);
+
+/* Initialize the cache. */
+void buffer_bootstrap(void);
+
+#endif /* _BUF_H_ */
@@ -51,16 +51,19 @@
 /*
  * Tell GCC how to check printf formats. Also tell it about functions
  * that don't return, as this is helpful for avoiding bogus warnings
- * about uninitialized variables.
+ * about uninitialized variables. __ALIGNED gives a type or variable
+ * at least the alignment N.
  */
 #ifdef __GNUC__
 #define __PF(a,b) __attribute__((__format__(__printf__, a, b)))
 #define __DEAD    __attribute__((__noreturn__))
 #define __UNUSED  __attribute__((__unused__))
+#define __ALIGNED(n) __attribute__((__aligned__(n)))
 #else
 #define __PF(a,b)
 #define __DEAD
 #define __UNUSED
+#define __ALIGNED(n)
 #endif
 
 
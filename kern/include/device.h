@@ -36,6 +36,7 @@
 
 
 struct uio;  /* in <uio.h> */
+struct blkreq;  /* in <blkq.h> */
 
 /*
  * Filesystem-namespace-accessible device.
@@ -56,11 +57,15 @@ struct device {
  *      devop_eachopen - called on each open call to allow denying the open
  *      devop_io - for both reads and writes (the uio indicates the direction)
  *      devop_ioctl - miscellaneous control operations
+ *      devop_submit - start an asynchronous block request and return
+ *                     without waiting; the request's callback is called
+ *                     when it finishes. Optional; see dev_submit.
  */
 struct device_ops {
 	int (*devop_eachopen)(struct device *, int flags_from_open);
 	int (*devop_io)(struct device *, struct uio *);
 	int (*devop_ioctl)(struct device *, int op, userptr_t data);
+	int (*devop_submit)(struct device *, struct blkreq *);
 };
 
 /*
@@ -69,6 +74,7 @@ struct device_ops {
 #define DEVOP_EACHOPEN(d, f)	((d)->d_ops->devop_eachopen(d, f))
 #define DEVOP_IO(d, u)		((d)->d_ops->devop_io(d, u))
 #define DEVOP_IOCTL(d, op, p)	((d)->d_ops->devop_ioctl(d, op, p))
+#define DEVOP_SUBMIT(d, r)	((d)->d_ops->devop_submit(d, r))
 
 
 /* Create vnode for a vfs-level device. */
@@ -77,9 +83,24 @@ struct vnode *dev_create_vnode(struct device *dev);
 /* Undo dev_create_vnode. */
 void dev_uncreate_vnode(struct vnode *vn);
 
+/*
+ * Start an asynchronous block request, which must have a callback, on
+ * any device. Devices without devop_submit do the I/O with devop_io
+ * before returning and call the callback from there. Returns an error
+ * (and doesn't call the callback) only if the request can't be
+ * started at all.
+ */
+int dev_submit(struct device *dev, struct blkreq *req);
+
 /* Initialization functions for builtin vfs-level devices. */
 void devnull_create(void);
 
+/*
+ * Create a RAM disk of NBLOCKS 512-byte blocks, initially all zeros,
+ * and add it as a mountable device named ramN.
+ */
+int ramdisk_create(blkcnt_t nblocks);
+
 /* Function that kicks off device probe and attach. */
 void dev_bootstrap(void);
 
@@ -23,16 +23,47 @@
 #define STDOUT_FD       1
 #define STDERR_FD       2
 
-/* global open file table entry includes file pointer (offset) and vnode pointer. */
+/* sys_copy_file_range moves COPY_CHUNK_BLOCKS blocks per VOP_READ/VOP_WRITE pair. */
+#define COPY_CHUNK_BLOCKS       32
+/* block size used when the file system does not report one. */
+#define COPY_DEFAULT_BLKSIZE    512
+
+/* largest user buffer sys_getdirentries fills in one call; bigger buffers just get fewer entries. */
+#define GETDIRENT_MAXBUF        8192
+
+/*
+ * global open file table entry includes file pointer (offset) and vnode pointer.
+ * of_lock protects fp and ref_count, so offset updates on different open files
+ * never contend with each other or with the table-wide oft_lock. reads and writes
+ * at the file pointer of a seekable object hold it across the transfer.
+ */
 struct of_entry {
     off_t fp;
     struct vnode *v_ptr;
     int ref_count;
+    struct lock *of_lock;
+};
+
+/*
+ * the global open file table grows on demand one chunk of slots at a time.
+ * chunks never move once allocated, so an entry can be looked up without oft_lock.
+ */
+#define OFT_CHUNK_SIZE  OPEN_MAX
+#define OFT_MAX_CHUNKS  64
+/* maximum number of open files in the whole system. */
+#define SYSTEM_OPEN_MAX (OFT_CHUNK_SIZE * OFT_MAX_CHUNKS)
+
+/* chunk of open file slots, next_free links the free slots into a list. */
+struct oft_chunk {
+    struct of_entry *open_files[OFT_CHUNK_SIZE];
+    int next_free[OFT_CHUNK_SIZE];
 };
 
-/* global open file table data structure, lock is included for synchronisation. */
+/* global open file table data structure, oft_lock only guards slot allocation and release. */
 struct of_table {
-    struct of_entry *open_files[OPEN_MAX];
+    struct oft_chunk *chunks[OFT_MAX_CHUNKS];
+    unsigned num_chunks;
+    int free_head;      /* first free slot, FREE_SLOT when every chunk is full */
     struct lock *oft_lock;
 };
 
@@ -52,9 +83,43 @@ int sys_write(int fd, userptr_t buf, size_t nbytes, int *bytes_written);
 /* sys_read - read from a file located at fd. */
 int sys_read(int fd, userptr_t buf, size_t nbytes, int *bytes_read);
 
+/* sys_pwrite - write out to a file located at fd at offset, without using the file pointer. */
+int sys_pwrite(int fd, userptr_t buf, size_t nbytes, off_t offset, int *bytes_written);
+
+/* sys_pread - read from a file located at fd at offset, without using the file pointer. */
+int sys_pread(int fd, userptr_t buf, size_t nbytes, off_t offset, int *bytes_read);
+
+/* sys_readv - read from a file located at fd into several user buffers in one call. */
+int sys_readv(int fd, userptr_t iov, int iovcnt, int *bytes_read);
+
+/* sys_writev - write out several user buffers to a file located at fd in one call. */
+int sys_writev(int fd, userptr_t iov, int iovcnt, int *bytes_written);
+
+/* sys_preadv - vectored sys_pread. */
+int sys_preadv(int fd, userptr_t iov, int iovcnt, off_t offset, int *bytes_read);
+
+/* sys_pwritev - vectored sys_pwrite. */
+int sys_pwritev(int fd, userptr_t iov, int iovcnt, off_t offset, int *bytes_written);
+
 /* sys_lseek - alters seek location of file, to a new position based on pos and whence. */
 int sys_lseek(int fd, off_t offset, int whence, off_t *new_fp);
 
+/* sys_pipe - create an anonymous pipe, returning read and write file descriptors in fds. */
+int sys_pipe(userptr_t fds, int *retval);
+
+/* sys_copy_file_range - copy a byte range from fd_in to fd_out without leaving the kernel. */
+int sys_copy_file_range(int fd_in, userptr_t off_in, int fd_out, userptr_t off_out,
+                        size_t len, int *bytes_copied);
+
+/* sys_getdirentries - read many directory entries, optionally with type and size, in one call. */
+int sys_getdirentries(int fd, userptr_t buf, size_t buflen, int flags, int *bytes_read);
+
+/* sys_fbatch_setup - registers a batched file operation ring, see <kern/fbatch.h>. */
+int sys_fbatch_setup(userptr_t ring, unsigned entries, int *retval);
+
+/* sys_fbatch_enter - runs queued operations from the registered ring in one call. */
+int sys_fbatch_enter(unsigned to_submit, int *retval);
+
 /* sys_dup2 - clones the file handle oldfd onto the file handle newfd. */
 int sys_dup2(int old_fd, int new_fd, int *retval);
 
@@ -68,6 +133,9 @@ int init_global_oft(void);
 /* adds an entry into global oft with vnode pointer and file pointer (offset). */
 int add_global_oft(off_t fp, struct vnode *v_ptr, int *ofptr);
 
+/* returns the open file entry at location ofptr. */
+struct of_entry *get_global_oft(int ofptr);
+
 /* removes an entry from the global oft. */
 int rem_global_oft(int ofptr);
 
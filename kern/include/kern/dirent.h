@@ -0,0 +1,32 @@
+#ifndef _KERN_DIRENT_H_
+#define _KERN_DIRENT_H_
+
+/*
+ * Records returned by getdirentries().
+ *
+ * Each call packs as many directory entries as fit into the caller's
+ * buffer, one struct dirent each, back to back. d_reclen is the
+ * distance to the next record. The name is NUL-terminated.
+ *
+ * With GETDIRENT_STAT, d_type and d_size describe the object each
+ * name refers to, looked up during the same call; d_type is the
+ * _S_IF* file type from <kern/stattypes.h> shifted right by 12 bits.
+ * Otherwise, or if the object could not be looked up, both are 0.
+ */
+
+/* Flags for getdirentries() */
+#define GETDIRENT_STAT	1	/* also fill in d_type and d_size */
+
+struct dirent {
+	__u16 d_reclen;			/* length of this record */
+	__u16 d_namlen;			/* length of d_name, without the NUL */
+	__u32 d_type;			/* file type, or 0 */
+	__i64 d_size;			/* size in bytes */
+	char d_name[];			/* name, NUL-terminated */
+};
+
+/* Record length for a name of NAMLEN bytes; keeps records 8-byte aligned. */
+#define DIRENT_RECLEN(namlen) \
+	((sizeof(struct dirent) + (namlen) + 1 + 7) & ~(size_t)7)
+
+#endif /* _KERN_DIRENT_H_ */
@@ -0,0 +1,77 @@
+#ifndef _KERN_FBATCH_H_
+#define _KERN_FBATCH_H_
+
+/*
+ * Batched file operations.
+ *
+ * A process lays out a ring in its own memory and registers it once
+ * with __fbatch_setup(). It then queues file operations as submission
+ * entries and calls __fbatch_enter() to have the kernel run a batch of
+ * them in a single trap. Each operation that is run posts exactly one
+ * completion entry, in submission order.
+ *
+ * Ring layout in user memory: struct fbatch_ring, followed by
+ * fr_entries submission entries, followed by fr_entries completion
+ * entries. Use FBATCH_SQES_OFFSET, FBATCH_CQES_OFFSET and
+ * FBATCH_RING_SIZE to find them.
+ *
+ * The head and tail counters run freely and wrap; the slot for
+ * counter value c is c % fr_entries. Userlevel writes fr_sq_tail and
+ * fr_cq_head; the kernel writes fr_sq_head and fr_cq_tail.
+ */
+
+/* Operations (fs_op). */
+#define FBATCH_OP_NOP     0	/* no-op, completes with 0 */
+#define FBATCH_OP_OPEN    1	/* fs_buf = path, fs_flags = flags, fs_mode */
+#define FBATCH_OP_CLOSE   2	/* fs_fd */
+#define FBATCH_OP_READ    3	/* fs_fd, fs_buf, fs_len */
+#define FBATCH_OP_WRITE   4	/* fs_fd, fs_buf, fs_len */
+#define FBATCH_OP_PREAD   5	/* fs_fd, fs_buf, fs_len, fs_pos */
+#define FBATCH_OP_PWRITE  6	/* fs_fd, fs_buf, fs_len, fs_pos */
+#define FBATCH_OP_LSEEK   7	/* fs_fd, fs_pos, fs_flags = whence */
+
+/* Largest ring the kernel accepts. */
+#define FBATCH_MAX_ENTRIES 256
+
+/* Submission queue entry. */
+struct fbatch_sqe {
+	off_t fs_pos;			/* file position, for pread/pwrite/lseek */
+#ifdef _KERNEL
+	userptr_t fs_buf;		/* data buffer, or path for open */
+#else
+	void *fs_buf;			/* data buffer, or path for open */
+#endif
+	size_t fs_len;			/* length of data buffer */
+	int fs_op;			/* FBATCH_OP_* */
+	int fs_fd;			/* file handle */
+	int fs_flags;			/* open flags or lseek whence */
+	mode_t fs_mode;			/* open mode */
+	__u32 fs_cookie;		/* passed through to the completion */
+	__u32 fs_reserved;		/* must be zero, else EINVAL */
+};
+
+/* Completion queue entry. */
+struct fbatch_cqe {
+	off_t fc_result;		/* fd, byte count or new position */
+	int fc_error;			/* 0 on success, otherwise an errno */
+	__u32 fc_cookie;		/* fs_cookie of the submission */
+};
+
+/* Ring header. */
+struct fbatch_ring {
+	unsigned fr_entries;		/* number of sqe and cqe slots */
+	unsigned fr_sq_head;		/* next sqe the kernel will consume */
+	unsigned fr_sq_tail;		/* next sqe slot userlevel will fill */
+	unsigned fr_cq_head;		/* next cqe userlevel will consume */
+	unsigned fr_cq_tail;		/* next cqe slot the kernel will fill */
+	unsigned fr_reserved;		/* keeps the entries 8-byte aligned */
+};
+
+#define FBATCH_SQES_OFFSET \
+	(sizeof(struct fbatch_ring))
+#define FBATCH_CQES_OFFSET(n) \
+	(FBATCH_SQES_OFFSET + (n) * sizeof(struct fbatch_sqe))
+#define FBATCH_RING_SIZE(n) \
+	(FBATCH_CQES_OFFSET(n) + (n) * sizeof(struct fbatch_cqe))
+
+#endif /* _KERN_FBATCH_H_ */
@@ -62,6 +62,48 @@
 /* Size of free block bitmap (in blocks) */
 #define SFS_FREEMAPBLOCKS(nblocks)  (SFS_FREEMAPBITS(nblocks)/SFS_BITSPERBLOCK)
 
+/*
+ * Directory index. A directory with SFS_DIRINDEX_MIN or more slots
+ * gets a hash table from names to slots, kept in blocks listed in
+ * sfi_dirindex. Viewed as one array of SFS_DIRINDEX_NENTRIES 32-bit
+ * entries (SFS_DIRINDEX_PERBLOCK to a block, in sfi_dirindex order; a
+ * zero block number stands for a block of empty entries), the table
+ * uses open addressing: the name with hash H is found by probing from
+ * entry H % SFS_DIRINDEX_NENTRIES upward, wrapping around, until an
+ * empty entry. An entry holds the high half of the name's hash and
+ * the slot number plus one (see the macros below). Deleted entries
+ * are kept as SFS_DIRINDEX_DELETED so probing carries on past them;
+ * sfi_dirdeleted counts them, and once there are more than
+ * SFS_DIRINDEX_MAXDELETED the index is rebuilt without them. Adding a
+ * name reuses the first deleted entry on its probe path.
+ *
+ * An indexed directory also has a free slot map, in the block
+ * sfi_dirfreemap: bit i (bit i % 8 of byte i / 8) is set exactly when
+ * slot i is an empty slot within sfi_size, so a new name goes in the
+ * lowest free slot without reading the directory. A directory has an
+ * index if and only if sfi_dirfreemap is nonzero.
+ *
+ * The hash is 32-bit FNV-1a over the bytes of the name:
+ *	h = 2166136261; for each byte c: h = (h ^ c) * 16777619.
+ *
+ * The index is only an accelerator: every entry it leads to is checked
+ * against the directory itself, and a directory whose sfi_dirfreemap
+ * is zero is simply searched the old way. sfsck checks the index
+ * and discards it if it is wrong, and it is rebuilt the next time a
+ * name is added.
+ */
+#define SFS_DIRINDEX_NBLOCKS  16          /* index blocks per directory */
+#define SFS_DIRINDEX_MIN      32          /* slots before we build one */
+#define SFS_DIRINDEX_MAXDELETED (SFS_DIRINDEX_NENTRIES / 4)
+#define SFS_DIRINDEX_PERBLOCK (SFS_BLOCKSIZE / sizeof(uint32_t))
+#define SFS_DIRINDEX_NENTRIES (SFS_DIRINDEX_NBLOCKS * SFS_DIRINDEX_PERBLOCK)
+#define SFS_DIRINDEX_EMPTY    0
+#define SFS_DIRINDEX_DELETED  0xffffffff
+#define SFS_DIRINDEX_ENTRY(hash, slot) \
+	(((hash) & 0xffff0000) | ((uint32_t)(slot) + 1))
+#define SFS_DIRINDEX_TAG(ent)  ((ent) & 0xffff0000)
+#define SFS_DIRINDEX_SLOT(ent) (((ent) & 0xffff) - 1)
+
 /* File types for sfi_type */
 #define SFS_TYPE_INVAL    0       /* Should not appear on disk */
 #define SFS_TYPE_FILE     1
@@ -86,7 +128,11 @@ struct sfs_dinode {
 	uint16_t sfi_linkcount;			/* # hard links to this file */
 	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_dirindex[SFS_DIRINDEX_NBLOCKS]; /* Directory index */
+	uint32_t sfi_dirfreemap;		/* Directory free slot map */
+	uint32_t sfi_dirdeleted;		/* Deleted index entries */
+	uint32_t sfi_waste[128-5-SFS_NDIRECT-SFS_DIRINDEX_NBLOCKS];
+						/* unused space, set to 0 */
 };
 
 /*
@@ -109,13 +109,13 @@
 #define SYS_close        49
 #define SYS_read         50
 #define SYS_pread        51
-//#define SYS_readv      52
-//#define SYS_preadv     53
+#define SYS_readv        52
+#define SYS_preadv       53
 #define SYS_getdirentry  54
 #define SYS_write        55
 #define SYS_pwrite       56
-//#define SYS_writev     57
-//#define SYS_pwritev    58
+#define SYS_writev       57
+#define SYS_pwritev      58
 #define SYS_lseek        59
 #define SYS_flock        60
 #define SYS_ftruncate    61
@@ -197,6 +197,16 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- Batched file operations --
+#define SYS___fbatch_setup 121
+#define SYS___fbatch_enter 122
+
+//                              -- In-kernel file copy --
+#define SYS_copy_file_range 123
+
+//                              -- Batched directory read --
+#define SYS_getdirentries 124
+
 /*CALLEND*/
 
 
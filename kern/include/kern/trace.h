@@ -0,0 +1,41 @@
+#ifndef _KERN_TRACE_H_
+#define _KERN_TRACE_H_
+
+/*
+ * System call trace records, as read from the "trace:" device.
+ *
+ * Each cpu logs the system calls it runs for traced processes into a
+ * ring of its own. Reading trace: returns whole records, oldest first
+ * within each cpu, and consumes them. If a ring wraps before it is
+ * read the oldest records are lost; a gap in tr_seq shows where.
+ *
+ * Writing "on" or "off" to trace: switches tracing for the calling
+ * process.
+ *
+ * Timestamps are the cpu cycle counter, which is 32 bits wide and
+ * wraps; tr_exit - tr_enter (unsigned) is the time spent in the call.
+ *
+ * The arguments are logged as the call saw them, after decoding: one
+ * per C argument whether it came in a register or on the stack, and
+ * 64-bit ones whole. Bit i of tr_wide is set if argument i is 64-bit;
+ * the others are zero-extended. If the arguments could not be fetched
+ * tr_nargs is 0.
+ */
+
+/* Most arguments logged for one call. */
+#define TRACE_MAXARGS	6
+
+struct trace_record {
+	__u32 tr_seq;			/* per-cpu sequence number */
+	__u16 tr_cpu;			/* cpu the call ran on */
+	__i16 tr_callno;		/* SYS_* */
+	__u16 tr_nargs;			/* entries of tr_args used */
+	__u16 tr_wide;			/* which of them are 64-bit */
+	__i32 tr_err;			/* errno, or 0 */
+	__u64 tr_args[TRACE_MAXARGS];	/* arguments, decoded */
+	__i64 tr_retval;		/* return value, if tr_err is 0 */
+	__u32 tr_enter;			/* cycle count on entry */
+	__u32 tr_exit;			/* cycle count on exit */
+};
+
+#endif /* _KERN_TRACE_H_ */
@@ -0,0 +1,28 @@
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+/*
+ * Anonymous pipes.
+ *
+ * A pipe is a ring buffer with two vnodes, one for each end. Reads
+ * and writes copy straight into and out of the ring without a sleep
+ * lock; a thread only sleeps (on a wchan) when the ring is empty
+ * (reader) or too full (writer). Writes of at most PIPE_BUF bytes are
+ * atomic.
+ */
+
+#include <limits.h>
+
+struct vnode;
+
+/* Ring buffer size; must be a power of two and at least PIPE_BUF. */
+#define PIPE_SIZE	(PIPE_BUF * 8)
+
+/*
+ * Create a pipe. On success, *rd_ret and *wr_ret hold one reference
+ * each to the read and write end. Release them with vfs_close(); once
+ * both are gone the pipe is destroyed.
+ */
+int pipe_create(struct vnode **rd_ret, struct vnode **wr_ret);
+
+#endif /* _PIPE_H_ */
@@ -76,6 +76,13 @@ struct proc {
 
 	/* file descriptor table*/
 	int *fd_table;
+
+	/* batched file operation ring registered by __fbatch_setup(), NULL if none */
+	userptr_t p_fbring;
+	unsigned p_fbentries;
+
+	/* log this process's system calls to trace: */
+	bool p_trace;
 };
 
 /* This is the process structure for the kernel and for kernel-only threads. */
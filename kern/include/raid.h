@@ -0,0 +1,36 @@
+#ifndef _RAID_H_
+#define _RAID_H_
+
+/*
+ * Software RAID: block devices made out of other block devices.
+ *
+ * raid_stripe_create makes a striped (RAID-0) device over NDISKS
+ * mountable block devices named in DISKNAMES, which must all have the
+ * same block size. The device's blocks are dealt out to the disks in
+ * turn, STRIPEBLOCKS at a time, so large transfers keep all the disks
+ * busy at once. Its size is NDISKS times the smallest disk, rounded
+ * down to a whole stripe.
+ *
+ * raid_mirror_create makes a mirrored (RAID-1) device over NDISKS
+ * disks, each holding a full copy of it; its size is that of the
+ * smallest disk. Writes go to every disk. Each read goes to just one,
+ * the one with the fewest requests outstanding, and of those the one
+ * that last worked nearest the block asked for, so several reads at
+ * once are spread across the disks. If a read fails it is tried on
+ * the other disks in turn.
+ *
+ * The disks are claimed (see vfs_claimdev) so they can no longer be
+ * mounted on their own, and the new device is added to VFS as a
+ * mountable device named stripe0, stripe1, ... or mirror0, mirror1,
+ * ... in the order they are made. Devices made this way last until
+ * shutdown.
+ */
+
+/* Most disks in one device. */
+#define RAID_MAXDISKS	8
+
+int raid_stripe_create(uint32_t stripeblocks, unsigned ndisks,
+		       char **disknames);
+int raid_mirror_create(unsigned ndisks, char **disknames);
+
+#endif /* _RAID_H_ */
@@ -48,14 +48,57 @@
  */
 #include <kern/sfs.h>
 
+/*
+ * Locking
+ *
+ * Each vnode's sv_lock is a reader-writer lock covering its in-memory
+ * inode (sv_i and sv_dirty) and for a directory its contents,
+ * including the directory index and free slot map. It is held shared
+ * to read a file, look up a name, read a directory entry, or stat, so
+ * any number of these can run on the same vnode at once, and held
+ * exclusively for everything that changes something. Since readers
+ * share it, the read-ahead state has its own spinlock, sv_ralock,
+ * which is never held across I/O. sv_idmap, the cached copy of the
+ * indirect block, is covered by sv_lock, except that a reader holding
+ * it shared may install one where there was none, under sv_idmaplock.
+ * sfs_vnlock covers the table of loaded vnodes (sfs_vnhash and
+ * everything that goes with it), and sfs_freemaplock covers the free
+ * block bitmap. The superblock and sfi_type don't change once loaded
+ * and need no lock.
+ *
+ * Locks are acquired in this order:
+ *
+ *	1. a directory's sv_lock
+ *	2. the sv_lock of a file in that directory
+ *	3. sfs_vnlock
+ *	4. sfs_freemaplock
+ *
+ * and the buffer cache's own locks come after all of these. So link,
+ * remove, and rename lock the directory, then look up and lock the
+ * file; and since SFS has only the one directory, rename's two
+ * directories are always the same one and are locked once.
+ * sfs_reclaim takes the vnode's own lock and then sfs_vnlock, so a
+ * vnode's lock must not be held when its last reference is dropped.
+ * vfs_biglock, which covers only the VFS device list and
+ * mounting, comes before all of them.
+ */
+
 /*
  * In-memory inode
  */
 struct sfs_vnode {
 	struct vnode sv_absvn;          /* abstract vnode structure */
+	struct rwlock *sv_lock;         /* see above */
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct spinlock sv_ralock;      /* protects the next three */
+	uint32_t sv_ranext;             /* file block a sequential read wants */
+	uint32_t sv_rawindow;           /* read-ahead window, in blocks */
+	uint32_t sv_raend;              /* file blocks before this prefetched */
+	struct sfs_vnode *sv_hashnext;  /* next in sfs_vnhash chain */
+	struct spinlock sv_idmaplock;   /* for installing sv_idmap */
+	uint32_t *sv_idmap;             /* copy of indirect block, or NULL */
 };
 
 /*
@@ -66,7 +109,11 @@ struct sfs_fs {
 	struct sfs_superblock sfs_sb;	/* copy of on-disk superblock */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
-	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct lock *sfs_vnlock;        /* protects the vnode table */
+	struct sfs_vnode **sfs_vnhash;  /* vnodes loaded into memory, by ino */
+	unsigned sfs_vnhashsize;        /* number of chains in sfs_vnhash */
+	unsigned sfs_nvnodes;           /* number of vnodes loaded */
+	struct lock *sfs_freemaplock;   /* protects the freemap */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
 };
@@ -140,4 +140,57 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of threads can hold the lock for reading at the same
+ * time, or one thread can hold it for writing. Writers are preferred:
+ * once a writer is waiting, new readers wait behind it, so a steady
+ * stream of readers can't starve writers out. The lock is not
+ * recursive in either mode; note that a thread that already holds it
+ * for reading and asks for it again will deadlock if a writer has
+ * started waiting in between.
+ *
+ * The deadlock detector sees a writer as the holder. Readers are not
+ * recorded (there can be many), so cycles through a read hold are not
+ * detected.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct rwlock {
+        char *rw_name;
+        HANGMAN_LOCKABLE(rw_hangman);   /* Deadlock detector hook. */
+        struct wchan *rw_readwchan;     /* Readers wait here. */
+        struct wchan *rw_writewchan;    /* Writers wait here. */
+        struct spinlock rw_lock;
+        volatile unsigned rw_readers;   /* Number holding it to read. */
+        volatile unsigned rw_writewaiters; /* Number waiting to write. */
+        struct thread *volatile rw_writer; /* Holder for writing, if any. */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_release_read  - Give up a read hold.
+ *    rwlock_acquire_write - Get the lock for writing.
+ *    rwlock_release_write - Give up a write hold. Only the thread
+ *                   holding the lock for writing may do this.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                   the lock for writing; false otherwise.
+ *    rwlock_is_held - Return true if any thread holds the lock in
+ *                   either mode. Readers aren't tracked individually,
+ *                   so this is mostly good for assertions.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+bool rwlock_is_held(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
@@ -40,6 +40,24 @@ struct trapframe; /* from <machine/trapframe.h> */
 
 void syscall(struct trapframe *tf);
 
+/*
+ * A system call argument as the dispatcher decodes it: sa_word for a
+ * 32-bit argument (SCARG_WORD), sa_dword for a 64-bit one
+ * (SCARG_DWORD).
+ */
+#define SYSCALL_MAXARGS		6	/* most arguments any call takes */
+
+#define SCARG_WORD	0		/* 32-bit argument */
+#define SCARG_DWORD	1		/* 64-bit argument */
+
+union syscall_arg {
+	uint32_t sa_word;
+	uint64_t sa_dword;
+};
+
+/* Print per-syscall call/error/cycle counters; zero them if RESET. */
+void syscall_stats(bool reset);
+
 /*
  * Support functions.
  */
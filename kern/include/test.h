@@ -79,6 +79,23 @@ int semu20(int, char **);
 int semu21(int, char **);
 int semu22(int, char **);
 
+/* rwlock unit tests */
+int rwu1(int, char **);
+int rwu2(int, char **);
+int rwu3(int, char **);
+int rwu4(int, char **);
+int rwu5(int, char **);
+int rwu6(int, char **);
+int rwu7(int, char **);
+int rwu8(int, char **);
+int rwu9(int, char **);
+int rwu10(int, char **);
+int rwu11(int, char **);
+int rwu12(int, char **);
+int rwu13(int, char **);
+int rwu14(int, char **);
+int rwu15(int, char **);
+
 /* filesystem tests */
 int fstest(int, char **);
 int readstress(int, char **);
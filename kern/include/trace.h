@@ -0,0 +1,36 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+/*
+ * Kernel side of system call tracing. See <kern/trace.h> for the
+ * record format.
+ *
+ * Tracing is switched per process (p_trace); the dispatcher only
+ * calls trace_syscall() when it is on, so untraced processes pay one
+ * test per system call.
+ */
+
+struct cpu;
+union syscall_arg;	/* in <syscall.h> */
+
+/* Records per cpu; must be a power of two. */
+#define TRACE_NRECS	256
+
+/* Initial p_trace for processes started from the menu. */
+extern bool trace_default;
+
+/* Allocate the trace ring for a newly created cpu. Called by cpu_create. */
+void trace_cpu_init(struct cpu *c);
+
+/* Attach the trace: device. */
+void trace_bootstrap(void);
+
+/*
+ * Log one system call on the current cpu: its NARGS decoded arguments
+ * ARGS, of types ARGTYPES (SCARG_*), and how it came out.
+ */
+void trace_syscall(int callno, const union syscall_arg *args,
+		   const unsigned char *argtypes, unsigned nargs,
+		   int64_t retval, int err, uint32_t enter, uint32_t exit);
+
+#endif /* _TRACE_H_ */
@@ -163,6 +163,13 @@ int vfs_getcwd(struct uio *buf);
  *                    previously returned by vfs_swapon should be
  *                    decref'd first. Similar to vfs_unmount.
  *
+ *    vfs_claimdev  - Look up DEVNAME and mark it as in use by another
+ *                    device, such as a RAID built on it, returning
+ *                    the device. It can't then be mounted or swapped
+ *                    on. Similar to vfs_swapon.
+ *
+ *    vfs_releasedev - Undo vfs_claimdev.
+ *
  *    vfs_unmountall - Unmount all mounted filesystems.
  */
 
@@ -181,8 +188,38 @@ int vfs_mount(const char *devname, void *data,
 int vfs_unmount(const char *devname);
 int vfs_swapon(const char *devname, struct vnode **result);
 int vfs_swapoff(const char *devname);
+int vfs_claimdev(const char *devname, struct device **result);
+int vfs_releasedev(const char *devname);
 int vfs_unmountall(void);
 
+/*
+ * Name cache ("dcache"), for file systems that look names up one
+ * directory at a time. It remembers what a name in a directory refers
+ * to, including that it doesn't exist. The file system keeps it up to
+ * date: it must call vfs_dcache_remove whenever it adds or removes a
+ * name, and must do so under the same lock as its lookups, so no one
+ * can cache a stale answer in between. Entries hold references, so
+ * the file system's vnodes must be purged before it can unmount.
+ *
+ *    vfs_dcache_lookup  - Look up NAME in DIR. Returns false if the
+ *                         cache doesn't know. Otherwise returns true
+ *                         with *RET set to the vnode (with a reference
+ *                         for the caller), or to NULL if the name is
+ *                         known not to exist.
+ *    vfs_dcache_enter   - Record that NAME in DIR is VN (NULL if none).
+ *    vfs_dcache_remove  - Forget what NAME in DIR is.
+ *    vfs_dcache_purgefs - Forget everything about file system FS.
+ *    vfs_dcache_printstats - Print hit and miss counts.
+ *    vfs_dcache_bootstrap - Initialize; called by vfs_bootstrap.
+ */
+bool vfs_dcache_lookup(struct vnode *dir, const char *name,
+		       struct vnode **ret);
+void vfs_dcache_enter(struct vnode *dir, const char *name, struct vnode *vn);
+void vfs_dcache_remove(struct vnode *dir, const char *name);
+void vfs_dcache_purgefs(struct fs *fs);
+void vfs_dcache_printstats(void);
+void vfs_dcache_bootstrap(void);
+
 /*
  * Array of vnodes.
  */
@@ -194,7 +231,8 @@ DECLARRAY(vnode, VFSINLINE);
 DEFARRAY(vnode, VFSINLINE);
 
 /*
- * Global one-big-lock for all filesystem operations.
+ * Global lock for the device list, mounting, and the boot filesystem.
+ * File systems lock their own vnodes; see vfslist.c.
  */
 void vfs_biglock_acquire(void);
 void vfs_biglock_release(void);
@@ -51,6 +51,9 @@
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
 #include <file.h>
+#include <trace.h>
+#include <buf.h>
+#include <blkq.h>
 
 
 /*
@@ -113,6 +116,9 @@ boot(void)
 	thread_bootstrap();
 	hardclock_bootstrap();
 	vfs_bootstrap();
+	blkq_bootstrap();
+	buffer_bootstrap();
+	trace_bootstrap();
 	kheap_nextgeneration();
 	/* Probe and initialize devices. Interrupts should come on. */
 	kprintf("Device probe...\n");
@@ -40,8 +40,13 @@
 #include <thread.h>
 #include <proc.h>
 #include <vfs.h>
+#include <device.h>
 #include <sfs.h>
 #include <syscall.h>
+#include <trace.h>
+#include <buf.h>
+#include <blkq.h>
+#include <raid.h>
 #include <test.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
@@ -453,6 +458,90 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+/*
+ * Command to make a RAM disk.
+ */
+static
+int
+cmd_ramdisk(int nargs, char **args)
+{
+	int nblocks;
+
+	if (nargs != 2) {
+		kprintf("Usage: ramdisk blocks\n");
+		return EINVAL;
+	}
+
+	nblocks = atoi(args[1]);
+	if (nblocks <= 0) {
+		kprintf("ramdisk: bad size %s\n", args[1]);
+		return EINVAL;
+	}
+
+	return ramdisk_create(nblocks);
+}
+
+/*
+ * Command to make a striped device out of several disks.
+ */
+static
+int
+cmd_stripe(int nargs, char **args)
+{
+	int stripeblocks;
+	char *device;
+	int i;
+
+	if (nargs < 4) {
+		kprintf("Usage: stripe blocks device device...\n");
+		return EINVAL;
+	}
+
+	stripeblocks = atoi(args[1]);
+	if (stripeblocks <= 0) {
+		kprintf("stripe: bad stripe size %s\n", args[1]);
+		return EINVAL;
+	}
+
+	for (i=2; i<nargs; i++) {
+		device = args[i];
+
+		/* Allow (but do not require) colon after device name */
+		if (device[strlen(device)-1]==':') {
+			device[strlen(device)-1] = 0;
+		}
+	}
+
+	return raid_stripe_create(stripeblocks, nargs - 2, args + 2);
+}
+
+/*
+ * Command to make a mirrored device out of several disks.
+ */
+static
+int
+cmd_mirror(int nargs, char **args)
+{
+	char *device;
+	int i;
+
+	if (nargs < 3) {
+		kprintf("Usage: mirror device device...\n");
+		return EINVAL;
+	}
+
+	for (i=1; i<nargs; i++) {
+		device = args[i];
+
+		/* Allow (but do not require) colon after device name */
+		if (device[strlen(device)-1]==':') {
+			device[strlen(device)-1] = 0;
+		}
+	}
+
+	return raid_mirror_create(nargs - 1, args + 1);
+}
+
 static
 int
 cmd_kheapstats(int nargs, char **args)
@@ -494,6 +583,63 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_scstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		syscall_stats(false);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		syscall_stats(true);
+	}
+	else {
+		kprintf("Usage: scstats [reset]\n");
+	}
+
+	return 0;
+}
+
+/*
+ * Command for printing buffer cache, name cache, and disk queue stats.
+ */
+static
+int
+cmd_bufstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	buffer_printstats();
+	vfs_dcache_printstats();
+	blkq_printstats();
+
+	return 0;
+}
+
+/*
+ * Command to choose whether programs run from the menu are traced.
+ */
+static
+int
+cmd_trace(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		trace_default = true;
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		trace_default = false;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: trace [on|off]\n");
+		return 0;
+	}
+	kprintf("Tracing of new programs is %s\n",
+		trace_default ? "on" : "off");
+
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -529,6 +675,9 @@ static const char *opsmenu[] = {
 	"[mount]   Mount a filesystem        ",
 	"[unmount] Unmount a filesystem      ",
 	"[bootfs]  Set \"boot\" filesystem     ",
+	"[ramdisk] Make a RAM disk           ",
+	"[stripe]  Make a striped device     ",
+	"[mirror]  Make a mirrored device    ",
 	"[pf]      Print a file              ",
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
@@ -571,6 +720,7 @@ static const char *testmenu[] = {
 	"[sy3] CV test                       ",
 	"[sy4] CV test #2                    ",
 	"[semu1-22] Semaphore unit tests     ",
+	"[rwu1-15] Rwlock unit tests         ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
 	"[fs3] FS write stress               ",
@@ -599,6 +749,9 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[scstats] System call stats         ",
+	"[bufstats] Buffer/name cache stats  ",
+	"[trace] Trace new programs [on|off] ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -635,6 +788,9 @@ static struct {
 	{ "mount",	cmd_mount },
 	{ "unmount",	cmd_unmount },
 	{ "bootfs",	cmd_bootfs },
+	{ "ramdisk",	cmd_ramdisk },
+	{ "stripe",	cmd_stripe },
+	{ "mirror",	cmd_mirror },
 	{ "pf",		printfile },
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
@@ -650,6 +806,9 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "scstats",    cmd_scstats },
+	{ "bufstats",   cmd_bufstats },
+	{ "trace",      cmd_trace },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -696,6 +855,21 @@ static struct {
 	{ "semu20",	semu20 },
 	{ "semu21",	semu21 },
 	{ "semu22",	semu22 },
+	{ "rwu1",	rwu1 },
+	{ "rwu2",	rwu2 },
+	{ "rwu3",	rwu3 },
+	{ "rwu4",	rwu4 },
+	{ "rwu5",	rwu5 },
+	{ "rwu6",	rwu6 },
+	{ "rwu7",	rwu7 },
+	{ "rwu8",	rwu8 },
+	{ "rwu9",	rwu9 },
+	{ "rwu10",	rwu10 },
+	{ "rwu11",	rwu11 },
+	{ "rwu12",	rwu12 },
+	{ "rwu13",	rwu13 },
+	{ "rwu14",	rwu14 },
+	{ "rwu15",	rwu15 },
 
 	/* file system assignment tests */
 	{ "fs1",	fstest },
@@ -48,6 +48,7 @@
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
+#include <trace.h>
 #include <kern/errno.h>
 
 /*
@@ -98,6 +99,12 @@ proc_create(const char *name)
 	/* attach file descriptor 2 to stderr open file in global table */
 	proc->fd_table[STDERR_FD] = GLOBAL_STDERR;
 
+	/* no batched file operation ring until the process registers one */
+	proc->p_fbring = NULL;
+	proc->p_fbentries = 0;
+
+	proc->p_trace = false;
+
 	return proc;
 }
 
@@ -235,6 +242,9 @@ proc_create_runprogram(const char *name)
 	}
 	spinlock_release(&curproc->p_lock);
 
+	/* tracing, as chosen with the menu's trace command */
+	newproc->p_trace = trace_default;
+
 	return newproc;
 }
 
@@ -346,7 +356,7 @@ int proc_addfd(int ofptr, int *fd_ptr) {
 
 	KASSERT(proc != NULL);
 	KASSERT(proc->fd_table);
-	KASSERT(ofptr >= 0 && ofptr < OPEN_MAX);
+	KASSERT(ofptr >= 0 && ofptr < SYSTEM_OPEN_MAX);
 
 	/* for dup2 if we pass in a valid fd_ptr we assign ofptr to it. */
 	if (*fd_ptr >= 0 && *fd_ptr < OPEN_MAX) {
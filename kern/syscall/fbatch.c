@@ -0,0 +1,209 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fbatch.h>
+#include <lib.h>
+#include <current.h>
+#include <file.h>
+#include <copyinout.h>
+#include <proc.h>
+
+/*
+ * Batched file operations, see <kern/fbatch.h> for the ring layout.
+ *
+ * The ring lives in the process address space and is accessed with copyin/copyout,
+ * so a batch costs one trap plus a small copy per entry instead of one trap per call.
+ */
+
+/* user address of sqe or cqe slot for counter value c. */
+#define FBATCH_SQE(ring, n, c) \
+    ((userptr_t)(ring) + FBATCH_SQES_OFFSET + ((c) % (n)) * sizeof(struct fbatch_sqe))
+#define FBATCH_CQE(ring, n, c) \
+    ((userptr_t)(ring) + FBATCH_CQES_OFFSET(n) + ((c) % (n)) * sizeof(struct fbatch_cqe))
+
+/*
+ * run a single submission entry through the matching sys_ call and fill in its completion.
+ */
+static void fbatch_run(struct fbatch_sqe *sqe, struct fbatch_cqe *cqe) {
+    int retval = 0;
+    off_t retval64 = 0;
+    int err;
+
+    /* reserved for later use, so refuse anything but zero now. */
+    if (sqe->fs_reserved != 0) {
+        err = EINVAL;
+        goto done;
+    }
+
+    switch (sqe->fs_op) {
+        case FBATCH_OP_NOP:
+        err = 0;
+        break;
+
+        case FBATCH_OP_OPEN:
+        err = sys_open((const_userptr_t)sqe->fs_buf, sqe->fs_flags, sqe->fs_mode, &retval);
+        break;
+
+        case FBATCH_OP_CLOSE:
+        err = sys_close(sqe->fs_fd, &retval);
+        break;
+
+        case FBATCH_OP_READ:
+        err = sys_read(sqe->fs_fd, sqe->fs_buf, sqe->fs_len, &retval);
+        break;
+
+        case FBATCH_OP_WRITE:
+        err = sys_write(sqe->fs_fd, sqe->fs_buf, sqe->fs_len, &retval);
+        break;
+
+        case FBATCH_OP_PREAD:
+        err = sys_pread(sqe->fs_fd, sqe->fs_buf, sqe->fs_len, sqe->fs_pos, &retval);
+        break;
+
+        case FBATCH_OP_PWRITE:
+        err = sys_pwrite(sqe->fs_fd, sqe->fs_buf, sqe->fs_len, sqe->fs_pos, &retval);
+        break;
+
+        case FBATCH_OP_LSEEK:
+        err = sys_lseek(sqe->fs_fd, sqe->fs_pos, sqe->fs_flags, &retval64);
+        break;
+
+        default:
+        err = EINVAL;
+        break;
+    }
+
+done:
+    cqe->fc_cookie = sqe->fs_cookie;
+    cqe->fc_error = err;
+    if (err) {
+        cqe->fc_result = -1;
+    } else if (sqe->fs_op == FBATCH_OP_LSEEK) {
+        cqe->fc_result = retval64;
+    } else {
+        cqe->fc_result = retval;
+    }
+}
+
+/*
+ * registers the ring at user address ring with entries slots for the current process.
+ * a NULL ring unregisters the current one.
+ */
+int sys_fbatch_setup(userptr_t ring, unsigned entries, int *retval) {
+    struct proc *proc = curproc;
+    struct fbatch_ring hdr;
+    int err;
+
+    *retval = -1;
+
+    if (ring == NULL) {
+        proc->p_fbring = NULL;
+        proc->p_fbentries = 0;
+        *retval = 0;
+        return 0;
+    }
+
+    if (entries == 0 || entries > FBATCH_MAX_ENTRIES) {
+        return EINVAL;
+    }
+
+    /* start both queues empty, this also checks the header is writable. */
+    hdr.fr_entries = entries;
+    hdr.fr_sq_head = 0;
+    hdr.fr_sq_tail = 0;
+    hdr.fr_cq_head = 0;
+    hdr.fr_cq_tail = 0;
+    hdr.fr_reserved = 0;
+    err = copyout(&hdr, ring, sizeof(hdr));
+    if (err) {
+        return err;
+    }
+
+    proc->p_fbring = ring;
+    proc->p_fbentries = entries;
+    *retval = 0;
+    return 0;
+}
+
+/*
+ * runs up to to_submit queued operations from the registered ring and returns how many were run.
+ * stops early when the submission queue is empty or the completion queue is full.
+ */
+int sys_fbatch_enter(unsigned to_submit, int *retval) {
+    struct proc *proc = curproc;
+    userptr_t ring = proc->p_fbring;
+    unsigned n = proc->p_fbentries;
+    struct fbatch_ring hdr;
+    struct fbatch_sqe sqe;
+    struct fbatch_cqe cqe;
+    unsigned pending, space, done;
+    int err;
+
+    *retval = -1;
+
+    if (ring == NULL) {
+        return EINVAL;
+    }
+
+    err = copyin((const_userptr_t)ring, &hdr, sizeof(hdr));
+    if (err) {
+        return err;
+    }
+
+    /* the counters are user-writable, so refuse anything that cannot be a valid ring state. */
+    pending = hdr.fr_sq_tail - hdr.fr_sq_head;
+    space = n - (hdr.fr_cq_tail - hdr.fr_cq_head);
+    if (hdr.fr_entries != n || pending > n || space > n) {
+        return EINVAL;
+    }
+
+    if (to_submit > pending) {
+        to_submit = pending;
+    }
+    if (to_submit > space) {
+        to_submit = space;
+    }
+
+    for (done = 0; done < to_submit; done++) {
+        err = copyin((const_userptr_t)FBATCH_SQE(ring, n, hdr.fr_sq_head), &sqe, sizeof(sqe));
+        if (err) {
+            break;
+        }
+        /*
+         * check the cqe slot is writable before running the op; once it has run
+         * it must be consumed and counted, or a retry would run it a second time.
+         */
+        bzero(&cqe, sizeof(cqe));
+        err = copyout(&cqe, FBATCH_CQE(ring, n, hdr.fr_cq_tail), sizeof(cqe));
+        if (err) {
+            break;
+        }
+        fbatch_run(&sqe, &cqe);
+        err = copyout(&cqe, FBATCH_CQE(ring, n, hdr.fr_cq_tail), sizeof(cqe));
+        hdr.fr_sq_head++;
+        hdr.fr_cq_tail++;
+        if (err) {
+            done++;
+            break;
+        }
+    }
+
+    /*
+     * publish only the kernel-owned counters, userlevel may be updating the others.
+     * ops that ran are reported even if a later entry failed, an error from the loop
+     * is returned only when nothing was run at all.
+     */
+    if (done > 0) {
+        err = copyout(&hdr.fr_sq_head,
+                      (userptr_t)&((struct fbatch_ring *)ring)->fr_sq_head, sizeof(unsigned));
+        if (err == 0) {
+            err = copyout(&hdr.fr_cq_tail,
+                          (userptr_t)&((struct fbatch_ring *)ring)->fr_cq_tail, sizeof(unsigned));
+        }
+    }
+    if (err) {
+        return err;
+    }
+
+    *retval = (int) done;
+    return 0;
+}
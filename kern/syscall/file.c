@@ -3,8 +3,11 @@
 #include <kern/fcntl.h>
 #include <kern/limits.h>
 #include <kern/stat.h>
+#include <kern/stattypes.h>
 #include <kern/seek.h>
+#include <kern/dirent.h>
 #include <lib.h>
+#include <limits.h>
 #include <uio.h>
 #include <thread.h>
 #include <current.h>
@@ -15,6 +18,7 @@
 #include <syscall.h>
 #include <copyinout.h>
 #include <proc.h>
+#include <pipe.h>
 
 /*
  * Add your file-related functions here ...
@@ -105,15 +109,38 @@ int sys_close(int fd, int *retval) {
     return 0;
 }
 
+/*
+ * locks the file pointer of an open file for a read or write that starts at it and
+ * moves it along. only seekable objects have a meaningful file pointer; pipes and the
+ * console can block indefinitely, and holding the lock then would stall a close of the
+ * same entry from another process, so they are not locked. returns whether it locked.
+ */
+static bool file_lockpos(struct of_entry *file) {
+    if (!VOP_ISSEEKABLE(file->v_ptr)) {
+        return false;
+    }
+    lock_acquire(file->of_lock);
+    return true;
+}
+
+/*
+ * releases a lock taken by file_lockpos.
+ */
+static void file_unlockpos(struct of_entry *file, bool locked) {
+    if (locked) {
+        lock_release(file->of_lock);
+    }
+}
+
 /*
  * writes nbytes to file specified by fd at the location of the current file pointer.
  */
 int sys_write(int fd, userptr_t buf, size_t nbytes, int *bytes_written) {
-    struct vnode *v_ptr = NULL;
+    struct of_entry *file;
     struct uio myuio;
     struct iovec iov;
     enum uio_rw rw = UIO_WRITE;
-    off_t fp, new_fp;
+    bool seekable;
     int ofptr, err;
 
     /* initialise the bytes written to an invalid value */
@@ -124,12 +151,103 @@ int sys_write(int fd, userptr_t buf, size_t nbytes, int *bytes_written) {
     if (ofptr < 0) {
         return EBADF;
     }
-    /* retrieve vnode pointer and file pointer from global open file table. */
-    v_ptr = global_oft->open_files[ofptr]->v_ptr;
-    fp = global_oft->open_files[ofptr]->fp;
+    file = get_global_oft(ofptr);
+
+    /* hold the entry lock from reading the file pointer to storing it back, so threads
+       sharing it never use the same offset; see file_lockpos. */
+    seekable = file_lockpos(file);
 
     /* initialise uio structure for writing to file */
-    uio_uinit(&iov, &myuio, buf, nbytes, fp, rw);
+    uio_uinit(&iov, &myuio, buf, nbytes, file->fp, rw);
+
+    /* write to file. */
+    err = VOP_WRITE(file->v_ptr, &myuio);
+    if (!err) {
+        /* record the amount of bytes written and move the file pointer past them. */
+        *bytes_written = (int) nbytes - (int) myuio.uio_resid;
+        if (seekable) {
+            file->fp = myuio.uio_offset;
+        }
+    }
+    file_unlockpos(file, seekable);
+
+    return err;
+}
+
+/*
+ * reads nbytes from file specified by fd at the location of the current file pointer.
+ */
+int sys_read(int fd, userptr_t buf, size_t nbytes, int *bytes_read) {
+    struct of_entry *file;
+    struct uio myuio;
+    struct iovec iov;
+    enum uio_rw rw = UIO_READ;
+    bool seekable;
+    int ofptr, err;
+
+    /* initialise the bytes read to an invalid value */
+    *bytes_read = -1;
+
+    /* retrieve open file ptr from process open file table. */
+    ofptr = proc_getoftptr(fd);
+    if (ofptr < 0) {
+        return EBADF;
+    }
+    file = get_global_oft(ofptr);
+
+    /* hold the entry lock from reading the file pointer to storing it back, so threads
+       sharing it never use the same offset; see file_lockpos. */
+    seekable = file_lockpos(file);
+
+    /* initialise uio structure for reading a file */
+    uio_uinit(&iov, &myuio, buf, nbytes, file->fp, rw);
+
+    /* read from file. */
+    err = VOP_READ(file->v_ptr, &myuio);
+    if (!err) {
+        /* record the amount of bytes read and move the file pointer past them. */
+        *bytes_read = (int) nbytes - (int) myuio.uio_resid;
+        if (seekable) {
+            file->fp = myuio.uio_offset;
+        }
+    }
+    file_unlockpos(file, seekable);
+
+    return err;
+}
+
+/*
+ * writes nbytes to file specified by fd at the location offset, the shared file pointer is not used or updated.
+ */
+int sys_pwrite(int fd, userptr_t buf, size_t nbytes, off_t offset, int *bytes_written) {
+    struct vnode *v_ptr = NULL;
+    struct uio myuio;
+    struct iovec iov;
+    enum uio_rw rw = UIO_WRITE;
+    int ofptr, err;
+
+    /* initialise the bytes written to an invalid value */
+    *bytes_written = -1;
+
+    /* retrieve open file ptr from process open file table. */
+    ofptr = proc_getoftptr(fd);
+    if (ofptr < 0) {
+        return EBADF;
+    }
+
+    /* retrieve vnode pointer from global open file table, the of_entry lock is never taken. */
+    v_ptr = get_global_oft(ofptr)->v_ptr;
+
+    /* positioned I/O only makes sense on seekable objects. */
+    if (!VOP_ISSEEKABLE(v_ptr)) {
+        return ESPIPE;
+    }
+    if (offset < 0) {
+        return EINVAL;
+    }
+
+    /* initialise uio structure for writing to file at the given offset */
+    uio_uinit(&iov, &myuio, buf, nbytes, offset, rw);
 
     /* write to file. */
     err = VOP_WRITE(v_ptr, &myuio);
@@ -140,24 +258,20 @@ int sys_write(int fd, userptr_t buf, size_t nbytes, int *bytes_written) {
     /* record the amount of bytes written to file. */
     *bytes_written = (int) nbytes - (int) myuio.uio_resid;
 
-    /* update file pointer to new location in global open file table. */
-    upd_global_oft(ofptr, (off_t) *bytes_written, SEEK_CUR, &new_fp);
-
     return 0;
 }
 
 /*
- * reads nbytes from file specified by fd at the location of the current file pointer.
+ * reads nbytes from file specified by fd at the location offset, the shared file pointer is not used or updated.
  */
-int sys_read(int fd, userptr_t buf, size_t nbytes, int *bytes_read) {
+int sys_pread(int fd, userptr_t buf, size_t nbytes, off_t offset, int *bytes_read) {
     struct vnode *v_ptr = NULL;
     struct uio myuio;
     struct iovec iov;
     enum uio_rw rw = UIO_READ;
-    off_t fp, new_fp;
     int ofptr, err;
 
-    /* initialise the bytes written to an invalid value */
+    /* initialise the bytes read to an invalid value */
     *bytes_read = -1;
 
     /* retrieve open file ptr from process open file table. */
@@ -166,12 +280,19 @@ int sys_read(int fd, userptr_t buf, size_t nbytes, int *bytes_read) {
         return EBADF;
     }
 
-    /* retrieve vnode pointer and file pointer from global open file table. */
-    v_ptr = global_oft->open_files[ofptr]->v_ptr;
-    fp = global_oft->open_files[ofptr]->fp;
+    /* retrieve vnode pointer from global open file table, the of_entry lock is never taken. */
+    v_ptr = get_global_oft(ofptr)->v_ptr;
 
-    /* initialise uio structure for reading a file */
-    uio_uinit(&iov, &myuio, buf, nbytes, fp, rw);
+    /* positioned I/O only makes sense on seekable objects. */
+    if (!VOP_ISSEEKABLE(v_ptr)) {
+        return ESPIPE;
+    }
+    if (offset < 0) {
+        return EINVAL;
+    }
+
+    /* initialise uio structure for reading a file at the given offset */
+    uio_uinit(&iov, &myuio, buf, nbytes, offset, rw);
 
     /* read from file. */
     err = VOP_READ(v_ptr, &myuio);
@@ -179,12 +300,498 @@ int sys_read(int fd, userptr_t buf, size_t nbytes, int *bytes_read) {
         return err;
     }
 
-    /* record the amount of bytes written to file. */
+    /* record the amount of bytes read from file. */
     *bytes_read = (int) nbytes - (int) myuio.uio_resid;
 
-    /* update file pointer to new location in global open file table. */
-    upd_global_oft(ofptr, (off_t) *bytes_read, SEEK_CUR, &new_fp);
+    return 0;
+}
+
+/*
+ * copies the user iovec array into the kernel and initialises a multi-segment uio over it.
+ * the kernel copy of the iovecs is returned in kiov and must be freed by the caller.
+ */
+static int file_uio_viinit(userptr_t iov, int iovcnt, struct iovec **kiov, struct uio *myuio,
+                           off_t pos, enum uio_rw rw) {
+    struct iovec *vec;
+    size_t total = 0;
+    int i, err;
 
+    *kiov = NULL;
+
+    if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+        return EINVAL;
+    }
+
+    vec = (struct iovec *) kmalloc(sizeof(struct iovec) * iovcnt);
+    if (vec == NULL) {
+        return ENOMEM;
+    }
+
+    /* copy the iovec array from user address to kernel address - as the user cannot be trusted. */
+    err = copyin((const_userptr_t) iov, vec, sizeof(struct iovec) * iovcnt);
+    if (err) {
+        kfree(vec);
+        return err;
+    }
+
+    /* the total transfer size must be representable in the ssize_t return value. */
+    for (i = 0; i < iovcnt; i++) {
+        if ((ssize_t) (total + vec[i].iov_len) < (ssize_t) total) {
+            kfree(vec);
+            return EINVAL;
+        }
+        total += vec[i].iov_len;
+    }
+
+    myuio->uio_iov = vec;
+    myuio->uio_iovcnt = iovcnt;
+    myuio->uio_offset = pos;
+    myuio->uio_resid = total;
+    myuio->uio_segflg = UIO_USERSPACE;
+    myuio->uio_rw = rw;
+    myuio->uio_space = proc_getas();
+
+    *kiov = vec;
+    return 0;
+}
+
+/*
+ * performs one vectored read or write on fd, either at the current file pointer
+ * (updated once for the whole transfer) or at an explicit offset.
+ */
+static int file_vio(int fd, userptr_t iov, int iovcnt, bool positioned, off_t offset,
+                    enum uio_rw rw, int *bytes_moved) {
+    struct vnode *v_ptr = NULL;
+    struct of_entry *file;
+    struct iovec *kiov;
+    struct uio myuio;
+    bool locked = false;
+    size_t nbytes;
+    int ofptr, err;
+
+    /* initialise the bytes moved to an invalid value */
+    *bytes_moved = -1;
+
+    /* retrieve open file ptr from process open file table. */
+    ofptr = proc_getoftptr(fd);
+    if (ofptr < 0) {
+        return EBADF;
+    }
+
+    /* retrieve vnode pointer from global open file table. */
+    file = get_global_oft(ofptr);
+    v_ptr = file->v_ptr;
+    if (positioned) {
+        if (!VOP_ISSEEKABLE(v_ptr)) {
+            return ESPIPE;
+        }
+        if (offset < 0) {
+            return EINVAL;
+        }
+    } else {
+        /* use and advance the file pointer under the entry lock; see file_lockpos. */
+        locked = file_lockpos(file);
+        offset = file->fp;
+    }
+
+    /* initialise a single uio spanning every user segment */
+    err = file_uio_viinit(iov, iovcnt, &kiov, &myuio, offset, rw);
+    if (err) {
+        file_unlockpos(file, locked);
+        return err;
+    }
+    nbytes = myuio.uio_resid;
+
+    /* transfer all segments in one trip through the file system. */
+    if (rw == UIO_READ) {
+        err = VOP_READ(v_ptr, &myuio);
+    } else {
+        err = VOP_WRITE(v_ptr, &myuio);
+    }
+    kfree(kiov);
+    if (!err) {
+        /* record the amount of bytes transferred. */
+        *bytes_moved = (int) nbytes - (int) myuio.uio_resid;
+
+        /* update the file pointer once for all segments. */
+        if (locked) {
+            file->fp = myuio.uio_offset;
+        }
+    }
+    file_unlockpos(file, locked);
+
+    return err;
+}
+
+/*
+ * reads into iovcnt user buffers described by iov from the current file pointer of fd.
+ */
+int sys_readv(int fd, userptr_t iov, int iovcnt, int *bytes_read) {
+    return file_vio(fd, iov, iovcnt, false, 0, UIO_READ, bytes_read);
+}
+
+/*
+ * writes out iovcnt user buffers described by iov at the current file pointer of fd.
+ */
+int sys_writev(int fd, userptr_t iov, int iovcnt, int *bytes_written) {
+    return file_vio(fd, iov, iovcnt, false, 0, UIO_WRITE, bytes_written);
+}
+
+/*
+ * reads into iovcnt user buffers described by iov from location offset of fd.
+ */
+int sys_preadv(int fd, userptr_t iov, int iovcnt, off_t offset, int *bytes_read) {
+    return file_vio(fd, iov, iovcnt, true, offset, UIO_READ, bytes_read);
+}
+
+/*
+ * writes out iovcnt user buffers described by iov at location offset of fd.
+ */
+int sys_pwritev(int fd, userptr_t iov, int iovcnt, off_t offset, int *bytes_written) {
+    return file_vio(fd, iov, iovcnt, true, offset, UIO_WRITE, bytes_written);
+}
+
+/*
+ * fetches the starting position for one side of sys_copy_file_range, either from the
+ * user pointer pos_ptr or, when it is NULL, from the shared file pointer.
+ */
+static int copy_getpos(struct of_entry *file, userptr_t pos_ptr, off_t *pos) {
+    int err;
+
+    if (pos_ptr == NULL) {
+        lock_acquire(file->of_lock);
+        *pos = file->fp;
+        lock_release(file->of_lock);
+        return 0;
+    }
+
+    if (!VOP_ISSEEKABLE(file->v_ptr)) {
+        return ESPIPE;
+    }
+    err = copyin((const_userptr_t) pos_ptr, pos, sizeof(off_t));
+    if (err) {
+        return err;
+    }
+    if (*pos < 0) {
+        return EINVAL;
+    }
+    return 0;
+}
+
+/*
+ * stores the final position for one side of sys_copy_file_range back where it came from.
+ */
+static int copy_setpos(int ofptr, userptr_t pos_ptr, off_t pos) {
+    off_t new_fp;
+
+    if (pos_ptr == NULL) {
+        return upd_global_oft(ofptr, pos, SEEK_SET, &new_fp);
+    }
+    return copyout(&pos, pos_ptr, sizeof(off_t));
+}
+
+/*
+ * returns the preferred transfer block size of an open file.
+ */
+static blksize_t copy_blksize(struct vnode *v_ptr) {
+    struct stat file_stat;
+
+    if (VOP_STAT(v_ptr, &file_stat) || file_stat.st_blksize == 0) {
+        return COPY_DEFAULT_BLKSIZE;
+    }
+    return file_stat.st_blksize;
+}
+
+/*
+ * copies up to len bytes from fd_in to fd_out entirely inside the kernel.
+ * a NULL off_in/off_out means use and advance that file's file pointer, otherwise the
+ * offset is read from (and the final offset written back to) the user pointer.
+ * data moves through one kernel buffer in block-aligned chunks of COPY_CHUNK_BLOCKS blocks.
+ */
+int sys_copy_file_range(int fd_in, userptr_t off_in, int fd_out, userptr_t off_out,
+                        size_t len, int *bytes_copied) {
+    struct of_entry *file_in, *file_out;
+    struct uio myuio;
+    struct iovec iov;
+    off_t in_pos, out_pos;
+    size_t bufsize, chunk, got, wrote, total = 0;
+    blksize_t blksize, out_blksize;
+    char *buf;
+    int ofptr_in, ofptr_out, err, err2;
+
+    /* initialise the bytes copied to an invalid value */
+    *bytes_copied = -1;
+
+    /* retrieve open file ptrs from process open file table. */
+    ofptr_in = proc_getoftptr(fd_in);
+    ofptr_out = proc_getoftptr(fd_out);
+    if (ofptr_in < 0 || ofptr_out < 0) {
+        return EBADF;
+    }
+    file_in = get_global_oft(ofptr_in);
+    file_out = get_global_oft(ofptr_out);
+
+    /* the byte count must be representable in the return value. */
+    if ((ssize_t) len < 0) {
+        return EINVAL;
+    }
+
+    err = copy_getpos(file_in, off_in, &in_pos);
+    if (err) {
+        return err;
+    }
+    err = copy_getpos(file_out, off_out, &out_pos);
+    if (err) {
+        return err;
+    }
+
+    /* overlapping ranges of the same file would read back data this call already wrote. */
+    if (file_in->v_ptr == file_out->v_ptr &&
+        in_pos < out_pos + (off_t) len && out_pos < in_pos + (off_t) len) {
+        return EINVAL;
+    }
+
+    /* use the larger of the two block sizes, so reads start and end on block boundaries. */
+    blksize = copy_blksize(file_in->v_ptr);
+    out_blksize = copy_blksize(file_out->v_ptr);
+    if (out_blksize > blksize) {
+        blksize = out_blksize;
+    }
+    bufsize = blksize * COPY_CHUNK_BLOCKS;
+
+    buf = kmalloc(bufsize);
+    if (buf == NULL) {
+        return ENOMEM;
+    }
+
+    while (total < len) {
+        /* the first chunk is trimmed so every later read is block aligned. */
+        chunk = bufsize - (size_t) (in_pos % blksize);
+        if (chunk > len - total) {
+            chunk = len - total;
+        }
+
+        uio_kinit(&iov, &myuio, buf, chunk, in_pos, UIO_READ);
+        err = VOP_READ(file_in->v_ptr, &myuio);
+        if (err) {
+            break;
+        }
+        got = chunk - myuio.uio_resid;
+        if (got == 0) {
+            /* end of file */
+            break;
+        }
+
+        uio_kinit(&iov, &myuio, buf, got, out_pos, UIO_WRITE);
+        err = VOP_WRITE(file_out->v_ptr, &myuio);
+        if (err) {
+            break;
+        }
+        wrote = got - myuio.uio_resid;
+
+        in_pos += wrote;
+        out_pos += wrote;
+        total += wrote;
+        if (wrote < got) {
+            /* short write, e.g. the disk is full */
+            break;
+        }
+    }
+
+    kfree(buf);
+
+    /* like read/write, report an error only if nothing at all was copied. */
+    if (err && total == 0) {
+        return err;
+    }
+
+    /*
+     * publish both positions even if one fails. once bytes have moved the count has to be
+     * reported, so a failure here is only returned when nothing was copied.
+     */
+    err = copy_setpos(ofptr_in, off_in, in_pos);
+    err2 = copy_setpos(ofptr_out, off_out, out_pos);
+    if (err == 0) {
+        err = err2;
+    }
+    if (err && total == 0) {
+        return err;
+    }
+
+    *bytes_copied = (int) total;
+    return 0;
+}
+
+/*
+ * fills in d_type and d_size of ent by looking its name up in the directory dir.
+ * a name that cannot be looked up (e.g. removed since it was read) is left with both 0.
+ */
+static void getdirent_stat(struct vnode *dir, struct dirent *ent) {
+    struct vnode *v_ptr;
+    struct stat file_stat;
+    char name[NAME_MAX + 1];
+
+    /* VOP_LOOKUP may modify the path it is given. */
+    strcpy(name, ent->d_name);
+    if (VOP_LOOKUP(dir, name, &v_ptr)) {
+        return;
+    }
+    if (VOP_STAT(v_ptr, &file_stat) == 0) {
+        ent->d_type = (file_stat.st_mode & _S_IFMT) >> 12;
+        ent->d_size = file_stat.st_size;
+    }
+    VOP_DECREF(v_ptr);
+}
+
+/*
+ * reads as many entries of directory fd as fit in buf, packed as struct dirent records,
+ * starting at and advancing the file pointer. returns the number of bytes filled, 0 at the
+ * end of the directory. with GETDIRENT_STAT each record also gets the type and size of the
+ * object it names, so listings do not need a stat call per entry.
+ */
+int sys_getdirentries(int fd, userptr_t buf, size_t buflen, int flags, int *bytes_read) {
+    struct of_entry *file;
+    struct dirent *ent;
+    struct uio myuio;
+    struct iovec iov;
+    char *kbuf;
+    off_t pos;
+    size_t namelen, used = 0;
+    int ofptr, err = 0;
+
+    /* initialise the bytes read to an invalid value */
+    *bytes_read = -1;
+
+    /* retrieve open file ptr from process open file table. */
+    ofptr = proc_getoftptr(fd);
+    if (ofptr < 0) {
+        return EBADF;
+    }
+    file = get_global_oft(ofptr);
+
+    if (flags & ~GETDIRENT_STAT) {
+        return EINVAL;
+    }
+    /* every call must be able to return at least one entry, whatever its name. */
+    if (buflen < DIRENT_RECLEN(NAME_MAX)) {
+        return EINVAL;
+    }
+    if (buflen > GETDIRENT_MAXBUF) {
+        buflen = GETDIRENT_MAXBUF;
+    }
+
+    kbuf = kmalloc(buflen);
+    if (kbuf == NULL) {
+        return ENOMEM;
+    }
+
+    /* hold the entry lock so the batch reads one contiguous run of the directory. */
+    lock_acquire(file->of_lock);
+    pos = file->fp;
+
+    /* the name is read straight into the record; stop while a longest-possible name still fits. */
+    while (buflen - used >= DIRENT_RECLEN(NAME_MAX)) {
+        ent = (struct dirent *) (kbuf + used);
+
+        uio_kinit(&iov, &myuio, ent->d_name, NAME_MAX, pos, UIO_READ);
+        err = VOP_GETDIRENTRY(file->v_ptr, &myuio);
+        if (err) {
+            break;
+        }
+        namelen = NAME_MAX - myuio.uio_resid;
+        if (namelen == 0) {
+            /* end of directory */
+            break;
+        }
+
+        ent->d_name[namelen] = '\0';
+        ent->d_namlen = namelen;
+        ent->d_reclen = DIRENT_RECLEN(namelen);
+        ent->d_type = 0;
+        ent->d_size = 0;
+        if (flags & GETDIRENT_STAT) {
+            getdirent_stat(file->v_ptr, ent);
+        }
+
+        pos = myuio.uio_offset;
+        used += ent->d_reclen;
+    }
+
+    /* like read, report an error only if no entries were read. */
+    if (used > 0) {
+        err = copyout(kbuf, buf, used);
+        if (!err) {
+            /* only advance past entries the caller actually received. */
+            file->fp = pos;
+        }
+    }
+    lock_release(file->of_lock);
+    kfree(kbuf);
+
+    if (err) {
+        return err;
+    }
+
+    *bytes_read = (int) used;
+    return 0;
+}
+
+/*
+ * creates an anonymous pipe and returns its read and write file descriptors in fds[0] and fds[1].
+ */
+int sys_pipe(userptr_t fds, int *retval) {
+    struct vnode *rd_ptr = NULL;
+    struct vnode *wr_ptr = NULL;
+    int pipe_fds[2] = { -1, -1 };
+    int rd_ofptr = -1;
+    int wr_ofptr = -1;
+    int err, ret;
+
+    /* initialise the return value to an invalid value */
+    *retval = -1;
+
+    err = pipe_create(&rd_ptr, &wr_ptr);
+    if (err) {
+        return err;
+    }
+
+    /* place both ends of the pipe into the global open file table. */
+    err = add_global_oft(0, rd_ptr, &rd_ofptr);
+    if (err) {
+        vfs_close(rd_ptr);
+        vfs_close(wr_ptr);
+        return err;
+    }
+    err = add_global_oft(0, wr_ptr, &wr_ofptr);
+    if (err) {
+        rem_global_oft(rd_ofptr);
+        vfs_close(wr_ptr);
+        return err;
+    }
+
+    /* place the open file pointers into the per process file table. */
+    err = proc_addfd(rd_ofptr, &pipe_fds[0]);
+    if (err) {
+        rem_global_oft(rd_ofptr);
+        rem_global_oft(wr_ofptr);
+        return err;
+    }
+    err = proc_addfd(wr_ofptr, &pipe_fds[1]);
+    if (err) {
+        sys_close(pipe_fds[0], &ret);
+        rem_global_oft(wr_ofptr);
+        return err;
+    }
+
+    /* hand the file descriptors back to the user. */
+    err = copyout(pipe_fds, fds, sizeof(pipe_fds));
+    if (err) {
+        sys_close(pipe_fds[0], &ret);
+        sys_close(pipe_fds[1], &ret);
+        return err;
+    }
+
+    *retval = 0;
     return 0;
 }
 
@@ -206,7 +813,7 @@ int sys_lseek(int fd, off_t offset, int whence, off_t *new_fp) {
     }
 
     /* retrieve vnode pointer and file pointer from global open file table. */
-    v_ptr = global_oft->open_files[ofptr]->v_ptr;
+    v_ptr = get_global_oft(ofptr)->v_ptr;
 
     seekable = VOP_ISSEEKABLE(v_ptr);
     if (!seekable) {
@@ -280,7 +887,7 @@ int init_global_oft(void) {
     char stderr[] = "con:";
     struct vnode *v_out = NULL;
     struct vnode *v_err = NULL;
-    int err, i, ofptr;
+    int err, ofptr;
 
     /* allocate memory for global open file table */
     global_oft = (struct of_table *) kmalloc(sizeof(struct of_table));
@@ -288,8 +895,9 @@ int init_global_oft(void) {
         panic("Cannot allocate memory for global open file table.");
         return ENOMEM;
     }
-    /* initialise all global open file entries to empty slots (NULL). */
-    for (i = 0; i < OPEN_MAX; i++) global_oft->open_files[i] = NULL;
+    /* start with no chunks, the first open allocates chunk 0 with slots 0 and 1 for stdout/stderr. */
+    global_oft->num_chunks = 0;
+    global_oft->free_head = FREE_SLOT;
 
     /* allocate memory for global open file table lock */
     global_oft->oft_lock = lock_create("global oft lock");
@@ -338,19 +946,65 @@ int init_global_oft(void) {
     return 0;
 }
 
+/*
+ * allocates a new chunk of free slots and links them into the free list in ascending order.
+ * must be called with oft_lock held and an empty free list.
+ */
+static int grow_global_oft(void) {
+    struct oft_chunk *chunk;
+    int base, i;
+
+    KASSERT(lock_do_i_hold(global_oft->oft_lock));
+    KASSERT(global_oft->free_head == FREE_SLOT);
+
+    if (global_oft->num_chunks >= OFT_MAX_CHUNKS) {
+        return ENFILE;
+    }
+
+    chunk = (struct oft_chunk *) kmalloc(sizeof(struct oft_chunk));
+    if (chunk == NULL) {
+        return ENOMEM;
+    }
+
+    base = global_oft->num_chunks * OFT_CHUNK_SIZE;
+    for (i = 0; i < OFT_CHUNK_SIZE; i++) {
+        chunk->open_files[i] = NULL;
+        chunk->next_free[i] = (i + 1 < OFT_CHUNK_SIZE) ? base + i + 1 : FREE_SLOT;
+    }
+
+    global_oft->chunks[global_oft->num_chunks] = chunk;
+    global_oft->num_chunks++;
+    global_oft->free_head = base;
+
+    return 0;
+}
+
+/*
+ * returns the open file entry at location ofptr, NULL if the slot is free.
+ * chunks are never freed or moved while the system is running, so no lock is needed.
+ */
+struct of_entry *get_global_oft(int ofptr) {
+    KASSERT(ofptr >= 0 && ofptr < SYSTEM_OPEN_MAX);
+    KASSERT((unsigned) ofptr / OFT_CHUNK_SIZE < global_oft->num_chunks);
+
+    return global_oft->chunks[ofptr / OFT_CHUNK_SIZE]->open_files[ofptr % OFT_CHUNK_SIZE];
+}
+
 /* 
- * adds a new open file to the first available slot in the global open file table.
+ * adds a new open file to the slot at the head of the free list in the global open file table.
  */
 int add_global_oft(off_t fp, struct vnode *v_ptr, int *ofptr) {
-    int i;
     struct of_entry *new_file;
+    struct oft_chunk *chunk;
+    int slot, err;
 
     /* case when dup2 is simply incrementing the reference count */
     if (*ofptr >= 0) {
-        lock_acquire(global_oft->oft_lock);
-        KASSERT(global_oft->open_files[*ofptr] != NULL);
-        global_oft->open_files[*ofptr]->ref_count++;
-        lock_release(global_oft->oft_lock);
+        new_file = get_global_oft(*ofptr);
+        KASSERT(new_file != NULL);
+        lock_acquire(new_file->of_lock);
+        new_file->ref_count++;
+        lock_release(new_file->of_lock);
         return 0;
     }
 
@@ -361,49 +1015,73 @@ int add_global_oft(off_t fp, struct vnode *v_ptr, int *ofptr) {
     if (new_file == NULL) {
         return ENOMEM;
     }
+    new_file->of_lock = lock_create("open file lock");
+    if (new_file->of_lock == NULL) {
+        kfree(new_file);
+        return ENOMEM;
+    }
     new_file->fp = fp;
     new_file->v_ptr = v_ptr;
     new_file->ref_count = 1;
 
-    /* place the new file at the first available free slot */
+    /* pop a free slot off the free list, growing the table if it is full */
     lock_acquire(global_oft->oft_lock);
-    for (i = 0; i < OPEN_MAX; i++) {
-        if (global_oft->open_files[i] == NULL) {
-            global_oft->open_files[i] = new_file;
+    if (global_oft->free_head == FREE_SLOT) {
+        err = grow_global_oft();
+        if (err) {
             lock_release(global_oft->oft_lock);
-            *ofptr = i;
-            return 0;
+            lock_destroy(new_file->of_lock);
+            kfree(new_file);
+            return err;
         }
     }
+    slot = global_oft->free_head;
+    chunk = global_oft->chunks[slot / OFT_CHUNK_SIZE];
+    KASSERT(chunk->open_files[slot % OFT_CHUNK_SIZE] == NULL);
+    global_oft->free_head = chunk->next_free[slot % OFT_CHUNK_SIZE];
+    chunk->open_files[slot % OFT_CHUNK_SIZE] = new_file;
     lock_release(global_oft->oft_lock);
 
-    kfree(new_file);
-    return ENFILE;
+    *ofptr = slot;
+    return 0;
 }
 
 /*
  * decrement ref_count if open file is accessed by other file descriptors, remove otherwise.
  */
 int rem_global_oft(int ofptr) {
-    struct vnode *v_ptr = NULL;
+    struct of_entry *old_file;
+    struct oft_chunk *chunk;
 
-    KASSERT(ofptr >= 0 && ofptr < OPEN_MAX);
+    old_file = get_global_oft(ofptr);
+    KASSERT(old_file != NULL);
 
-    lock_acquire(global_oft->oft_lock);
-    if (global_oft->open_files[ofptr]->ref_count > 1) {
+    lock_acquire(old_file->of_lock);
+    if (old_file->ref_count > 1) {
         /* open file is still being used */
-        global_oft->open_files[ofptr]->ref_count--;
-    } else {
-        /* open file entry can be removed */
-        v_ptr = global_oft->open_files[ofptr]->v_ptr;
-        /* use virtual file system call to close vnode */
-        vfs_close(v_ptr);
-        /* free entry in global open file table */
-        kfree(global_oft->open_files[ofptr]);
-        global_oft->open_files[ofptr] = NULL;
+        old_file->ref_count--;
+        lock_release(old_file->of_lock);
+        return 0;
     }
+    lock_release(old_file->of_lock);
+
+    /*
+     * last reference is gone, so no other thread can reach this entry.
+     * only the slot itself needs the table-wide lock.
+     */
+    lock_acquire(global_oft->oft_lock);
+    chunk = global_oft->chunks[ofptr / OFT_CHUNK_SIZE];
+    chunk->open_files[ofptr % OFT_CHUNK_SIZE] = NULL;
+    chunk->next_free[ofptr % OFT_CHUNK_SIZE] = global_oft->free_head;
+    global_oft->free_head = ofptr;
     lock_release(global_oft->oft_lock);
 
+    /* use virtual file system call to close vnode */
+    vfs_close(old_file->v_ptr);
+    /* free entry removed from global open file table */
+    lock_destroy(old_file->of_lock);
+    kfree(old_file);
+
     return 0;
 }
 
@@ -411,10 +1089,13 @@ int rem_global_oft(int ofptr) {
  * update file pointer at entry ofptr.
  */
 int upd_global_oft(int ofptr, off_t offset, int whence, off_t *new_fp) {
+    struct of_entry *file = get_global_oft(ofptr);
     struct vnode *v_ptr = NULL;
     struct stat file_stat;
     int err = 0;
 
+    KASSERT(file != NULL);
+
     switch (whence) {
         /* new file pointer is 0 (start of file) + offset */
         case SEEK_SET:
@@ -423,38 +1104,38 @@ int upd_global_oft(int ofptr, off_t offset, int whence, off_t *new_fp) {
             err = EINVAL;
             break;
         }
-        lock_acquire(global_oft->oft_lock);
-        global_oft->open_files[ofptr]->fp = *new_fp;
-        lock_release(global_oft->oft_lock);
+        lock_acquire(file->of_lock);
+        file->fp = *new_fp;
+        lock_release(file->of_lock);
         break;
 
         /* new file pointer is current file pointer + offset (used for read/write updates)*/
         case SEEK_CUR:
-        lock_acquire(global_oft->oft_lock);
-        *new_fp = global_oft->open_files[ofptr]->fp + offset;
+        lock_acquire(file->of_lock);
+        *new_fp = file->fp + offset;
         if (*new_fp < 0) {
-            lock_release(global_oft->oft_lock);
+            lock_release(file->of_lock);
             err = EINVAL;
             break;
         }
-        global_oft->open_files[ofptr]->fp = *new_fp;
-        lock_release(global_oft->oft_lock);
+        file->fp = *new_fp;
+        lock_release(file->of_lock);
         break;
 
         /* new file pointer is file size (end of file location) + offset */
         case SEEK_END:
-        lock_acquire(global_oft->oft_lock);
-        v_ptr = global_oft->open_files[ofptr]->v_ptr;
+        lock_acquire(file->of_lock);
+        v_ptr = file->v_ptr;
         /* retrieve file size into location file_stat->st_size */
         VOP_STAT(v_ptr, &file_stat);
         *new_fp = file_stat.st_size + offset;
         if (*new_fp < 0) {
-            lock_release(global_oft->oft_lock);
+            lock_release(file->of_lock);
             err = EINVAL;
             break;
         }
-        global_oft->open_files[ofptr]->fp = *new_fp;
-        lock_release(global_oft->oft_lock);
+        file->fp = *new_fp;
+        lock_release(file->of_lock);
         break;
 
         /* whence is invalid */ 
@@ -476,12 +1157,19 @@ int upd_global_oft(int ofptr, off_t offset, int whence, off_t *new_fp) {
  * free all allocated memory associated with the global open file table.
  */
 void free_global_oft(struct of_table *global_oft) {
+    struct oft_chunk *chunk;
+    unsigned c;
     int i;
     
-    for (i = 0; i < OPEN_MAX; i++) {
-        if (global_oft->open_files[i] != NULL) {
-            kfree(global_oft->open_files[i]);
+    for (c = 0; c < global_oft->num_chunks; c++) {
+        chunk = global_oft->chunks[c];
+        for (i = 0; i < OFT_CHUNK_SIZE; i++) {
+            if (chunk->open_files[i] != NULL) {
+                lock_destroy(chunk->open_files[i]->of_lock);
+                kfree(chunk->open_files[i]);
+            }
         }
+        kfree(chunk);
     }
 
     lock_destroy(global_oft->oft_lock);
@@ -496,12 +1184,17 @@ void print_global_oft(struct of_table *global_oft) {
 
     KASSERT(global_oft != NULL);
 
+    struct of_entry *file;
+    unsigned c;
     int i;
-    for (i = 0; i < OPEN_MAX; i++) {
-        if (global_oft->open_files[i] != NULL) {
-            kprintf("\nOpen file at global oft location %d\n", i);
-            kprintf("\tFile pointer offset = %d\n", (int)global_oft->open_files[i]->fp);
-            kprintf("\tVnode reference count = %d\n", global_oft->open_files[i]->v_ptr->vn_refcount);
+    for (c = 0; c < global_oft->num_chunks; c++) {
+        for (i = 0; i < OFT_CHUNK_SIZE; i++) {
+            file = global_oft->chunks[c]->open_files[i];
+            if (file != NULL) {
+                kprintf("\nOpen file at global oft location %d\n", (int)c * OFT_CHUNK_SIZE + i);
+                kprintf("\tFile pointer offset = %d\n", (int)file->fp);
+                kprintf("\tVnode reference count = %d\n", file->v_ptr->vn_refcount);
+            }
         }
     }
 }
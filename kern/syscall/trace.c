@@ -0,0 +1,287 @@
+/*
+ * System call tracing and the trace: device.
+ *
+ * Each cpu owns a ring of TRACE_NRECS records. Only that cpu ever
+ * writes to it, with interrupts off, so logging a call takes no lock
+ * and never waits on another cpu. Readers (the trace: device) are
+ * serialized among themselves by trace_lock but do not stop writers;
+ * instead every record carries its sequence number, which is stored
+ * first when the slot is rewritten. A reader checks the number before
+ * and after copying the slot, and drops the record if it changed.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/trace.h>
+#include <lib.h>
+#include <spl.h>
+#include <membar.h>
+#include <cpu.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <syscall.h>
+#include <platform/maxcpus.h>
+#include <trace.h>
+
+struct trace_ring {
+	volatile uint32_t tr_head;	/* records ever written */
+	uint32_t tr_tail;		/* records consumed; under trace_lock */
+	struct trace_record tr_recs[TRACE_NRECS];
+};
+
+bool trace_default;
+
+static struct trace_ring *trace_rings[MAXCPUS];
+static struct lock *trace_lock;
+
+void
+trace_cpu_init(struct cpu *c)
+{
+	struct trace_ring *tr;
+
+	KASSERT(c->c_number < MAXCPUS);
+
+	tr = kmalloc(sizeof(*tr));
+	if (tr == NULL) {
+		panic("trace_cpu_init: Out of memory\n");
+	}
+	tr->tr_head = 0;
+	tr->tr_tail = 0;
+	bzero(tr->tr_recs, sizeof(tr->tr_recs));
+
+	membar_store_store();
+	trace_rings[c->c_number] = tr;
+}
+
+void
+trace_syscall(int callno, const union syscall_arg *args,
+	      const unsigned char *argtypes, unsigned nargs,
+	      int64_t retval, int err, uint32_t enter, uint32_t exit)
+{
+	struct trace_ring *tr;
+	struct trace_record *rec;
+	uint32_t seq;
+	unsigned i;
+	int spl;
+
+	COMPILE_ASSERT(SYSCALL_MAXARGS <= TRACE_MAXARGS);
+	KASSERT(nargs <= SYSCALL_MAXARGS);
+
+	spl = splhigh();
+
+	tr = trace_rings[curcpu->c_number];
+	seq = tr->tr_head;
+	rec = &tr->tr_recs[seq & (TRACE_NRECS - 1)];
+
+	/* claim the slot before touching it; see trace_copyrec */
+	rec->tr_seq = seq;
+	membar_store_store();
+
+	rec->tr_cpu = curcpu->c_number;
+	rec->tr_callno = callno;
+	rec->tr_nargs = nargs;
+	rec->tr_wide = 0;
+	for (i=0; i<TRACE_MAXARGS; i++) {
+		if (i >= nargs) {
+			rec->tr_args[i] = 0;
+		}
+		else if (argtypes[i] == SCARG_DWORD) {
+			rec->tr_args[i] = args[i].sa_dword;
+			rec->tr_wide |= 1 << i;
+		}
+		else {
+			rec->tr_args[i] = args[i].sa_word;
+		}
+	}
+	rec->tr_retval = err ? 0 : retval;
+	rec->tr_err = err;
+	rec->tr_enter = enter;
+	rec->tr_exit = exit;
+
+	/* publish */
+	membar_store_store();
+	tr->tr_head = seq + 1;
+
+	splx(spl);
+}
+
+/*
+ * Copy record SEQ out of ring TR into REC. Returns false if the
+ * writer has reused the slot since, in which case REC is garbage.
+ */
+static
+bool
+trace_copyrec(struct trace_ring *tr, uint32_t seq, struct trace_record *rec)
+{
+	struct trace_record *slot;
+
+	slot = &tr->tr_recs[seq & (TRACE_NRECS - 1)];
+	if (*(volatile uint32_t *)&slot->tr_seq != seq) {
+		return false;
+	}
+	membar_load_load();
+	*rec = *slot;
+	membar_load_load();
+	return *(volatile uint32_t *)&slot->tr_seq == seq;
+}
+
+/*
+ * Read: hand out as many whole records as fit, consuming them.
+ */
+static
+int
+trace_read(struct uio *uio)
+{
+	struct trace_ring *tr;
+	struct trace_record rec;
+	uint32_t head;
+	unsigned i;
+	int result;
+
+	if (uio->uio_resid < sizeof(rec)) {
+		return EINVAL;
+	}
+
+	result = 0;
+	lock_acquire(trace_lock);
+	for (i=0; i<MAXCPUS && uio->uio_resid >= sizeof(rec); i++) {
+		tr = trace_rings[i];
+		if (tr == NULL) {
+			continue;
+		}
+		membar_load_load();
+		head = tr->tr_head;
+		if (head - tr->tr_tail > TRACE_NRECS) {
+			/* overrun; skip to the oldest record still there */
+			tr->tr_tail = head - TRACE_NRECS;
+		}
+		while (tr->tr_tail != head && uio->uio_resid >= sizeof(rec)) {
+			if (trace_copyrec(tr, tr->tr_tail, &rec)) {
+				result = uiomove(&rec, sizeof(rec), uio);
+				if (result) {
+					goto out;
+				}
+			}
+			tr->tr_tail++;
+		}
+	}
+ out:
+	lock_release(trace_lock);
+	return result;
+}
+
+/*
+ * Write: "on" or "off", optionally followed by a newline, switches
+ * tracing for the calling process.
+ */
+static
+int
+trace_write(struct uio *uio)
+{
+	char buf[8];
+	size_t len;
+	int result;
+
+	if (uio->uio_resid >= sizeof(buf)) {
+		return EINVAL;
+	}
+	len = uio->uio_resid;
+	result = uiomove(buf, len, uio);
+	if (result) {
+		return result;
+	}
+	if (len > 0 && buf[len - 1] == '\n') {
+		len--;
+	}
+	buf[len] = '\0';
+
+	if (!strcmp(buf, "on")) {
+		curproc->p_trace = true;
+	}
+	else if (!strcmp(buf, "off")) {
+		curproc->p_trace = false;
+	}
+	else {
+		return EINVAL;
+	}
+	return 0;
+}
+
+/* For open() */
+static
+int
+traceopen(struct device *dev, int openflags)
+{
+	(void)dev;
+	(void)openflags;
+
+	return 0;
+}
+
+/* For d_io() */
+static
+int
+traceio(struct device *dev, struct uio *uio)
+{
+	(void)dev;
+
+	if (uio->uio_rw == UIO_READ) {
+		return trace_read(uio);
+	}
+	return trace_write(uio);
+}
+
+/* For ioctl() */
+static
+int
+traceioctl(struct device *dev, int op, userptr_t data)
+{
+	(void)dev;
+	(void)op;
+	(void)data;
+
+	return EINVAL;
+}
+
+static const struct device_ops trace_devops = {
+	.devop_eachopen = traceopen,
+	.devop_io = traceio,
+	.devop_ioctl = traceioctl,
+};
+
+/*
+ * Function to create and attach trace:
+ */
+void
+trace_bootstrap(void)
+{
+	int result;
+	struct device *dev;
+
+	trace_lock = lock_create("trace");
+	if (trace_lock == NULL) {
+		panic("Could not add trace device: out of memory\n");
+	}
+
+	dev = kmalloc(sizeof(*dev));
+	if (dev==NULL) {
+		panic("Could not add trace device: out of memory\n");
+	}
+
+	dev->d_ops = &trace_devops;
+
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+
+	dev->d_devnumber = 0; /* assigned by vfs_adddev */
+
+	dev->d_data = NULL;
+
+	result = vfs_adddev("trace", dev, 0);
+	if (result) {
+		panic("Could not add trace device: %s\n", strerror(result));
+	}
+}
@@ -0,0 +1,594 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <clock.h>
+#include <test.h>
+
+/*
+ * Unit tests for reader-writer locks.
+ *
+ * As with the semaphore unit tests (semunit.c), each test checks the
+ * criterion stated in the comment at its top, some go inside the
+ * abstraction to check the internal state, and those that don't
+ * crash clean up after themselves, calling ok() first.
+ *
+ * Tests that need other threads fork readers and writers that take
+ * the lock, note down in order that they got it, and let it go again;
+ * clocksleep gives them time to get as far as they can.
+ */
+
+#define NAMESTRING "some-silly-name"
+
+////////////////////////////////////////////////////////////
+// support code
+
+static unsigned waiters_running = 0;
+static struct spinlock waiters_lock = SPINLOCK_INITIALIZER;
+
+/* The order in which forked threads got the lock: 'r' or 'w' each. */
+#define MAXSEQ 8
+static char seq[MAXSEQ + 1];
+static unsigned seqlen;
+
+static
+void
+ok(void)
+{
+	kprintf("Test passed; now cleaning up.\n");
+}
+
+/*
+ * Wrapper for rwlock_create when we aren't explicitly tweaking it.
+ */
+static
+struct rwlock *
+makerw(void)
+{
+	struct rwlock *rw;
+
+	rw = rwlock_create(NAMESTRING);
+	if (rw == NULL) {
+		panic("rwlockunit: whoops: rwlock_create failed\n");
+	}
+	return rw;
+}
+
+static
+void
+resetseq(void)
+{
+	spinlock_acquire(&waiters_lock);
+	seqlen = 0;
+	seq[0] = 0;
+	spinlock_release(&waiters_lock);
+}
+
+/*
+ * Note that a thread got the lock, and, if DONE, that it's finished.
+ */
+static
+void
+record(char what, bool done)
+{
+	spinlock_acquire(&waiters_lock);
+	KASSERT(seqlen < MAXSEQ);
+	seq[seqlen++] = what;
+	seq[seqlen] = 0;
+	if (done) {
+		KASSERT(waiters_running > 0);
+		waiters_running--;
+	}
+	spinlock_release(&waiters_lock);
+}
+
+static
+unsigned
+running(void)
+{
+	unsigned ret;
+
+	spinlock_acquire(&waiters_lock);
+	ret = waiters_running;
+	spinlock_release(&waiters_lock);
+	return ret;
+}
+
+/*
+ * A thread that takes the lock to read and lets it go.
+ */
+static
+void
+reader(void *vrw, unsigned long junk)
+{
+	struct rwlock *rw = vrw;
+	(void)junk;
+
+	rwlock_acquire_read(rw);
+	record('r', false);
+	rwlock_release_read(rw);
+
+	record('-', true);
+}
+
+/*
+ * A thread that takes the lock to write and lets it go.
+ */
+static
+void
+writer(void *vrw, unsigned long junk)
+{
+	struct rwlock *rw = vrw;
+	(void)junk;
+
+	rwlock_acquire_write(rw);
+	record('w', false);
+	rwlock_release_write(rw);
+
+	record('-', true);
+}
+
+/*
+ * Set up a reader or writer and give it time to run.
+ */
+static
+void
+makewaiter(struct rwlock *rw, bool iswriter)
+{
+	int result;
+
+	spinlock_acquire(&waiters_lock);
+	waiters_running++;
+	spinlock_release(&waiters_lock);
+
+	result = thread_fork(iswriter ? "rwlockunit writer" :
+			     "rwlockunit reader", NULL,
+			     iswriter ? writer : reader, rw, 0);
+	if (result) {
+		panic("rwlockunit: thread_fork failed\n");
+	}
+	kprintf("Sleeping for %s to run\n", iswriter ? "writer" : "reader");
+	clocksleep(1);
+}
+
+/*
+ * Wait for all the forked threads to finish.
+ */
+static
+void
+waitdone(void)
+{
+	kprintf("Sleeping for the others to finish\n");
+	clocksleep(1);
+	KASSERT(running() == 0);
+}
+
+/*
+ * As in semunit.c.
+ */
+static
+bool
+spinlock_not_held(struct spinlock *splk)
+{
+	return splk->splk_holder == NULL;
+}
+
+/*
+ * Check that SEQ, ignoring the '-' entries for threads finishing, is
+ * EXPECTED.
+ */
+static
+void
+checkseq(const char *expected)
+{
+	char got[MAXSEQ + 1];
+	unsigned i, j;
+
+	spinlock_acquire(&waiters_lock);
+	for (i=j=0; i<seqlen; i++) {
+		if (seq[i] != '-') {
+			got[j++] = seq[i];
+		}
+	}
+	got[j] = 0;
+	spinlock_release(&waiters_lock);
+
+	if (strcmp(got, expected)) {
+		panic("rwlockunit: threads got the lock in the order %s; "
+		      "expected %s\n", got, expected);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// tests
+
+/*
+ * 1. After a successful rwlock_create:
+ *     - rw_name compares equal to the passed-in name
+ *     - rw_name is not the same pointer as the passed-in name
+ *     - rw_readwchan and rw_writewchan are not null
+ *     - rw_lock is not held and has no owner
+ *     - there are no readers, no writer, and no waiting writers
+ */
+int
+rwu1(int nargs, char **args)
+{
+	struct rwlock *rw;
+	const char *name = NAMESTRING;
+
+	(void)nargs; (void)args;
+
+	rw = rwlock_create(name);
+	if (rw == NULL) {
+		panic("rwu1: whoops: rwlock_create failed\n");
+	}
+	KASSERT(!strcmp(rw->rw_name, name));
+	KASSERT(rw->rw_name != name);
+	KASSERT(rw->rw_readwchan != NULL);
+	KASSERT(rw->rw_writewchan != NULL);
+	KASSERT(spinlock_not_held(&rw->rw_lock));
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rw->rw_writewaiters == 0);
+
+	ok();
+	/* clean up */
+	rwlock_destroy(rw);
+	return 0;
+}
+
+/*
+ * 2. Holding the lock to write sets rw_writer to the current thread
+ * and makes rwlock_do_i_hold_write and rwlock_is_held true; releasing
+ * it makes both false again.
+ */
+int
+rwu2(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	rw = makerw();
+	KASSERT(!rwlock_do_i_hold_write(rw));
+	KASSERT(!rwlock_is_held(rw));
+
+	rwlock_acquire_write(rw);
+	KASSERT(rw->rw_writer == curthread);
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rwlock_do_i_hold_write(rw));
+	KASSERT(rwlock_is_held(rw));
+	KASSERT(spinlock_not_held(&rw->rw_lock));
+
+	rwlock_release_write(rw);
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(!rwlock_do_i_hold_write(rw));
+	KASSERT(!rwlock_is_held(rw));
+
+	ok();
+	/* clean up */
+	rwlock_destroy(rw);
+	return 0;
+}
+
+/*
+ * 3. Holding the lock to read counts a reader and makes
+ * rwlock_is_held true but not rwlock_do_i_hold_write.
+ */
+int
+rwu3(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	rw = makerw();
+
+	rwlock_acquire_read(rw);
+	KASSERT(rw->rw_readers == 1);
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rwlock_is_held(rw));
+	KASSERT(!rwlock_do_i_hold_write(rw));
+
+	rwlock_release_read(rw);
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(!rwlock_is_held(rw));
+
+	ok();
+	/* clean up */
+	rwlock_destroy(rw);
+	return 0;
+}
+
+/*
+ * 4. A reader gets the lock while another thread holds it to read.
+ */
+int
+rwu4(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	rw = makerw();
+	resetseq();
+
+	rwlock_acquire_read(rw);
+	makewaiter(rw, false);
+	KASSERT(running() == 0);
+	checkseq("r");
+	KASSERT(rw->rw_readers == 1);
+
+	ok();
+	/* clean up */
+	rwlock_release_read(rw);
+	rwlock_destroy(rw);
+	return 0;
+}
+
+/*
+ * 5. A reader waits while another thread holds the lock to write, and
+ * gets it once the writer lets go.
+ */
+int
+rwu5(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	rw = makerw();
+	resetseq();
+
+	rwlock_acquire_write(rw);
+	makewaiter(rw, false);
+	KASSERT(running() == 1);
+	KASSERT(rw->rw_readers == 0);
+	checkseq("");
+
+	rwlock_release_write(rw);
+	waitdone();
+	checkseq("r");
+
+	ok();
+	/* clean up */
+	rwlock_destroy(rw);
+	return 0;
+}
+
+/*
+ * 6. A writer waits while another thread holds the lock to read, is
+ * counted in rw_writewaiters meanwhile, and gets the lock once the
+ * reader lets go.
+ */
+int
+rwu6(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	rw = makerw();
+	resetseq();
+
+	rwlock_acquire_read(rw);
+	makewaiter(rw, true);
+	KASSERT(running() == 1);
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rw->rw_writewaiters == 1);
+	checkseq("");
+
+	rwlock_release_read(rw);
+	waitdone();
+	KASSERT(rw->rw_writewaiters == 0);
+	checkseq("w");
+
+	ok();
+	/* clean up */
+	rwlock_destroy(rw);
+	return 0;
+}
+
+/*
+ * 7. A writer waits while another thread holds the lock to write.
+ */
+int
+rwu7(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	rw = makerw();
+	resetseq();
+
+	rwlock_acquire_write(rw);
+	makewaiter(rw, true);
+	KASSERT(running() == 1);
+	KASSERT(rw->rw_writer == curthread);
+	KASSERT(rw->rw_writewaiters == 1);
+
+	rwlock_release_write(rw);
+	waitdone();
+	checkseq("w");
+
+	ok();
+	/* clean up */
+	rwlock_destroy(rw);
+	return 0;
+}
+
+/*
+ * 8. Writer preference: once a writer is waiting, a new reader waits
+ * too, even though the lock is only held to read; and the writer gets
+ * the lock before that reader does.
+ */
+int
+rwu8(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	rw = makerw();
+	resetseq();
+
+	rwlock_acquire_read(rw);
+	makewaiter(rw, true);
+	makewaiter(rw, false);
+	KASSERT(running() == 2);
+	KASSERT(rw->rw_readers == 1);
+	checkseq("");
+
+	rwlock_release_read(rw);
+	waitdone();
+	checkseq("wr");
+
+	ok();
+	/* clean up */
+	rwlock_destroy(rw);
+	return 0;
+}
+
+/*
+ * 9. Releasing a write hold wakes a waiting writer ahead of waiting
+ * readers, even ones that started waiting first; the readers then all
+ * get the lock together.
+ */
+int
+rwu9(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	rw = makerw();
+	resetseq();
+
+	rwlock_acquire_write(rw);
+	makewaiter(rw, false);
+	makewaiter(rw, false);
+	makewaiter(rw, true);
+	KASSERT(running() == 3);
+
+	rwlock_release_write(rw);
+	waitdone();
+	checkseq("wrr");
+
+	ok();
+	/* clean up */
+	rwlock_destroy(rw);
+	return 0;
+}
+
+/*
+ * 10. Passing a null name to rwlock_create asserts or crashes.
+ */
+int
+rwu10(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	kprintf("This should crash with a kernel null dereference\n");
+	rw = rwlock_create(NULL);
+	(void)rw;
+	panic("rwu10: rwlock_create accepted a null name\n");
+	return 0;
+}
+
+/*
+ * 11. Destroying a lock that is held asserts.
+ */
+int
+rwu11(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	kprintf("This should assert that the lock isn't held\n");
+	rw = makerw();
+	rwlock_acquire_read(rw);
+	rwlock_destroy(rw);
+	panic("rwu11: rwlock_destroy tolerated a held lock\n");
+	return 0;
+}
+
+/*
+ * 12. Releasing a write hold we don't have asserts.
+ */
+int
+rwu12(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	kprintf("This should assert that we hold the lock to write\n");
+	rw = makerw();
+	rwlock_acquire_read(rw);
+	rwlock_release_write(rw);
+	panic("rwu12: rwlock_release_write tolerated a read hold\n");
+	return 0;
+}
+
+/*
+ * 13. Releasing a read hold when there are no readers asserts.
+ */
+int
+rwu13(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	kprintf("This should assert that there is a reader\n");
+	rw = makerw();
+	rwlock_release_read(rw);
+	panic("rwu13: rwlock_release_read tolerated no readers\n");
+	return 0;
+}
+
+/*
+ * 14. Asking for a write hold we already have asserts (instead of
+ * deadlocking).
+ */
+int
+rwu14(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	kprintf("This should assert that we don't already hold the lock\n");
+	rw = makerw();
+	rwlock_acquire_write(rw);
+	rwlock_acquire_write(rw);
+	panic("rwu14: rwlock_acquire_write allowed recursion\n");
+	return 0;
+}
+
+/*
+ * 15. Asking for the lock in an interrupt handler asserts.
+ */
+int
+rwu15(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	kprintf("This should assert that we aren't in an interrupt\n");
+
+	rw = makerw();
+	/* as in semunit.c */
+	curthread->t_in_interrupt = true;
+	rwlock_acquire_read(rw);
+	panic("rwu15: rwlock_acquire_read tolerated being in an "
+	      "interrupt handler\n");
+	return 0;
+}
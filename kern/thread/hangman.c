@@ -156,6 +156,33 @@ hangman_acquire(struct hangman_actor *a,
 	spinlock_release(&hangman_lock);
 }
 
+/*
+ * Note that a got l in shared mode (a read hold on a reader-writer
+ * lock). It is no longer waiting; but since l may have any number of
+ * such holders, it isn't recorded as l's holder.
+ */
+void
+hangman_acquire_shared(struct hangman_actor *a,
+		       struct hangman_lockable *l)
+{
+	if (l == &hangman_lock.splk_hangman) {
+		/* don't recurse */
+		return;
+	}
+
+	spinlock_acquire(&hangman_lock);
+
+	if (a->a_waiting != l) {
+		spinlock_release(&hangman_lock);
+		panic("hangman_acquire_shared: not waiting for lock %s (%p)\n",
+		      l->l_name, l);
+	}
+
+	a->a_waiting = NULL;
+
+	spinlock_release(&hangman_lock);
+}
+
 void
 hangman_release(struct hangman_actor *a,
 		struct hangman_lockable *l)
@@ -315,3 +315,176 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	wchan_wakeall(cv->cv_wchan, &cv->cv_wchanlock);
 	spinlock_release(&cv->cv_wchanlock);
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rw_name = kstrdup(name);
+	if (rw->rw_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	HANGMAN_LOCKABLEINIT(&rw->rw_hangman, rw->rw_name);
+
+	rw->rw_readwchan = wchan_create(rw->rw_name);
+	if (rw->rw_readwchan == NULL) {
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+	rw->rw_writewchan = wchan_create(rw->rw_name);
+	if (rw->rw_writewchan == NULL) {
+		wchan_destroy(rw->rw_readwchan);
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+	spinlock_init(&rw->rw_lock);
+	rw->rw_readers = 0;
+	rw->rw_writewaiters = 0;
+	rw->rw_writer = NULL;
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rw->rw_writewaiters == 0);
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_writewchan);
+	wchan_destroy(rw->rw_readwchan);
+
+	kfree(rw->rw_name);
+	kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+
+	HANGMAN_WAIT(&curthread->t_hangman, &rw->rw_hangman);
+
+	KASSERT(rw->rw_writer != curthread);
+	/* Wait out the writer, and any writers waiting too. */
+	while (rw->rw_writer != NULL || rw->rw_writewaiters > 0) {
+		wchan_sleep(rw->rw_readwchan, &rw->rw_lock);
+	}
+	rw->rw_readers++;
+
+	HANGMAN_ACQUIRE_SHARED(&curthread->t_hangman, &rw->rw_hangman);
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+
+	KASSERT(rw->rw_readers > 0);
+	KASSERT(rw->rw_writer == NULL);
+	rw->rw_readers--;
+	if (rw->rw_readers == 0) {
+		/* Let a writer in, if one is waiting. */
+		wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+	}
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+
+	HANGMAN_WAIT(&curthread->t_hangman, &rw->rw_hangman);
+
+	KASSERT(rw->rw_writer != curthread);
+	/* Counting ourselves as waiting holds off new readers. */
+	rw->rw_writewaiters++;
+	while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+		wchan_sleep(rw->rw_writewchan, &rw->rw_lock);
+	}
+	rw->rw_writewaiters--;
+	rw->rw_writer = curthread;
+
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &rw->rw_hangman);
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+
+	KASSERT(rw->rw_writer == curthread);
+	rw->rw_writer = NULL;
+	if (rw->rw_writewaiters > 0) {
+		/* Writers first; readers keep waiting behind them. */
+		wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+	}
+	else {
+		wchan_wakeall(rw->rw_readwchan, &rw->rw_lock);
+	}
+
+	HANGMAN_RELEASE(&curthread->t_hangman, &rw->rw_hangman);
+
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	bool ret;
+
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	ret = (rw->rw_writer == curthread);
+	spinlock_release(&rw->rw_lock);
+
+	return ret;
+}
+
+bool
+rwlock_is_held(struct rwlock *rw)
+{
+	bool ret;
+
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	ret = (rw->rw_writer != NULL || rw->rw_readers > 0);
+	spinlock_release(&rw->rw_lock);
+
+	return ret;
+}
@@ -50,6 +50,7 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <trace.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -193,6 +194,8 @@ cpu_create(unsigned hardware_number)
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
 
+	trace_cpu_init(c);
+
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
 	if (c->c_curthread == NULL) {
@@ -0,0 +1,690 @@
+/*
+ * Block request queue. See <blkq.h> for the interface.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <wchan.h>
+#include <device.h>
+#include <thread.h>
+#include <blkq.h>
+
+/* Most requests blkq_io puts in the queue at once. */
+#define BLKQ_MAXBATCH	16
+
+/* Size of blkq_io's bounce buffer, for what can't be done in place. */
+#define BLKQ_BOUNCESIZE	4096
+
+/* All the queues, for blkq_printstats. */
+static struct blkq *blkq_all;
+static struct spinlock blkq_all_lock = SPINLOCK_INITIALIZER;
+
+/* Finished requests whose callbacks want a thread, linked on br_next. */
+static struct blkreq *blkq_cbhead;
+static struct blkreq *blkq_cbtail;
+static struct spinlock blkq_cblock = SPINLOCK_INITIALIZER;
+static struct wchan *blkq_cbwchan;
+
+////////////////////////////////////////////////////////////
+// scheduling
+
+static
+void
+blkq_unlink(struct blkq *q, struct blkreq *req, struct blkreq *prev)
+{
+	if (prev == NULL) {
+		q->bq_head = req->br_next;
+	}
+	else {
+		prev->br_next = req->br_next;
+	}
+	if (q->bq_tail == req) {
+		q->bq_tail = prev;
+	}
+	req->br_next = NULL;
+}
+
+/*
+ * Take the request that should go to the device next off the waiting
+ * list, along with any that can be merged onto it, and hand back the
+ * run.
+ */
+static
+struct blkreq *
+blkq_pick(struct blkq *q)
+{
+	struct blkreq *req, *prev, *best, *bestprev, *last;
+	uint32_t nblocks;
+	daddr_t end;
+
+	KASSERT(spinlock_do_i_hold(&q->bq_lock));
+
+	if (q->bq_head == NULL) {
+		return NULL;
+	}
+
+	if (q->bq_seq - q->bq_head->br_seq >= BLKQ_DEADLINE) {
+		/* The oldest has waited long enough. */
+		best = q->bq_head;
+		bestprev = NULL;
+		q->bq_nexpired++;
+	}
+	else {
+		/*
+		 * C-LOOK: the lowest block at or after the head
+		 * position, or failing that the lowest block.
+		 */
+		best = bestprev = NULL;
+		for (prev = NULL, req = q->bq_head; req != NULL;
+		     prev = req, req = req->br_next) {
+			if (best == NULL) {
+				best = req;
+				bestprev = prev;
+				continue;
+			}
+			if ((req->br_block >= q->bq_pos) !=
+			    (best->br_block >= q->bq_pos)) {
+				/* prefer the one ahead of the head */
+				if (req->br_block >= q->bq_pos) {
+					best = req;
+					bestprev = prev;
+				}
+			}
+			else if (req->br_block < best->br_block) {
+				best = req;
+				bestprev = prev;
+			}
+		}
+	}
+	blkq_unlink(q, best, bestprev);
+	best->br_mergenext = NULL;
+
+	if (best->br_block >= q->bq_pos) {
+		q->bq_seekdist += best->br_block - q->bq_pos;
+	}
+	else {
+		q->bq_seekdist += q->bq_pos - best->br_block;
+	}
+
+	/* Merge on whatever picks up where the run leaves off. */
+	last = best;
+	nblocks = best->br_nblocks;
+	end = best->br_block + best->br_nblocks;
+ again:
+	for (prev = NULL, req = q->bq_head; req != NULL;
+	     prev = req, req = req->br_next) {
+		if (req->br_block == end &&
+		    req->br_iswrite == best->br_iswrite &&
+		    nblocks + req->br_nblocks <= BLKQ_MAXMERGE) {
+			blkq_unlink(q, req, prev);
+			req->br_mergenext = NULL;
+			last->br_mergenext = req;
+			last = req;
+			nblocks += req->br_nblocks;
+			end += req->br_nblocks;
+			q->bq_nmerged++;
+			goto again;
+		}
+	}
+
+	q->bq_pos = end;
+	q->bq_seq++;
+	return best;
+}
+
+/*
+ * If the device is idle and there's something to do, start it.
+ */
+static
+void
+blkq_dispatch(struct blkq *q)
+{
+	struct blkreq *run;
+
+	KASSERT(spinlock_do_i_hold(&q->bq_lock));
+
+	if (q->bq_active != NULL) {
+		return;
+	}
+	run = blkq_pick(q);
+	if (run == NULL) {
+		return;
+	}
+	q->bq_active = run;
+	q->bq_start(q->bq_data, run);
+}
+
+/*
+ * Put requests in the queue; start the device if it's idle.
+ */
+void
+blkq_submit(struct blkq *q, struct blkreq *reqs, unsigned n)
+{
+	unsigned i;
+
+	spinlock_acquire(&q->bq_lock);
+	for (i=0; i<n; i++) {
+		KASSERT(reqs[i].br_callback != NULL);
+		reqs[i].br_result = 0;
+		reqs[i].br_seq = q->bq_seq;
+		reqs[i].br_next = NULL;
+		reqs[i].br_mergenext = NULL;
+		if (q->bq_tail == NULL) {
+			q->bq_head = &reqs[i];
+		}
+		else {
+			q->bq_tail->br_next = &reqs[i];
+		}
+		q->bq_tail = &reqs[i];
+		q->bq_nreqs++;
+	}
+	blkq_dispatch(q);
+	spinlock_release(&q->bq_lock);
+}
+
+/*
+ * Hand a finished request to the callback thread.
+ */
+static
+void
+blkq_defer(struct blkreq *req)
+{
+	spinlock_acquire(&blkq_cblock);
+	req->br_next = NULL;
+	if (blkq_cbtail == NULL) {
+		blkq_cbhead = req;
+	}
+	else {
+		blkq_cbtail->br_next = req;
+	}
+	blkq_cbtail = req;
+	wchan_wakeone(blkq_cbwchan, &blkq_cblock);
+	spinlock_release(&blkq_cblock);
+}
+
+void
+blkq_complete(struct blkreq *req, int result)
+{
+	req->br_result = result;
+	if (req->br_inthread) {
+		blkq_defer(req);
+	}
+	else {
+		req->br_callback(req);
+	}
+}
+
+void
+blkq_done(struct blkq *q, struct blkreq *req, int result)
+{
+	spinlock_acquire(&q->bq_lock);
+	KASSERT(req == q->bq_active);
+	q->bq_active = req->br_mergenext;
+	blkq_dispatch(q);
+	spinlock_release(&q->bq_lock);
+
+	blkq_complete(req, result);
+}
+
+/*
+ * Callback thread. Runs callbacks handed over by blkq_defer, forever.
+ */
+static
+void
+blkq_cbthread(void *unused1, unsigned long unused2)
+{
+	struct blkreq *req;
+
+	(void)unused1;
+	(void)unused2;
+
+	spinlock_acquire(&blkq_cblock);
+	while (1) {
+		while (blkq_cbhead == NULL) {
+			wchan_sleep(blkq_cbwchan, &blkq_cblock);
+		}
+		req = blkq_cbhead;
+		blkq_cbhead = req->br_next;
+		if (blkq_cbhead == NULL) {
+			blkq_cbtail = NULL;
+		}
+		spinlock_release(&blkq_cblock);
+
+		req->br_callback(req);
+
+		spinlock_acquire(&blkq_cblock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// uio interface
+
+/*
+ * A batch of requests someone is waiting for. The callback for each
+ * (blkq_batchdone) counts it off and notes the first error; the
+ * waiter sleeps on blkq_batchwchan until none are left.
+ */
+struct blkq_batch {
+	unsigned bb_pending;
+	int bb_result;
+};
+
+static struct spinlock blkq_batchlock = SPINLOCK_INITIALIZER;
+static struct wchan *blkq_batchwchan;
+
+static
+void
+blkq_batchdone(struct blkreq *req)
+{
+	struct blkq_batch *bb = req->br_cbdata;
+
+	spinlock_acquire(&blkq_batchlock);
+	if (req->br_result && bb->bb_result == 0) {
+		bb->bb_result = req->br_result;
+	}
+	KASSERT(bb->bb_pending > 0);
+	bb->bb_pending--;
+	if (bb->bb_pending == 0) {
+		wchan_wakeall(blkq_batchwchan, &blkq_batchlock);
+	}
+	spinlock_release(&blkq_batchlock);
+}
+
+static
+int
+blkq_batchwait(struct blkq_batch *bb)
+{
+	spinlock_acquire(&blkq_batchlock);
+	while (bb->bb_pending > 0) {
+		wchan_sleep(blkq_batchwchan, &blkq_batchlock);
+	}
+	spinlock_release(&blkq_batchlock);
+	return bb->bb_result;
+}
+
+/*
+ * Ways of starting a batch: into a queue, or to a device.
+ */
+typedef void (*blkq_submitfn)(void *to, struct blkreq *reqs, unsigned n);
+
+static
+void
+blkq_submit_queue(void *vq, struct blkreq *reqs, unsigned n)
+{
+	blkq_submit(vq, reqs, n);
+}
+
+static
+void
+blkq_submit_dev(void *vd, struct blkreq *reqs, unsigned n)
+{
+	unsigned i;
+	int result;
+
+	for (i=0; i<n; i++) {
+		result = dev_submit(vd, &reqs[i]);
+		if (result) {
+			reqs[i].br_result = result;
+			blkq_batchdone(&reqs[i]);
+		}
+	}
+}
+
+/*
+ * Start the first N of REQS, filled in except for the callback, and
+ * wait for them all.
+ */
+static
+int
+blkq_dobatch(blkq_submitfn submit, void *to, struct blkreq *reqs, unsigned n)
+{
+	struct blkq_batch bb;
+	unsigned i;
+
+	bb.bb_pending = n;
+	bb.bb_result = 0;
+	for (i=0; i<n; i++) {
+		reqs[i].br_callback = blkq_batchdone;
+		reqs[i].br_cbdata = &bb;
+		reqs[i].br_inthread = false;
+	}
+	submit(to, reqs, n);
+	return blkq_batchwait(&bb);
+}
+
+/*
+ * Move up to BLKQ_BOUNCESIZE bytes of UIO through the bounce buffer
+ * BOUNCE.
+ */
+static
+int
+blkq_bounce(blkq_submitfn submit, void *to, struct uio *uio,
+	    uint32_t blocksize, void *bounce)
+{
+	struct blkreq req;
+	size_t len;
+	int result;
+
+	len = uio->uio_resid;
+	if (len > BLKQ_BOUNCESIZE) {
+		len = BLKQ_BOUNCESIZE;
+	}
+	if (len % blocksize != 0) {
+		return EINVAL;
+	}
+
+	req.br_block = uio->uio_offset / blocksize;
+	req.br_nblocks = len / blocksize;
+	req.br_iswrite = (uio->uio_rw == UIO_WRITE);
+	req.br_data = bounce;
+
+	if (req.br_iswrite) {
+		result = uiomove(bounce, len, uio);
+		if (result) {
+			return result;
+		}
+	}
+	result = blkq_dobatch(submit, to, &req, 1);
+	if (result) {
+		return result;
+	}
+	if (!req.br_iswrite) {
+		result = uiomove(bounce, len, uio);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Kernel buffers are used as they are where possible: one request per
+ * iovec, all started together so the ones in a run get merged, or, on
+ * a device made of others, go to the disks underneath at once. An
+ * iovec that isn't a whole number of blocks (one block split across
+ * two iovecs, say) can't be, so from there on the data goes through
+ * a bounce buffer until the iovecs line up with blocks again.
+ */
+static
+int
+blkq_uio_kernel(blkq_submitfn submit, void *to, struct uio *uio,
+		uint32_t blocksize)
+{
+	struct blkreq *reqs;
+	struct iovec *iov;
+	void *bounce;
+	unsigned i, niov, n;
+	daddr_t block;
+	size_t total;
+	int result;
+
+	reqs = kmalloc(BLKQ_MAXBATCH * sizeof(*reqs));
+	if (reqs == NULL) {
+		return ENOMEM;
+	}
+	bounce = NULL;
+
+	result = 0;
+	while (uio->uio_resid > 0) {
+		KASSERT(uio->uio_iovcnt > 0);
+
+		/* Make a request for each iovec, up to the batch size. */
+		block = uio->uio_offset / blocksize;
+		total = 0;
+		n = 0;
+		for (niov=0; niov<uio->uio_iovcnt && n<BLKQ_MAXBATCH; niov++) {
+			iov = &uio->uio_iov[niov];
+			if (iov->iov_len == 0) {
+				continue;
+			}
+			if (iov->iov_len % blocksize != 0) {
+				break;
+			}
+			reqs[n].br_block = block;
+			reqs[n].br_nblocks = iov->iov_len / blocksize;
+			reqs[n].br_iswrite = (uio->uio_rw == UIO_WRITE);
+			reqs[n].br_data = iov->iov_kbase;
+			block += reqs[n].br_nblocks;
+			total += iov->iov_len;
+			n++;
+		}
+
+		if (n == 0) {
+			/* The next iovec is out of line; bounce it. */
+			if (bounce == NULL) {
+				bounce = kmalloc(BLKQ_BOUNCESIZE);
+				if (bounce == NULL) {
+					result = ENOMEM;
+					break;
+				}
+			}
+			result = blkq_bounce(submit, to, uio, blocksize,
+					     bounce);
+			if (result) {
+				break;
+			}
+			continue;
+		}
+
+		result = blkq_dobatch(submit, to, reqs, n);
+		if (result) {
+			break;
+		}
+
+		/* All done; move the uio past them. */
+		for (i=0; i<niov; i++) {
+			iov = &uio->uio_iov[i];
+			iov->iov_kbase = (char *)iov->iov_kbase + iov->iov_len;
+			iov->iov_len = 0;
+		}
+		uio->uio_iov += niov;
+		uio->uio_iovcnt -= niov;
+		uio->uio_offset += total;
+		uio->uio_resid -= total;
+	}
+
+	if (bounce != NULL) {
+		kfree(bounce);
+	}
+	kfree(reqs);
+	return result;
+}
+
+/*
+ * User buffers always go through a bounce buffer.
+ */
+static
+int
+blkq_uio_user(blkq_submitfn submit, void *to, struct uio *uio,
+	      uint32_t blocksize)
+{
+	void *bounce;
+	int result;
+
+	bounce = kmalloc(BLKQ_BOUNCESIZE);
+	if (bounce == NULL) {
+		return ENOMEM;
+	}
+
+	result = 0;
+	while (uio->uio_resid > 0) {
+		result = blkq_bounce(submit, to, uio, blocksize, bounce);
+		if (result) {
+			break;
+		}
+	}
+
+	kfree(bounce);
+	return result;
+}
+
+static
+int
+blkq_uio(blkq_submitfn submit, void *to, struct uio *uio, uint32_t blocksize)
+{
+	if (uio->uio_offset % blocksize != 0 ||
+	    uio->uio_resid % blocksize != 0) {
+		return EINVAL;
+	}
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		return blkq_uio_kernel(submit, to, uio, blocksize);
+	}
+	return blkq_uio_user(submit, to, uio, blocksize);
+}
+
+int
+blkq_io(struct blkq *q, struct uio *uio, uint32_t blocksize)
+{
+	return blkq_uio(blkq_submit_queue, q, uio, blocksize);
+}
+
+int
+blkq_devio(struct device *d, struct uio *uio)
+{
+	return blkq_uio(blkq_submit_dev, d, uio, d->d_blocksize);
+}
+
+////////////////////////////////////////////////////////////
+// setup and stats
+
+struct blkq *
+blkq_create(const char *name, void (*start)(void *data, struct blkreq *run),
+	    void *data)
+{
+	struct blkq *q;
+
+	q = kmalloc(sizeof(*q));
+	if (q == NULL) {
+		return NULL;
+	}
+	q->bq_name = kstrdup(name);
+	if (q->bq_name == NULL) {
+		kfree(q);
+		return NULL;
+	}
+	spinlock_init(&q->bq_lock);
+
+	q->bq_start = start;
+	q->bq_data = data;
+	q->bq_head = q->bq_tail = NULL;
+	q->bq_active = NULL;
+	q->bq_pos = 0;
+	q->bq_seq = 0;
+	q->bq_nreqs = 0;
+	q->bq_nmerged = 0;
+	q->bq_nexpired = 0;
+	q->bq_seekdist = 0;
+
+	spinlock_acquire(&blkq_all_lock);
+	q->bq_nextq = blkq_all;
+	blkq_all = q;
+	spinlock_release(&blkq_all_lock);
+
+	return q;
+}
+
+void
+blkq_destroy(struct blkq *q)
+{
+	struct blkq **qp;
+
+	KASSERT(q->bq_head == NULL);
+	KASSERT(q->bq_active == NULL);
+
+	spinlock_acquire(&blkq_all_lock);
+	for (qp = &blkq_all; *qp != q; qp = &(*qp)->bq_nextq) {
+		KASSERT(*qp != NULL);
+	}
+	*qp = q->bq_nextq;
+	spinlock_release(&blkq_all_lock);
+
+	spinlock_cleanup(&q->bq_lock);
+	kfree(q->bq_name);
+	kfree(q);
+}
+
+/*
+ * One queue's statistics, copied out by blkq_printstats.
+ */
+struct blkq_stats {
+	char bs_name[32];
+	unsigned bs_nreqs;
+	unsigned bs_nruns;
+	unsigned bs_nmerged;
+	unsigned bs_nexpired;
+	uint64_t bs_seekdist;
+};
+
+void
+blkq_printstats(void)
+{
+	struct blkq_stats *stats;
+	struct blkq *q;
+	unsigned i, n;
+
+	/*
+	 * kprintf can sleep, so it mustn't be called with the queue
+	 * locks held. Count the queues, make room, and copy everything
+	 * out under the locks; then print the copy. Queues made in
+	 * between are left out.
+	 */
+	spinlock_acquire(&blkq_all_lock);
+	for (n = 0, q = blkq_all; q != NULL; q = q->bq_nextq) {
+		n++;
+	}
+	spinlock_release(&blkq_all_lock);
+	if (n == 0) {
+		return;
+	}
+
+	stats = kmalloc(n * sizeof(*stats));
+	if (stats == NULL) {
+		kprintf("blkq: Out of memory for statistics\n");
+		return;
+	}
+
+	spinlock_acquire(&blkq_all_lock);
+	for (i = 0, q = blkq_all; q != NULL && i < n; q = q->bq_nextq, i++) {
+		spinlock_acquire(&q->bq_lock);
+		snprintf(stats[i].bs_name, sizeof(stats[i].bs_name), "%s",
+			 q->bq_name);
+		stats[i].bs_nreqs = q->bq_nreqs;
+		stats[i].bs_nruns = q->bq_seq;
+		stats[i].bs_nmerged = q->bq_nmerged;
+		stats[i].bs_nexpired = q->bq_nexpired;
+		stats[i].bs_seekdist = q->bq_seekdist;
+		spinlock_release(&q->bq_lock);
+	}
+	n = i;
+	spinlock_release(&blkq_all_lock);
+
+	for (i=0; i<n; i++) {
+		kprintf("%s: %u requests in %u runs (%u merged, "
+			"%u past deadline); %llu blocks of seeking\n",
+			stats[i].bs_name, stats[i].bs_nreqs, stats[i].bs_nruns,
+			stats[i].bs_nmerged, stats[i].bs_nexpired,
+			(unsigned long long)stats[i].bs_seekdist);
+	}
+	kfree(stats);
+}
+
+void
+blkq_bootstrap(void)
+{
+	int result;
+
+	blkq_cbwchan = wchan_create("blkq callbacks");
+	if (blkq_cbwchan == NULL) {
+		panic("blkq_bootstrap: Out of memory\n");
+	}
+	blkq_batchwchan = wchan_create("blkq batches");
+	if (blkq_batchwchan == NULL) {
+		panic("blkq_bootstrap: Out of memory\n");
+	}
+	result = thread_fork("blkq callbacks", NULL, blkq_cbthread, NULL, 0);
+	if (result) {
+		panic("blkq_bootstrap: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+}
@@ -0,0 +1,1067 @@
+/*
+ * Buffer cache. See <buf.h> for the interface.
+ *
+ * Buffers are found through a hash table on (device, block). Buffers
+ * no one holds are also on a doubly-linked LRU list, least recently
+ * used first; a held ("busy") buffer is off the list. buffer_lock
+ * protects the hash table, the LRU list, and every buffer's header
+ * fields. The data of a buffer belongs to whoever holds it, so the
+ * lock is dropped during device I/O, with the buffer kept busy.
+ * Anyone who wants a busy buffer waits on buffer_cv.
+ *
+ * Dirty buffers are counted in buffer_dirtymem and stamped with the
+ * time they were first dirtied, so the flusher thread can pick out the
+ * ones it should write. Because it is just another holder of busy
+ * buffers, buffer_sync and buffer_drop wait for busy buffers of their
+ * device rather than assume no one else has any.
+ *
+ * Prefetch requests go in a small ring, also under buffer_lock, which
+ * the prefetch thread empties by getting a busy buffer for each block
+ * like anyone else and starting an asynchronous read into it (see
+ * dev_submit). It doesn't wait for the read: when that finishes, the
+ * callback marks the buffer valid and releases it, from the block
+ * queue's callback thread. So many prefetches can be in flight at
+ * once, a block being prefetched is just a busy buffer, and a reader
+ * that wants it waits for the read already under way instead of
+ * starting another.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <thread.h>
+#include <clock.h>
+#include <uio.h>
+#include <device.h>
+#include <blkq.h>
+#include <buf.h>
+
+/* Number of hash chains; a prime spreads consecutive blocks well. */
+#define BUFFER_HASHSIZE		251
+
+struct buf {
+	struct buf *b_hashnext;		/* next on hash chain */
+	struct buf *b_lruprev;		/* LRU list, when not busy */
+	struct buf *b_lrunext;
+	struct device *b_dev;		/* device */
+	daddr_t b_block;		/* block number on device */
+	size_t b_size;			/* size of block */
+	void *b_data;			/* block data */
+	bool b_valid;			/* b_data holds the block */
+	bool b_dirty;			/* b_data is newer than the disk */
+	bool b_busy;			/* held, or doing I/O */
+	time_t b_dirtytime;		/* when it last became dirty */
+	struct blkreq b_req;		/* for asynchronous reads */
+};
+
+static struct lock *buffer_lock;
+static struct cv *buffer_cv;
+
+static struct buf *buffer_hash[BUFFER_HASHSIZE];
+static struct buf *buffer_lruhead;	/* least recently used */
+static struct buf *buffer_lrutail;	/* most recently used */
+static unsigned buffer_count;		/* buffers in existence */
+static size_t buffer_mem;		/* bytes of block data */
+static size_t buffer_dirtymem;		/* bytes of dirty block data */
+
+/* Prefetch ring; protected by buffer_lock */
+struct buffer_prefetchreq {
+	struct device *pr_dev;
+	daddr_t pr_block;
+	size_t pr_size;
+};
+static struct buffer_prefetchreq buffer_prefetchq[BUFFER_PREFETCH_MAX];
+static unsigned buffer_prefetchhead;	/* next request to do */
+static unsigned buffer_prefetchcount;	/* requests queued */
+static struct device *buffer_prefetchdev; /* device being read, or NULL */
+static struct cv *buffer_prefetchcv;
+
+/* Statistics; protected by buffer_lock */
+static unsigned buffer_hits;
+static unsigned buffer_misses;
+static unsigned buffer_evictions;
+static unsigned buffer_writebacks;
+static unsigned buffer_flushes;
+static unsigned buffer_throttles;
+static unsigned buffer_prefetches;
+
+////////////////////////////////////////////////////////////
+// lists
+
+static
+unsigned
+buffer_hashfn(struct device *dev, daddr_t block)
+{
+	return ((uintptr_t)dev / sizeof(void *) + block) % BUFFER_HASHSIZE;
+}
+
+static
+struct buf *
+buffer_find(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+
+	for (b = buffer_hash[buffer_hashfn(dev, block)];
+	     b != NULL; b = b->b_hashnext) {
+		if (b->b_dev == dev && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+buffer_hash_insert(struct buf *b)
+{
+	unsigned h;
+
+	h = buffer_hashfn(b->b_dev, b->b_block);
+	b->b_hashnext = buffer_hash[h];
+	buffer_hash[h] = b;
+}
+
+static
+void
+buffer_hash_remove(struct buf *b)
+{
+	struct buf **bp;
+
+	for (bp = &buffer_hash[buffer_hashfn(b->b_dev, b->b_block)];
+	     *bp != NULL; bp = &(*bp)->b_hashnext) {
+		if (*bp == b) {
+			*bp = b->b_hashnext;
+			b->b_hashnext = NULL;
+			return;
+		}
+	}
+	panic("buffer_hash_remove: buffer not in hash table\n");
+}
+
+static
+void
+buffer_lru_remove(struct buf *b)
+{
+	if (b->b_lruprev != NULL) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	}
+	else {
+		KASSERT(buffer_lruhead == b);
+		buffer_lruhead = b->b_lrunext;
+	}
+	if (b->b_lrunext != NULL) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	}
+	else {
+		KASSERT(buffer_lrutail == b);
+		buffer_lrutail = b->b_lruprev;
+	}
+	b->b_lruprev = b->b_lrunext = NULL;
+}
+
+/* Put B at the most recently used end. */
+static
+void
+buffer_lru_append(struct buf *b)
+{
+	b->b_lrunext = NULL;
+	b->b_lruprev = buffer_lrutail;
+	if (buffer_lrutail != NULL) {
+		buffer_lrutail->b_lrunext = b;
+	}
+	else {
+		buffer_lruhead = b;
+	}
+	buffer_lrutail = b;
+}
+
+/* Put B at the least recently used end, to be recycled first. */
+static
+void
+buffer_lru_prepend(struct buf *b)
+{
+	b->b_lruprev = NULL;
+	b->b_lrunext = buffer_lruhead;
+	if (buffer_lruhead != NULL) {
+		buffer_lruhead->b_lruprev = b;
+	}
+	else {
+		buffer_lrutail = b;
+	}
+	buffer_lruhead = b;
+}
+
+////////////////////////////////////////////////////////////
+// dirty accounting
+
+/* Mark B dirty. Called with buffer_lock held. */
+static
+void
+buffer_setdirty(struct buf *b)
+{
+	struct timespec ts;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+	if (!b->b_dirty) {
+		gettime(&ts);
+		b->b_dirty = true;
+		b->b_dirtytime = ts.tv_sec;
+		buffer_dirtymem += b->b_size;
+	}
+}
+
+/* Mark B clean. Called with buffer_lock held. */
+static
+void
+buffer_setclean(struct buf *b)
+{
+	KASSERT(lock_do_i_hold(buffer_lock));
+	if (b->b_dirty) {
+		KASSERT(buffer_dirtymem >= b->b_size);
+		b->b_dirty = false;
+		buffer_dirtymem -= b->b_size;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// I/O
+
+/*
+ * Read or write a run of N buffers for consecutive blocks of one
+ * device as a single device request, retrying I/O errors. Called on
+ * busy buffers without buffer_lock.
+ */
+static
+int
+buffer_runio(struct buf **bufs, unsigned n, enum uio_rw rw)
+{
+	struct iovec iov[BUFFER_MAXRUN];
+	struct uio ku;
+	struct buf *b = bufs[0];
+	unsigned i;
+	int result;
+	int tries=0;
+
+	KASSERT(n > 0 && n <= BUFFER_MAXRUN);
+	KASSERT(!lock_do_i_hold(buffer_lock));
+
+ retry:
+	for (i=0; i<n; i++) {
+		KASSERT(bufs[i]->b_busy);
+		KASSERT(bufs[i]->b_dev == b->b_dev);
+		KASSERT(bufs[i]->b_block == b->b_block + i);
+		KASSERT(bufs[i]->b_size == b->b_size);
+		iov[i].iov_kbase = bufs[i]->b_data;
+		iov[i].iov_len = b->b_size;
+	}
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = n;
+	ku.uio_offset = (off_t)b->b_block * b->b_size;
+	ku.uio_resid = n * b->b_size;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = rw;
+	ku.uio_space = NULL;
+	result = DEVOP_IO(b->b_dev, &ku);
+	if (result == EINVAL) {
+		/*
+		 * This means the sector we requested was out of range,
+		 * or the seek address we gave wasn't sector-aligned,
+		 * or a couple of other things that are our fault.
+		 */
+		panic("buffer: device %u: DEVOP_IO returned EINVAL\n",
+		      b->b_dev->d_devnumber);
+	}
+	if (result == EIO) {
+		if (tries == 0) {
+			tries++;
+			kprintf("buffer: device %u block %u I/O error, "
+				"retrying\n", b->b_dev->d_devnumber,
+				b->b_block);
+			goto retry;
+		}
+		else if (tries < 10) {
+			tries++;
+			goto retry;
+		}
+		else {
+			kprintf("buffer: device %u block %u I/O error, "
+				"giving up after %d retries\n",
+				b->b_dev->d_devnumber, b->b_block, tries);
+		}
+	}
+	return result;
+}
+
+/*
+ * Read or write a single buffer.
+ */
+static
+int
+buffer_io(struct buf *b, enum uio_rw rw)
+{
+	return buffer_runio(&b, 1, rw);
+}
+
+/*
+ * Write back a dirty buffer. B must be busy; buffer_lock is held on
+ * entry and exit but dropped during the I/O.
+ */
+static
+int
+buffer_writeback(struct buf *b)
+{
+	int result;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+	KASSERT(b->b_busy);
+	KASSERT(b->b_dirty);
+
+	lock_release(buffer_lock);
+	result = buffer_io(b, UIO_WRITE);
+	lock_acquire(buffer_lock);
+	if (result == 0) {
+		buffer_setclean(b);
+		buffer_writebacks++;
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// getting and releasing buffers
+
+/*
+ * Make a new, empty buffer of SIZE bytes. Recycles the least
+ * recently used buffer if the cache is full. Returns NULL if out of
+ * memory. The buffer returned is on no lists.
+ */
+static
+struct buf *
+buffer_alloc(size_t size)
+{
+	struct buf *b;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+
+	while (buffer_mem + size > BUFFER_MAXMEM && buffer_lruhead != NULL) {
+		b = buffer_lruhead;
+		buffer_lru_remove(b);
+		if (b->b_dirty) {
+			b->b_busy = true;
+			if (buffer_writeback(b)) {
+				/* can't write it; keep it and grow instead */
+				b->b_busy = false;
+				buffer_lru_append(b);
+				cv_broadcast(buffer_cv, buffer_lock);
+				break;
+			}
+			b->b_busy = false;
+			cv_broadcast(buffer_cv, buffer_lock);
+			/*
+			 * We slept, so someone may have taken it in the
+			 * meantime; put it back and look again.
+			 */
+			buffer_lru_prepend(b);
+			continue;
+		}
+		buffer_hash_remove(b);
+		buffer_evictions++;
+		if (b->b_size == size) {
+			return b;
+		}
+		buffer_mem -= b->b_size;
+		buffer_count--;
+		kfree(b->b_data);
+		kfree(b);
+	}
+
+	b = kmalloc(sizeof(*b));
+	if (b == NULL) {
+		return NULL;
+	}
+	b->b_data = kmalloc(size);
+	if (b->b_data == NULL) {
+		kfree(b);
+		return NULL;
+	}
+	b->b_size = size;
+	buffer_mem += size;
+	buffer_count++;
+	return b;
+}
+
+/*
+ * Common code for buffer_get and buffer_read: find the buffer for
+ * (DEV, BLOCK) or make one, and mark it busy. Called with
+ * buffer_lock held.
+ */
+static
+int
+buffer_getbusy(struct device *dev, daddr_t block, size_t size,
+	       struct buf **ret)
+{
+	struct buf *b;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+
+ again:
+	b = buffer_find(dev, block);
+	if (b != NULL) {
+		if (b->b_busy) {
+			cv_wait(buffer_cv, buffer_lock);
+			goto again;
+		}
+		KASSERT(b->b_size == size);
+		buffer_lru_remove(b);
+		b->b_busy = true;
+		buffer_hits++;
+		*ret = b;
+		return 0;
+	}
+
+	b = buffer_alloc(size);
+	if (b == NULL) {
+		return ENOMEM;
+	}
+	if (buffer_find(dev, block) != NULL) {
+		/* someone else made it while we were writing back */
+		buffer_mem -= b->b_size;
+		buffer_count--;
+		kfree(b->b_data);
+		kfree(b);
+		goto again;
+	}
+
+	b->b_hashnext = NULL;
+	b->b_lruprev = b->b_lrunext = NULL;
+	b->b_dev = dev;
+	b->b_block = block;
+	b->b_valid = false;
+	b->b_dirty = false;
+	b->b_busy = true;
+	buffer_hash_insert(b);
+	buffer_misses++;
+
+	*ret = b;
+	return 0;
+}
+
+int
+buffer_get(struct device *dev, daddr_t block, size_t size, struct buf **ret)
+{
+	int result;
+
+	lock_acquire(buffer_lock);
+	result = buffer_getbusy(dev, block, size, ret);
+	lock_release(buffer_lock);
+	return result;
+}
+
+int
+buffer_read(struct device *dev, daddr_t block, size_t size, struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	result = buffer_get(dev, block, size, &b);
+	if (result) {
+		return result;
+	}
+
+	if (!b->b_valid) {
+		result = buffer_io(b, UIO_READ);
+		if (result) {
+			buffer_release_and_invalidate(b);
+			return result;
+		}
+		b->b_valid = true;
+	}
+
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Get N buffers for consecutive blocks starting at BLOCK. They are
+ * taken in block order, so two threads getting overlapping runs
+ * can't deadlock. On failure none are held.
+ */
+int
+buffer_get_run(struct device *dev, daddr_t block, unsigned n, size_t size,
+	       struct buf **bufs)
+{
+	unsigned i;
+	int result;
+
+	KASSERT(n <= BUFFER_MAXRUN);
+
+	lock_acquire(buffer_lock);
+	for (i=0; i<n; i++) {
+		result = buffer_getbusy(dev, block + i, size, &bufs[i]);
+		if (result) {
+			lock_release(buffer_lock);
+			while (i > 0) {
+				buffer_release(bufs[--i]);
+			}
+			return result;
+		}
+	}
+	lock_release(buffer_lock);
+	return 0;
+}
+
+/*
+ * Same, but read in whatever isn't cached. Each stretch of
+ * consecutive uncached blocks is read with one device request.
+ */
+int
+buffer_read_run(struct device *dev, daddr_t block, unsigned n, size_t size,
+		struct buf **bufs)
+{
+	unsigned i, j, k;
+	int result;
+
+	result = buffer_get_run(dev, block, n, size, bufs);
+	if (result) {
+		return result;
+	}
+
+	for (i=0; i<n; i=j) {
+		if (bufs[i]->b_valid) {
+			j = i+1;
+			continue;
+		}
+		for (j=i+1; j<n && !bufs[j]->b_valid; j++) {
+			/* nothing */
+		}
+		result = buffer_runio(&bufs[i], j - i, UIO_READ);
+		if (result) {
+			for (k=0; k<n; k++) {
+				if (bufs[k]->b_valid) {
+					buffer_release(bufs[k]);
+				}
+				else {
+					buffer_release_and_invalidate(bufs[k]);
+				}
+			}
+			return result;
+		}
+		for (k=i; k<j; k++) {
+			bufs[k]->b_valid = true;
+		}
+	}
+	return 0;
+}
+
+void *
+buffer_map(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	return b->b_data;
+}
+
+bool
+buffer_is_valid(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	return b->b_valid;
+}
+
+void
+buffer_mark_valid(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	b->b_valid = true;
+}
+
+void
+buffer_mark_dirty(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	b->b_valid = true;
+	if (!b->b_dirty) {
+		lock_acquire(buffer_lock);
+		buffer_setdirty(b);
+		lock_release(buffer_lock);
+	}
+}
+
+int
+buffer_writeout(struct buf *b)
+{
+	int result;
+
+	KASSERT(b->b_busy);
+	if (!b->b_dirty) {
+		return 0;
+	}
+	result = buffer_io(b, UIO_WRITE);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(buffer_lock);
+	buffer_setclean(b);
+	buffer_writebacks++;
+	lock_release(buffer_lock);
+	return 0;
+}
+
+/*
+ * Write out a run of held buffers, as from buffer_get_run. Each
+ * stretch of consecutive dirty buffers is one device request.
+ */
+int
+buffer_writeout_run(struct buf **bufs, unsigned n)
+{
+	unsigned i, j, k;
+	int result;
+
+	for (i=0; i<n; i=j) {
+		if (!bufs[i]->b_dirty) {
+			j = i+1;
+			continue;
+		}
+		for (j=i+1; j<n && bufs[j]->b_dirty; j++) {
+			/* nothing */
+		}
+		result = buffer_runio(&bufs[i], j - i, UIO_WRITE);
+		if (result) {
+			return result;
+		}
+		lock_acquire(buffer_lock);
+		for (k=i; k<j; k++) {
+			buffer_setclean(bufs[k]);
+			buffer_writebacks++;
+		}
+		lock_release(buffer_lock);
+	}
+	return 0;
+}
+
+void
+buffer_release(struct buf *b)
+{
+	lock_acquire(buffer_lock);
+	KASSERT(b->b_busy);
+	if (b->b_dirty && buffer_dirtymem > BUFFER_DIRTY_MAX) {
+		/* Too much is dirty; the flusher isn't keeping up. */
+		buffer_throttles++;
+		(void)buffer_writeback(b);
+	}
+	b->b_busy = false;
+	buffer_lru_append(b);
+	cv_broadcast(buffer_cv, buffer_lock);
+	lock_release(buffer_lock);
+}
+
+void
+buffer_release_and_invalidate(struct buf *b)
+{
+	lock_acquire(buffer_lock);
+	KASSERT(b->b_busy);
+	b->b_valid = false;
+	buffer_setclean(b);
+	b->b_busy = false;
+	/* nothing worth keeping; recycle it first */
+	buffer_lru_prepend(b);
+	cv_broadcast(buffer_cv, buffer_lock);
+	lock_release(buffer_lock);
+}
+
+////////////////////////////////////////////////////////////
+// prefetch
+
+void
+buffer_prefetch(struct device *dev, daddr_t block, size_t size)
+{
+	struct buffer_prefetchreq *pr;
+	unsigned i;
+
+	lock_acquire(buffer_lock);
+	if (buffer_find(dev, block) != NULL ||
+	    buffer_prefetchcount == BUFFER_PREFETCH_MAX) {
+		/* already cached (or on its way), or no room */
+		lock_release(buffer_lock);
+		return;
+	}
+	for (i=0; i<buffer_prefetchcount; i++) {
+		pr = &buffer_prefetchq[(buffer_prefetchhead + i)
+				       % BUFFER_PREFETCH_MAX];
+		if (pr->pr_dev == dev && pr->pr_block == block) {
+			lock_release(buffer_lock);
+			return;
+		}
+	}
+	pr = &buffer_prefetchq[(buffer_prefetchhead + buffer_prefetchcount)
+			       % BUFFER_PREFETCH_MAX];
+	pr->pr_dev = dev;
+	pr->pr_block = block;
+	pr->pr_size = size;
+	buffer_prefetchcount++;
+	cv_signal(buffer_prefetchcv, buffer_lock);
+	lock_release(buffer_lock);
+}
+
+/*
+ * Callback for a prefetch read; the buffer is ours until we let go.
+ */
+static
+void
+buffer_readdone(struct blkreq *req)
+{
+	struct buf *b = req->br_cbdata;
+
+	if (req->br_result) {
+		buffer_release_and_invalidate(b);
+		return;
+	}
+	b->b_valid = true;
+	buffer_release(b);
+}
+
+/*
+ * Start reading busy buffer B and return without waiting; the read's
+ * callback releases it. B mustn't be touched afterwards unless this
+ * fails.
+ */
+static
+int
+buffer_startread(struct buf *b)
+{
+	struct device *dev = b->b_dev;
+	struct blkreq *req = &b->b_req;
+
+	KASSERT(b->b_busy);
+	KASSERT(!lock_do_i_hold(buffer_lock));
+
+	if (b->b_size % dev->d_blocksize != 0) {
+		return EINVAL;
+	}
+	req->br_block = ((off_t)b->b_block * b->b_size) / dev->d_blocksize;
+	req->br_nblocks = b->b_size / dev->d_blocksize;
+	req->br_iswrite = false;
+	req->br_data = b->b_data;
+	req->br_callback = buffer_readdone;
+	req->br_cbdata = b;
+	req->br_inthread = true;
+	return dev_submit(dev, req);
+}
+
+/*
+ * Prefetch thread. Starts reads of queued blocks into the cache,
+ * forever.
+ */
+static
+void
+buffer_prefetch_thread(void *unused1, unsigned long unused2)
+{
+	struct buffer_prefetchreq pr;
+	struct buf *b;
+
+	(void)unused1;
+	(void)unused2;
+
+	lock_acquire(buffer_lock);
+	while (1) {
+		while (buffer_prefetchcount == 0) {
+			cv_wait(buffer_prefetchcv, buffer_lock);
+		}
+		pr = buffer_prefetchq[buffer_prefetchhead];
+		buffer_prefetchhead = (buffer_prefetchhead + 1)
+			% BUFFER_PREFETCH_MAX;
+		buffer_prefetchcount--;
+		if (pr.pr_dev == NULL) {
+			/* cancelled by buffer_drop */
+			continue;
+		}
+
+		/*
+		 * buffer_drop waits for this before letting go of the
+		 * device, and after that for the buffer we read into,
+		 * which stays busy until the read is done.
+		 */
+		buffer_prefetchdev = pr.pr_dev;
+		if (buffer_find(pr.pr_dev, pr.pr_block) == NULL &&
+		    buffer_getbusy(pr.pr_dev, pr.pr_block, pr.pr_size,
+				   &b) == 0) {
+			lock_release(buffer_lock);
+			if (b->b_valid) {
+				/* someone read it while we were waiting */
+				buffer_release(b);
+			}
+			else if (buffer_startread(b)) {
+				buffer_release_and_invalidate(b);
+			}
+			lock_acquire(buffer_lock);
+			buffer_prefetches++;
+		}
+		buffer_prefetchdev = NULL;
+		cv_broadcast(buffer_prefetchcv, buffer_lock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// whole-cache operations
+
+/*
+ * Find a dirty buffer of DEV (any device if NULL) that no one holds.
+ */
+static
+struct buf *
+buffer_find_dirty(struct device *dev)
+{
+	struct buf *b;
+
+	for (b = buffer_lruhead; b != NULL; b = b->b_lrunext) {
+		if (b->b_dirty && (dev == NULL || b->b_dev == dev)) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Is some buffer of DEV (any device if NULL) both busy and dirty?
+ */
+static
+bool
+buffer_busy_dirty(struct device *dev)
+{
+	struct buf *b;
+	unsigned i;
+
+	for (i=0; i<BUFFER_HASHSIZE; i++) {
+		for (b = buffer_hash[i]; b != NULL; b = b->b_hashnext) {
+			if (b->b_busy && b->b_dirty &&
+			    (dev == NULL || b->b_dev == dev)) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/*
+ * Write back B, a dirty buffer no one holds, together with as many
+ * unheld dirty buffers for the blocks right after it as make a run.
+ * Called with buffer_lock held; drops it during the I/O.
+ */
+static
+int
+buffer_writeback_unheld(struct buf *b)
+{
+	struct buf *bufs[BUFFER_MAXRUN];
+	struct buf *nb;
+	unsigned n, i;
+	int result;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+	KASSERT(!b->b_busy && b->b_dirty);
+
+	bufs[0] = b;
+	for (n=1; n<BUFFER_MAXRUN; n++) {
+		nb = buffer_find(b->b_dev, b->b_block + n);
+		if (nb == NULL || nb->b_busy || !nb->b_dirty ||
+		    nb->b_size != b->b_size) {
+			break;
+		}
+		bufs[n] = nb;
+	}
+	for (i=0; i<n; i++) {
+		buffer_lru_remove(bufs[i]);
+		bufs[i]->b_busy = true;
+	}
+
+	lock_release(buffer_lock);
+	result = buffer_runio(bufs, n, UIO_WRITE);
+	lock_acquire(buffer_lock);
+
+	for (i=0; i<n; i++) {
+		if (result == 0) {
+			buffer_setclean(bufs[i]);
+			buffer_writebacks++;
+		}
+		bufs[i]->b_busy = false;
+		buffer_lru_append(bufs[i]);
+	}
+	cv_broadcast(buffer_cv, buffer_lock);
+	return result;
+}
+
+int
+buffer_sync(struct device *dev)
+{
+	struct buf *b;
+	int result;
+
+	lock_acquire(buffer_lock);
+	while (1) {
+		b = buffer_find_dirty(dev);
+		if (b != NULL) {
+			result = buffer_writeback_unheld(b);
+			if (result) {
+				lock_release(buffer_lock);
+				return result;
+			}
+		}
+		else if (buffer_busy_dirty(dev)) {
+			/* the flusher has it; wait, then look again */
+			cv_wait(buffer_cv, buffer_lock);
+		}
+		else {
+			break;
+		}
+	}
+	lock_release(buffer_lock);
+	return 0;
+}
+
+/*
+ * Find a dirty buffer no one holds that the flusher should write at
+ * time NOW: one that has been dirty too long, or the least recently
+ * used one if too much is dirty.
+ */
+static
+struct buf *
+buffer_find_flushable(time_t now)
+{
+	struct buf *b;
+
+	for (b = buffer_lruhead; b != NULL; b = b->b_lrunext) {
+		if (!b->b_dirty) {
+			continue;
+		}
+		if (buffer_dirtymem > BUFFER_DIRTY_BG ||
+		    now - b->b_dirtytime >= BUFFER_FLUSH_AGE) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Flusher thread. Once a second, writes back what
+ * buffer_find_flushable picks, forever.
+ */
+static
+void
+buffer_flush_thread(void *unused1, unsigned long unused2)
+{
+	struct timespec ts;
+	struct buf *b;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		clocksleep(1);
+		gettime(&ts);
+
+		lock_acquire(buffer_lock);
+		while ((b = buffer_find_flushable(ts.tv_sec)) != NULL) {
+			if (buffer_writeback_unheld(b)) {
+				/* leave it for next time */
+				break;
+			}
+			buffer_flushes++;
+		}
+		lock_release(buffer_lock);
+	}
+}
+
+void
+buffer_drop(struct device *dev)
+{
+	struct buf *b, *next;
+	unsigned i;
+
+	lock_acquire(buffer_lock);
+
+	/* Cancel queued prefetches for the device and wait out the current one */
+	for (i=0; i<buffer_prefetchcount; i++) {
+		struct buffer_prefetchreq *pr;
+
+		pr = &buffer_prefetchq[(buffer_prefetchhead + i)
+				       % BUFFER_PREFETCH_MAX];
+		if (pr->pr_dev == dev) {
+			/* leave a request that reads nothing new */
+			pr->pr_dev = NULL;
+		}
+	}
+	while (buffer_prefetchdev == dev) {
+		cv_wait(buffer_prefetchcv, buffer_lock);
+	}
+
+	/* Wait for the flusher to finish with anything of ours */
+ again:
+	for (i=0; i<BUFFER_HASHSIZE; i++) {
+		for (b = buffer_hash[i]; b != NULL; b = b->b_hashnext) {
+			if (b->b_dev == dev && b->b_busy) {
+				cv_wait(buffer_cv, buffer_lock);
+				goto again;
+			}
+		}
+	}
+
+	for (i=0; i<BUFFER_HASHSIZE; i++) {
+		for (b = buffer_hash[i]; b != NULL; b = next) {
+			next = b->b_hashnext;
+			if (b->b_dev != dev) {
+				continue;
+			}
+			KASSERT(!b->b_dirty);
+			buffer_hash_remove(b);
+			buffer_lru_remove(b);
+			buffer_mem -= b->b_size;
+			buffer_count--;
+			kfree(b->b_data);
+			kfree(b);
+		}
+	}
+	lock_release(buffer_lock);
+}
+
+void
+buffer_printstats(void)
+{
+	lock_acquire(buffer_lock);
+	kprintf("buffers: %u (%zu bytes of %u, %zu dirty)\n",
+		buffer_count, buffer_mem, BUFFER_MAXMEM, buffer_dirtymem);
+	kprintf("hits %u, misses %u, evictions %u, writebacks %u, "
+		"prefetches %u\n", buffer_hits, buffer_misses,
+		buffer_evictions, buffer_writebacks, buffer_prefetches);
+	kprintf("flushes %u, throttled releases %u\n",
+		buffer_flushes, buffer_throttles);
+	lock_release(buffer_lock);
+}
+
+void
+buffer_bootstrap(void)
+{
+	int result;
+
+	buffer_lock = lock_create("buffer cache");
+	if (buffer_lock == NULL) {
+		panic("buffer_bootstrap: Out of memory\n");
+	}
+	buffer_cv = cv_create("buffer cache");
+	if (buffer_cv == NULL) {
+		panic("buffer_bootstrap: Out of memory\n");
+	}
+	buffer_prefetchcv = cv_create("buffer prefetch");
+	if (buffer_prefetchcv == NULL) {
+		panic("buffer_bootstrap: Out of memory\n");
+	}
+
+	result = thread_fork("prefetch", NULL, buffer_prefetch_thread,
+			     NULL, 0);
+	if (result) {
+		panic("buffer_bootstrap: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+	result = thread_fork("flusher", NULL, buffer_flush_thread, NULL, 0);
+	if (result) {
+		panic("buffer_bootstrap: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+}
@@ -42,6 +42,7 @@
 #include <synch.h>
 #include <vnode.h>
 #include <device.h>
+#include <blkq.h>
 
 /*
  * Called for each open().
@@ -386,3 +387,34 @@ dev_uncreate_vnode(struct vnode *vn)
 	vnode_cleanup(vn);
 	kfree(vn);
 }
+
+/*
+ * Asynchronous block I/O. See <device.h>.
+ */
+int
+dev_submit(struct device *d, struct blkreq *req)
+{
+	struct iovec iov;
+	struct uio ku;
+
+	KASSERT(req->br_callback != NULL);
+
+	if (d->d_blocks == 0) {
+		/* Not a block device */
+		return ENODEV;
+	}
+	if (req->br_block + req->br_nblocks > d->d_blocks ||
+	    req->br_block + req->br_nblocks < req->br_block) {
+		return EINVAL;
+	}
+
+	if (d->d_ops->devop_submit != NULL) {
+		return DEVOP_SUBMIT(d, req);
+	}
+
+	uio_kinit(&iov, &ku, req->br_data, req->br_nblocks * d->d_blocksize,
+		  (off_t)req->br_block * d->d_blocksize,
+		  req->br_iswrite ? UIO_WRITE : UIO_READ);
+	blkq_complete(req, DEVOP_IO(d, &ku));
+	return 0;
+}
@@ -0,0 +1,488 @@
+/*
+ * Anonymous pipe objects. See <pipe.h>.
+ *
+ * The ring is single-producer/single-consumer: pp_tail is only
+ * written by the thread that currently owns the write end and pp_head
+ * only by the thread that owns the read end, so data moves without
+ * any lock held.
+ *
+ * Ownership of an end (needed when several processes share it after
+ * dup2) is taken with an atomic test-and-set on po_busy. A thread that
+ * finds the end busy counts itself in po_waiters and sleeps on the
+ * end's own po_wchan under pp_lock; the owner clears po_busy and then
+ * checks po_waiters, with a full barrier in between, so it only takes
+ * pp_lock when someone is actually waiting.
+ *
+ * Waiting for data or space works the same way: a sleeping thread
+ * sets its pp_*waiting flag and rechecks the ring under pp_lock; the
+ * other side publishes its counter and then checks the flag. So a
+ * wakeup can't be lost, and a read or write that neither contends for
+ * its end nor has to wait for the other side never touches pp_lock.
+ * pp_lock is never held across uiomove.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stattypes.h>
+#include <stat.h>
+#include <lib.h>
+#include <membar.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <uio.h>
+#include <vnode.h>
+#include <pipe.h>
+
+/*
+ * Ownership of one end of the pipe.
+ */
+struct pipe_owner {
+	volatile spinlock_data_t po_busy; /* some thread owns the end */
+	volatile unsigned po_waiters;	/* threads waiting; under pp_lock */
+	struct wchan *po_wchan;		/* where they wait */
+};
+
+struct pipe {
+	char *pp_buf;			/* PIPE_SIZE bytes of ring */
+	volatile unsigned pp_head;	/* bytes consumed; reader only */
+	volatile unsigned pp_tail;	/* bytes produced; writer only */
+	struct pipe_owner pp_rown;	/* read end ownership */
+	struct pipe_owner pp_wown;	/* write end ownership */
+
+	struct spinlock pp_lock;	/* protects everything below */
+	struct wchan *pp_rwchan;	/* readers wait for data or the end */
+	struct wchan *pp_wwchan;	/* writers wait for space or the end */
+	volatile bool pp_rwaiting;	/* a reader is (about to be) asleep */
+	volatile bool pp_wwaiting;	/* a writer is (about to be) asleep */
+	bool pp_rclosed;		/* read end reclaimed */
+	bool pp_wclosed;		/* write end reclaimed */
+
+	struct vnode pp_rvn;		/* read end */
+	struct vnode pp_wvn;		/* write end */
+};
+
+#define PIPE_USED(pp)	((pp)->pp_tail - (pp)->pp_head)
+#define PIPE_FREE(pp)	(PIPE_SIZE - PIPE_USED(pp))
+
+////////////////////////////////////////////////////////////
+// ring helpers
+
+/*
+ * Take ownership of one end of the pipe, waiting for any other
+ * thread using it to finish.
+ */
+static
+void
+pipe_claim(struct pipe *pp, struct pipe_owner *po)
+{
+	if (spinlock_data_testandset(&po->po_busy) == 0) {
+		/* uncontended */
+		membar_any_any();
+		return;
+	}
+
+	spinlock_acquire(&pp->pp_lock);
+	po->po_waiters++;
+	membar_any_any();
+	while (spinlock_data_testandset(&po->po_busy) != 0) {
+		wchan_sleep(po->po_wchan, &pp->pp_lock);
+	}
+	po->po_waiters--;
+	spinlock_release(&pp->pp_lock);
+	membar_any_any();
+}
+
+static
+void
+pipe_unclaim(struct pipe *pp, struct pipe_owner *po)
+{
+	/* finish with the ring before letting anyone else at it */
+	membar_any_any();
+	spinlock_data_set(&po->po_busy, 0);
+	membar_any_any();
+	if (po->po_waiters > 0) {
+		spinlock_acquire(&pp->pp_lock);
+		wchan_wakeone(po->po_wchan, &pp->pp_lock);
+		spinlock_release(&pp->pp_lock);
+	}
+}
+
+/*
+ * Wake the other side if it said it was going to sleep. Called after
+ * publishing a new head or tail.
+ */
+static
+void
+pipe_kick(struct pipe *pp, volatile bool *waiting, struct wchan *wc)
+{
+	membar_any_any();
+	if (*waiting) {
+		spinlock_acquire(&pp->pp_lock);
+		wchan_wakeall(wc, &pp->pp_lock);
+		spinlock_release(&pp->pp_lock);
+	}
+}
+
+/*
+ * Move LEN bytes between the ring at counter position POS and the
+ * uio, wrapping around the end of the buffer if needed.
+ */
+static
+int
+pipe_move(struct pipe *pp, unsigned pos, size_t len, struct uio *uio)
+{
+	unsigned off = pos & (PIPE_SIZE - 1);
+	size_t first;
+	int result;
+
+	first = PIPE_SIZE - off;
+	if (first > len) {
+		first = len;
+	}
+	result = uiomove(pp->pp_buf + off, first, uio);
+	if (result) {
+		return result;
+	}
+	if (len > first) {
+		result = uiomove(pp->pp_buf, len - first, uio);
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// vnode ops
+
+static
+int
+pipe_eachopen(struct vnode *vn, int openflags)
+{
+	/* pipes are only ever created by pipe_create, never opened */
+	(void)vn;
+	(void)openflags;
+	return EINVAL;
+}
+
+static
+int
+pipe_reclaim(struct vnode *vn)
+{
+	struct pipe *pp = vn->vn_data;
+	bool done;
+
+	/* once the other end sees our flag it may free pp, vnode and all */
+	vnode_cleanup(vn);
+
+	spinlock_acquire(&pp->pp_lock);
+	if (vn == &pp->pp_rvn) {
+		/* writers now get EPIPE */
+		pp->pp_rclosed = true;
+		wchan_wakeall(pp->pp_wwchan, &pp->pp_lock);
+	}
+	else {
+		/* readers now get EOF once the ring drains */
+		KASSERT(vn == &pp->pp_wvn);
+		pp->pp_wclosed = true;
+		wchan_wakeall(pp->pp_rwchan, &pp->pp_lock);
+	}
+	done = pp->pp_rclosed && pp->pp_wclosed;
+	spinlock_release(&pp->pp_lock);
+
+	if (done) {
+		wchan_destroy(pp->pp_wown.po_wchan);
+		wchan_destroy(pp->pp_rown.po_wchan);
+		wchan_destroy(pp->pp_wwchan);
+		wchan_destroy(pp->pp_rwchan);
+		spinlock_cleanup(&pp->pp_lock);
+		kfree(pp->pp_buf);
+		kfree(pp);
+	}
+	return 0;
+}
+
+static
+int
+pipe_read(struct vnode *vn, struct uio *uio)
+{
+	struct pipe *pp = vn->vn_data;
+	unsigned head;
+	size_t len;
+	int result;
+
+	if (uio->uio_resid == 0) {
+		return 0;
+	}
+
+	pipe_claim(pp, &pp->pp_rown);
+
+	if (PIPE_USED(pp) == 0) {
+		/* slow path: sleep until there is data or no writer */
+		spinlock_acquire(&pp->pp_lock);
+		pp->pp_rwaiting = true;
+		membar_any_any();
+		while (PIPE_USED(pp) == 0 && !pp->pp_wclosed) {
+			wchan_sleep(pp->pp_rwchan, &pp->pp_lock);
+		}
+		pp->pp_rwaiting = false;
+		spinlock_release(&pp->pp_lock);
+	}
+
+	len = PIPE_USED(pp);
+	if (len == 0) {
+		/* EOF */
+		pipe_unclaim(pp, &pp->pp_rown);
+		return 0;
+	}
+	if (len > uio->uio_resid) {
+		len = uio->uio_resid;
+	}
+
+	/* see the data before the tail that covers it */
+	membar_load_load();
+	head = pp->pp_head;
+	result = pipe_move(pp, head, len, uio);
+	if (result == 0) {
+		/* finish reading the data before handing the space back */
+		membar_any_store();
+		pp->pp_head = head + len;
+		pipe_kick(pp, &pp->pp_wwaiting, pp->pp_wwchan);
+	}
+
+	pipe_unclaim(pp, &pp->pp_rown);
+	return result;
+}
+
+static
+int
+pipe_write(struct vnode *vn, struct uio *uio)
+{
+	struct pipe *pp = vn->vn_data;
+	size_t start = uio->uio_resid;
+	size_t need, len;
+	unsigned tail;
+	int result = 0;
+
+	pipe_claim(pp, &pp->pp_wown);
+
+	while (uio->uio_resid > 0) {
+		/* writes of up to PIPE_BUF bytes must not be split */
+		need = uio->uio_resid <= PIPE_BUF ? uio->uio_resid : 1;
+
+		if (PIPE_FREE(pp) < need || pp->pp_rclosed) {
+			/* slow path: sleep until there is room or no reader */
+			spinlock_acquire(&pp->pp_lock);
+			pp->pp_wwaiting = true;
+			membar_any_any();
+			while (PIPE_FREE(pp) < need && !pp->pp_rclosed) {
+				wchan_sleep(pp->pp_wwchan, &pp->pp_lock);
+			}
+			pp->pp_wwaiting = false;
+			spinlock_release(&pp->pp_lock);
+
+			if (pp->pp_rclosed) {
+				/* report a partial write as such */
+				result = uio->uio_resid == start ? EPIPE : 0;
+				break;
+			}
+		}
+
+		len = PIPE_FREE(pp);
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+
+		tail = pp->pp_tail;
+		result = pipe_move(pp, tail, len, uio);
+		if (result) {
+			break;
+		}
+		/* make the data visible before the tail that covers it */
+		membar_store_store();
+		pp->pp_tail = tail + len;
+		pipe_kick(pp, &pp->pp_rwaiting, pp->pp_rwchan);
+	}
+
+	pipe_unclaim(pp, &pp->pp_wown);
+	return result;
+}
+
+static
+int
+pipe_badend(struct vnode *vn, struct uio *uio)
+{
+	/* reading the write end or writing the read end */
+	(void)vn;
+	(void)uio;
+	return EBADF;
+}
+
+static
+int
+pipe_ioctl(struct vnode *vn, int op, userptr_t data)
+{
+	(void)vn;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+pipe_stat(struct vnode *vn, struct stat *statbuf)
+{
+	struct pipe *pp = vn->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+	statbuf->st_mode = S_IFIFO | 0600;
+	statbuf->st_nlink = 1;
+	statbuf->st_size = PIPE_USED(pp);
+	statbuf->st_blksize = PIPE_BUF;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *vn, mode_t *ret)
+{
+	(void)vn;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+bool
+pipe_isseekable(struct vnode *vn)
+{
+	(void)vn;
+	return false;
+}
+
+static
+int
+pipe_fsync(struct vnode *vn)
+{
+	(void)vn;
+	return 0;
+}
+
+static
+int
+pipe_truncate(struct vnode *vn, off_t len)
+{
+	(void)vn;
+	(void)len;
+	return EINVAL;
+}
+
+#define PIPE_OPS(readop, writeop)			\
+	{						\
+	.vop_magic = VOP_MAGIC,				\
+							\
+	.vop_eachopen = pipe_eachopen,			\
+	.vop_reclaim = pipe_reclaim,			\
+							\
+	.vop_read = readop,				\
+	.vop_readlink = vopfail_uio_inval,		\
+	.vop_getdirentry = vopfail_uio_notdir,		\
+	.vop_write = writeop,				\
+	.vop_ioctl = pipe_ioctl,			\
+	.vop_stat = pipe_stat,				\
+	.vop_gettype = pipe_gettype,			\
+	.vop_isseekable = pipe_isseekable,		\
+	.vop_fsync = pipe_fsync,			\
+	.vop_mmap = vopfail_mmap_perm,			\
+	.vop_truncate = pipe_truncate,			\
+	.vop_namefile = vopfail_uio_notdir,		\
+							\
+	.vop_creat = vopfail_creat_notdir,		\
+	.vop_symlink = vopfail_symlink_notdir,		\
+	.vop_mkdir = vopfail_mkdir_notdir,		\
+	.vop_link = vopfail_link_notdir,		\
+	.vop_remove = vopfail_string_notdir,		\
+	.vop_rmdir = vopfail_string_notdir,		\
+	.vop_rename = vopfail_rename_notdir,		\
+	.vop_lookup = vopfail_lookup_notdir,		\
+	.vop_lookparent = vopfail_lookparent_notdir,	\
+	}
+
+static const struct vnode_ops pipe_rops = PIPE_OPS(pipe_read, pipe_badend);
+static const struct vnode_ops pipe_wops = PIPE_OPS(pipe_badend, pipe_write);
+
+////////////////////////////////////////////////////////////
+// creation
+
+int
+pipe_create(struct vnode **rd_ret, struct vnode **wr_ret)
+{
+	struct pipe *pp;
+	int result;
+
+	pp = kmalloc(sizeof(*pp));
+	if (pp == NULL) {
+		return ENOMEM;
+	}
+	pp->pp_buf = kmalloc(PIPE_SIZE);
+	if (pp->pp_buf == NULL) {
+		result = ENOMEM;
+		goto fail_pp;
+	}
+	pp->pp_rwchan = wchan_create("pipe reader");
+	if (pp->pp_rwchan == NULL) {
+		result = ENOMEM;
+		goto fail_buf;
+	}
+	pp->pp_wwchan = wchan_create("pipe writer");
+	if (pp->pp_wwchan == NULL) {
+		result = ENOMEM;
+		goto fail_rwchan;
+	}
+	pp->pp_rown.po_wchan = wchan_create("pipe read end");
+	if (pp->pp_rown.po_wchan == NULL) {
+		result = ENOMEM;
+		goto fail_wwchan;
+	}
+	pp->pp_wown.po_wchan = wchan_create("pipe write end");
+	if (pp->pp_wown.po_wchan == NULL) {
+		result = ENOMEM;
+		goto fail_rown;
+	}
+
+	pp->pp_head = 0;
+	pp->pp_tail = 0;
+	spinlock_data_set(&pp->pp_rown.po_busy, 0);
+	pp->pp_rown.po_waiters = 0;
+	spinlock_data_set(&pp->pp_wown.po_busy, 0);
+	pp->pp_wown.po_waiters = 0;
+	spinlock_init(&pp->pp_lock);
+	pp->pp_rwaiting = false;
+	pp->pp_wwaiting = false;
+	pp->pp_rclosed = false;
+	pp->pp_wclosed = false;
+
+	result = vnode_init(&pp->pp_rvn, &pipe_rops, NULL, pp);
+	if (result) {
+		goto fail_lock;
+	}
+	result = vnode_init(&pp->pp_wvn, &pipe_wops, NULL, pp);
+	if (result) {
+		vnode_cleanup(&pp->pp_rvn);
+		goto fail_lock;
+	}
+
+	*rd_ret = &pp->pp_rvn;
+	*wr_ret = &pp->pp_wvn;
+	return 0;
+
+ fail_lock:
+	spinlock_cleanup(&pp->pp_lock);
+	wchan_destroy(pp->pp_wown.po_wchan);
+ fail_rown:
+	wchan_destroy(pp->pp_rown.po_wchan);
+ fail_wwchan:
+	wchan_destroy(pp->pp_wwchan);
+ fail_rwchan:
+	wchan_destroy(pp->pp_rwchan);
+ fail_buf:
+	kfree(pp->pp_buf);
+ fail_pp:
+	kfree(pp);
+	return result;
+}
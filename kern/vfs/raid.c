@@ -0,0 +1,497 @@
+/*
+ * Software RAID. See <raid.h> for what it does.
+ *
+ * A RAID device is driven entirely through devop_submit: a request
+ * is turned into child requests for the disks (for a stripe, one per
+ * piece that lives on a single disk; for a mirror, one per disk for a
+ * write and one for a read), and the children are sent to the disks
+ * with dev_submit, all at once, so the disks work in parallel. The
+ * children's callbacks run on the block queue's callback thread
+ * (br_inthread), since the last one to finish frees the bookkeeping;
+ * it then finishes the original request. devop_io is blkq_devio on
+ * top of that.
+ *
+ * devop_submit allocates memory, so unlike a disk's it may only be
+ * called from a thread.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <blkq.h>
+#include <raid.h>
+
+struct raid_softc {
+	struct device rd_dev;		/* our VFS device */
+	char rd_name[16];		/* its name, for messages */
+	unsigned rd_ndisks;
+	struct device *rd_disks[RAID_MAXDISKS];
+	uint32_t rd_stripe;		/* blocks per stripe unit */
+
+	struct spinlock rd_lock;	/* for everything below */
+	unsigned rd_busy[RAID_MAXDISKS];	/* requests out to each disk */
+	daddr_t rd_pos[RAID_MAXDISKS];	/* block after each disk's last */
+};
+
+/*
+ * One request in progress, and its children.
+ */
+struct raid_child {
+	struct blkreq rc_req;
+	struct raid_io *rc_io;
+	unsigned rc_disk;		/* index in rd_disks */
+};
+
+struct raid_io {
+	struct raid_softc *ri_rd;
+	struct blkreq *ri_parent;
+	unsigned ri_pending;		/* children not finished */
+	int ri_result;			/* first error from a child */
+	unsigned ri_retries;		/* other disks a failed child may try */
+	unsigned ri_nchildren;
+	struct raid_child ri_children[];
+};
+
+static void raid_childdone(struct blkreq *child);
+
+/* Number of devices of each kind made, for naming them. */
+static unsigned raid_nstripes;
+static unsigned raid_nmirrors;
+
+////////////////////////////////////////////////////////////
+// requests
+
+/*
+ * Find where BLOCK of the stripe lives: which disk, which block on
+ * it, and how many blocks from there on are on the same disk.
+ */
+static
+void
+raid_stripe_map(struct raid_softc *rd, daddr_t block,
+		unsigned *disk, daddr_t *diskblock, uint32_t *left)
+{
+	uint32_t unit, off;
+
+	unit = block / rd->rd_stripe;
+	off = block % rd->rd_stripe;
+	*disk = unit % rd->rd_ndisks;
+	*diskblock = (unit / rd->rd_ndisks) * rd->rd_stripe + off;
+	*left = rd->rd_stripe - off;
+}
+
+/*
+ * Count how many pieces a request of NBLOCKS from BLOCK splits into.
+ */
+static
+unsigned
+raid_stripe_npieces(struct raid_softc *rd, daddr_t block, uint32_t nblocks)
+{
+	uint32_t first;
+
+	first = rd->rd_stripe - block % rd->rd_stripe;
+	if (nblocks <= first) {
+		return 1;
+	}
+	return 1 + DIVROUNDUP(nblocks - first, rd->rd_stripe);
+}
+
+/*
+ * Allocate the bookkeeping for a request with N children.
+ */
+static
+struct raid_io *
+raid_io_create(struct raid_softc *rd, struct blkreq *parent, unsigned n)
+{
+	struct raid_io *ri;
+	unsigned i;
+
+	ri = kmalloc(sizeof(*ri) + n * sizeof(struct raid_child));
+	if (ri == NULL) {
+		return NULL;
+	}
+	ri->ri_rd = rd;
+	ri->ri_parent = parent;
+	ri->ri_pending = n;
+	ri->ri_result = 0;
+	ri->ri_retries = 0;
+	ri->ri_nchildren = n;
+	for (i=0; i<n; i++) {
+		ri->ri_children[i].rc_io = ri;
+		ri->ri_children[i].rc_req.br_callback = raid_childdone;
+		ri->ri_children[i].rc_req.br_cbdata = &ri->ri_children[i];
+		ri->ri_children[i].rc_req.br_inthread = true;
+	}
+	return ri;
+}
+
+/*
+ * Send one child to its disk. On failure, finish it with the error.
+ */
+static
+void
+raid_startchild(struct raid_child *rc)
+{
+	struct raid_softc *rd = rc->rc_io->ri_rd;
+	int result;
+
+	spinlock_acquire(&rd->rd_lock);
+	rd->rd_busy[rc->rc_disk]++;
+	rd->rd_pos[rc->rc_disk] = rc->rc_req.br_block + rc->rc_req.br_nblocks;
+	spinlock_release(&rd->rd_lock);
+
+	result = dev_submit(rd->rd_disks[rc->rc_disk], &rc->rc_req);
+	if (result) {
+		rc->rc_req.br_result = result;
+		raid_childdone(&rc->rc_req);
+	}
+}
+
+/*
+ * Callback for a child request.
+ *
+ * If it failed and there are retries left, send it again to the next
+ * disk instead; this is only done for mirror reads, where every disk
+ * has the same data.
+ */
+static
+void
+raid_childdone(struct blkreq *child)
+{
+	struct raid_child *rc = child->br_cbdata;
+	struct raid_io *ri = rc->rc_io;
+	struct raid_softc *rd = ri->ri_rd;
+	bool retry, last;
+
+	spinlock_acquire(&rd->rd_lock);
+	KASSERT(rd->rd_busy[rc->rc_disk] > 0);
+	rd->rd_busy[rc->rc_disk]--;
+	retry = (child->br_result != 0 && ri->ri_retries > 0);
+	if (retry) {
+		ri->ri_retries--;
+		rc->rc_disk = (rc->rc_disk + 1) % rd->rd_ndisks;
+	}
+	else {
+		if (child->br_result && ri->ri_result == 0) {
+			ri->ri_result = child->br_result;
+		}
+		KASSERT(ri->ri_pending > 0);
+		ri->ri_pending--;
+	}
+	last = (ri->ri_pending == 0);
+	spinlock_release(&rd->rd_lock);
+
+	if (retry) {
+		kprintf("%s: error %d, retrying on disk %u\n",
+			rd->rd_name, child->br_result, rc->rc_disk);
+		raid_startchild(rc);
+	}
+	else if (last) {
+		blkq_complete(ri->ri_parent, ri->ri_result);
+		kfree(ri);
+	}
+}
+
+/*
+ * Send all of RI's children to their disks.
+ */
+static
+void
+raid_startchildren(struct raid_io *ri)
+{
+	unsigned i, n;
+
+	/*
+	 * Read the count first: the last child to finish frees RI,
+	 * and that may be before the loop gets to the end.
+	 */
+	n = ri->ri_nchildren;
+	for (i=0; i<n; i++) {
+		raid_startchild(&ri->ri_children[i]);
+	}
+}
+
+static
+int
+raid_stripe_submit(struct device *d, struct blkreq *req)
+{
+	struct raid_softc *rd = d->d_data;
+	struct raid_io *ri;
+	struct raid_child *rc;
+	unsigned n, i;
+	daddr_t block;
+	uint32_t nblocks, left;
+	char *data;
+
+	n = raid_stripe_npieces(rd, req->br_block, req->br_nblocks);
+	ri = raid_io_create(rd, req, n);
+	if (ri == NULL) {
+		return ENOMEM;
+	}
+
+	block = req->br_block;
+	nblocks = req->br_nblocks;
+	data = req->br_data;
+	for (i=0; i<n; i++) {
+		rc = &ri->ri_children[i];
+		raid_stripe_map(rd, block, &rc->rc_disk,
+				&rc->rc_req.br_block, &left);
+		if (left > nblocks) {
+			left = nblocks;
+		}
+		rc->rc_req.br_nblocks = left;
+		rc->rc_req.br_iswrite = req->br_iswrite;
+		rc->rc_req.br_data = data;
+		block += left;
+		nblocks -= left;
+		data += left * d->d_blocksize;
+	}
+	KASSERT(nblocks == 0);
+
+	raid_startchildren(ri);
+	return 0;
+}
+
+/*
+ * Choose which disk of a mirror to read BLOCK from: the one with the
+ * fewest requests out, and of those, the one whose last request ended
+ * nearest BLOCK. This is only a hint; it doesn't matter if things have
+ * changed by the time the request gets there.
+ */
+static
+unsigned
+raid_mirror_pick(struct raid_softc *rd, daddr_t block)
+{
+	unsigned i, best;
+	uint32_t dist, bestdist;
+
+	best = 0;
+	bestdist = 0;
+	spinlock_acquire(&rd->rd_lock);
+	for (i=0; i<rd->rd_ndisks; i++) {
+		dist = block > rd->rd_pos[i] ?
+			block - rd->rd_pos[i] : rd->rd_pos[i] - block;
+		if (i == 0 || rd->rd_busy[i] < rd->rd_busy[best] ||
+		    (rd->rd_busy[i] == rd->rd_busy[best] &&
+		     dist < bestdist)) {
+			best = i;
+			bestdist = dist;
+		}
+	}
+	spinlock_release(&rd->rd_lock);
+	return best;
+}
+
+/*
+ * A write goes to every disk. A read goes to one, and if that fails,
+ * to each of the others in turn until one works.
+ */
+static
+int
+raid_mirror_submit(struct device *d, struct blkreq *req)
+{
+	struct raid_softc *rd = d->d_data;
+	struct raid_io *ri;
+	struct raid_child *rc;
+	unsigned n, i;
+
+	n = req->br_iswrite ? rd->rd_ndisks : 1;
+	ri = raid_io_create(rd, req, n);
+	if (ri == NULL) {
+		return ENOMEM;
+	}
+
+	for (i=0; i<n; i++) {
+		rc = &ri->ri_children[i];
+		rc->rc_disk = i;
+		rc->rc_req.br_block = req->br_block;
+		rc->rc_req.br_nblocks = req->br_nblocks;
+		rc->rc_req.br_iswrite = req->br_iswrite;
+		rc->rc_req.br_data = req->br_data;
+	}
+	if (!req->br_iswrite) {
+		ri->ri_children[0].rc_disk =
+			raid_mirror_pick(rd, req->br_block);
+		ri->ri_retries = rd->rd_ndisks - 1;
+	}
+
+	raid_startchildren(ri);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// device operations
+
+static
+int
+raid_eachopen(struct device *d, int openflags)
+{
+	(void)d;
+	(void)openflags;
+	return 0;
+}
+
+static
+int
+raid_io(struct device *d, struct uio *uio)
+{
+	if (uio->uio_offset % d->d_blocksize != 0 ||
+	    uio->uio_resid % d->d_blocksize != 0) {
+		return EINVAL;
+	}
+	if (uio->uio_offset / d->d_blocksize +
+	    uio->uio_resid / d->d_blocksize > d->d_blocks) {
+		return EINVAL;
+	}
+	return blkq_devio(d, uio);
+}
+
+static
+int
+raid_ioctl(struct device *d, int op, userptr_t data)
+{
+	(void)d;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+static const struct device_ops raid_stripe_devops = {
+	.devop_eachopen = raid_eachopen,
+	.devop_io = raid_io,
+	.devop_ioctl = raid_ioctl,
+	.devop_submit = raid_stripe_submit,
+};
+
+static const struct device_ops raid_mirror_devops = {
+	.devop_eachopen = raid_eachopen,
+	.devop_io = raid_io,
+	.devop_ioctl = raid_ioctl,
+	.devop_submit = raid_mirror_submit,
+};
+
+////////////////////////////////////////////////////////////
+// setup
+
+/*
+ * Claim the disks for a new device, and check they go together.
+ * Hands back the size of the smallest. On failure none are claimed.
+ */
+static
+int
+raid_claimdisks(struct raid_softc *rd, unsigned ndisks, char **disknames,
+		blkcnt_t *minblocks)
+{
+	unsigned i;
+	int result;
+
+	if (ndisks < 2 || ndisks > RAID_MAXDISKS) {
+		return EINVAL;
+	}
+
+	for (i=0; i<ndisks; i++) {
+		result = vfs_claimdev(disknames[i], &rd->rd_disks[i]);
+		if (result == 0 && rd->rd_disks[i]->d_blocksize !=
+		    rd->rd_disks[0]->d_blocksize) {
+			vfs_releasedev(disknames[i]);
+			result = EINVAL;
+		}
+		if (result) {
+			while (i > 0) {
+				i--;
+				vfs_releasedev(disknames[i]);
+			}
+			return result;
+		}
+		if (i == 0 || rd->rd_disks[i]->d_blocks < *minblocks) {
+			*minblocks = rd->rd_disks[i]->d_blocks;
+		}
+	}
+	rd->rd_ndisks = ndisks;
+	return 0;
+}
+
+/*
+ * Make a device with operations OPS over the disks in DISKNAMES and
+ * add it to VFS, named KIND followed by *COUNT. STRIPEBLOCKS is the
+ * stripe unit for a stripe, or 0 for a mirror.
+ */
+static
+int
+raid_create(const struct device_ops *ops, const char *kind, unsigned *count,
+	    uint32_t stripeblocks, unsigned ndisks, char **disknames)
+{
+	struct raid_softc *rd;
+	blkcnt_t minblocks;
+	unsigned i;
+	int result;
+
+	rd = kmalloc(sizeof(*rd));
+	if (rd == NULL) {
+		return ENOMEM;
+	}
+	result = raid_claimdisks(rd, ndisks, disknames, &minblocks);
+	if (result) {
+		kfree(rd);
+		return result;
+	}
+	rd->rd_stripe = stripeblocks;
+	spinlock_init(&rd->rd_lock);
+	for (i=0; i<ndisks; i++) {
+		rd->rd_busy[i] = 0;
+		rd->rd_pos[i] = 0;
+	}
+
+	rd->rd_dev.d_ops = ops;
+	if (stripeblocks > 0) {
+		rd->rd_dev.d_blocks =
+			(minblocks / stripeblocks) * stripeblocks * ndisks;
+	}
+	else {
+		rd->rd_dev.d_blocks = minblocks;
+	}
+	rd->rd_dev.d_blocksize = rd->rd_disks[0]->d_blocksize;
+	rd->rd_dev.d_data = rd;
+	if (rd->rd_dev.d_blocks == 0) {
+		result = EINVAL;
+		goto fail;
+	}
+
+	snprintf(rd->rd_name, sizeof(rd->rd_name), "%s%u", kind, *count);
+	result = vfs_adddev(rd->rd_name, &rd->rd_dev, 1);
+	if (result) {
+		goto fail;
+	}
+	(*count)++;
+
+	kprintf("%s: %u disks, %u blocks\n", rd->rd_name,
+		ndisks, (unsigned)rd->rd_dev.d_blocks);
+	return 0;
+
+ fail:
+	for (i=0; i<ndisks; i++) {
+		vfs_releasedev(disknames[i]);
+	}
+	spinlock_cleanup(&rd->rd_lock);
+	kfree(rd);
+	return result;
+}
+
+int
+raid_stripe_create(uint32_t stripeblocks, unsigned ndisks, char **disknames)
+{
+	if (stripeblocks == 0) {
+		return EINVAL;
+	}
+	return raid_create(&raid_stripe_devops, "stripe", &raid_nstripes,
+			   stripeblocks, ndisks, disknames);
+}
+
+int
+raid_mirror_create(unsigned ndisks, char **disknames)
+{
+	return raid_create(&raid_mirror_devops, "mirror", &raid_nmirrors,
+			   0, ndisks, disknames);
+}
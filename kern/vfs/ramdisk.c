@@ -0,0 +1,148 @@
+/*
+ * RAM disk: a block device whose blocks live in kernel memory, made
+ * with the "ramdisk" menu command (which can also be given on the
+ * kernel's boot command line). It holds nothing across a reboot, but
+ * I/O to it is a memory copy, so a filesystem on it runs without
+ * waiting for a disk.
+ *
+ * The memory is allocated a page at a time, so a large RAM disk
+ * doesn't need a large contiguous piece of memory. It is never freed.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <vm.h>
+#include <vfs.h>
+#include <device.h>
+
+#define RAMDISK_BLOCKSIZE	512
+#define RAMDISK_BLOCKSPERPAGE	(PAGE_SIZE / RAMDISK_BLOCKSIZE)
+
+struct ramdisk {
+	struct device rd_dev;		/* our VFS device */
+	unsigned rd_npages;
+	vaddr_t *rd_pages;		/* the memory, page by page */
+};
+
+/* Number of RAM disks made, for naming them. */
+static unsigned ramdisk_count;
+
+static
+int
+ramdisk_eachopen(struct device *d, int openflags)
+{
+	(void)d;
+	(void)openflags;
+	return 0;
+}
+
+/*
+ * Copy straight to or from the pages, a page at a time.
+ */
+static
+int
+ramdisk_io(struct device *d, struct uio *uio)
+{
+	struct ramdisk *rd = d->d_data;
+	off_t pos;
+	size_t off, len;
+	int result;
+
+	if (uio->uio_offset % RAMDISK_BLOCKSIZE != 0 ||
+	    uio->uio_resid % RAMDISK_BLOCKSIZE != 0) {
+		return EINVAL;
+	}
+	if (uio->uio_offset / RAMDISK_BLOCKSIZE +
+	    uio->uio_resid / RAMDISK_BLOCKSIZE > d->d_blocks) {
+		return EINVAL;
+	}
+
+	while (uio->uio_resid > 0) {
+		pos = uio->uio_offset;
+		off = pos % PAGE_SIZE;
+		len = PAGE_SIZE - off;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove((char *)rd->rd_pages[pos / PAGE_SIZE] + off,
+				 len, uio);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+static
+int
+ramdisk_ioctl(struct device *d, int op, userptr_t data)
+{
+	(void)d;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+static const struct device_ops ramdisk_devops = {
+	.devop_eachopen = ramdisk_eachopen,
+	.devop_io = ramdisk_io,
+	.devop_ioctl = ramdisk_ioctl,
+};
+
+int
+ramdisk_create(blkcnt_t nblocks)
+{
+	struct ramdisk *rd;
+	char name[16];
+	unsigned i;
+	int result;
+
+	if (nblocks == 0) {
+		return EINVAL;
+	}
+
+	rd = kmalloc(sizeof(*rd));
+	if (rd == NULL) {
+		return ENOMEM;
+	}
+	rd->rd_npages = DIVROUNDUP(nblocks, RAMDISK_BLOCKSPERPAGE);
+	rd->rd_pages = kmalloc(rd->rd_npages * sizeof(vaddr_t));
+	if (rd->rd_pages == NULL) {
+		kfree(rd);
+		return ENOMEM;
+	}
+	for (i=0; i<rd->rd_npages; i++) {
+		rd->rd_pages[i] = alloc_kpages(1);
+		if (rd->rd_pages[i] == 0) {
+			result = ENOMEM;
+			goto fail;
+		}
+		bzero((void *)rd->rd_pages[i], PAGE_SIZE);
+	}
+
+	rd->rd_dev.d_ops = &ramdisk_devops;
+	rd->rd_dev.d_blocks = nblocks;
+	rd->rd_dev.d_blocksize = RAMDISK_BLOCKSIZE;
+	rd->rd_dev.d_data = rd;
+
+	snprintf(name, sizeof(name), "ram%u", ramdisk_count);
+	result = vfs_adddev(name, &rd->rd_dev, 1);
+	if (result) {
+		goto fail;
+	}
+	ramdisk_count++;
+
+	kprintf("%s: %u blocks, %u bytes\n", name, (unsigned)nblocks,
+		(unsigned)nblocks * RAMDISK_BLOCKSIZE);
+	return 0;
+
+ fail:
+	while (i > 0) {
+		i--;
+		free_kpages(rd->rd_pages[i]);
+	}
+	kfree(rd->rd_pages);
+	kfree(rd);
+	return result;
+}
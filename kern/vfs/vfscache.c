@@ -0,0 +1,322 @@
+/*
+ * Name cache ("dcache"). See <vfs.h> for the interface.
+ *
+ * A fixed pool of entries, each mapping (directory vnode, name) to
+ * the vnode the name refers to, or to NULL for a name known not to
+ * exist. Entries are found through a hash table and kept on an LRU
+ * list; when the pool is used up the least recently used entry is
+ * recycled. Unused entries (those with no directory) sit at the
+ * least recently used end.
+ *
+ * An entry holds a reference to its directory and to its vnode, so
+ * neither can be reclaimed (and its address reused) while the entry
+ * exists. A file that is removed loses its entry at the same time, so
+ * this doesn't keep deleted files around; but everything a file
+ * system has in the cache must be purged before it can unmount.
+ *
+ * vfs_dcache_lock protects everything here. References are dropped
+ * only after it is released, because dropping the last one calls into
+ * the file system.
+ */
+#include <types.h>
+#include <lib.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+
+/* Number of entries, and of hash chains */
+#define DCACHE_SIZE		128
+#define DCACHE_HASHSIZE		61
+
+/* Names this long or longer aren't cached */
+#define DCACHE_NAMELEN		64
+
+struct dcache_entry {
+	struct dcache_entry *de_hashnext;	/* next on hash chain */
+	struct dcache_entry *de_lruprev;	/* LRU list */
+	struct dcache_entry *de_lrunext;
+	struct vnode *de_dir;			/* directory, or NULL if free */
+	struct vnode *de_vn;			/* its vnode, or NULL if none */
+	char de_name[DCACHE_NAMELEN];
+};
+
+static struct lock *vfs_dcache_lock;
+static struct dcache_entry vfs_dcache_pool[DCACHE_SIZE];
+static struct dcache_entry *vfs_dcache_hash[DCACHE_HASHSIZE];
+static struct dcache_entry *vfs_dcache_lruhead;	/* least recently used */
+static struct dcache_entry *vfs_dcache_lrutail;	/* most recently used */
+
+/* Statistics; protected by vfs_dcache_lock */
+static unsigned vfs_dcache_hits;
+static unsigned vfs_dcache_neghits;
+static unsigned vfs_dcache_misses;
+
+////////////////////////////////////////////////////////////
+// lists
+
+static
+unsigned
+dcache_hashfn(struct vnode *dir, const char *name)
+{
+	unsigned h;
+
+	h = (uintptr_t)dir / sizeof(void *);
+	while (*name) {
+		h = h*33 + (unsigned char)*name++;
+	}
+	return h % DCACHE_HASHSIZE;
+}
+
+static
+void
+dcache_lru_remove(struct dcache_entry *de)
+{
+	if (de->de_lruprev != NULL) {
+		de->de_lruprev->de_lrunext = de->de_lrunext;
+	}
+	else {
+		vfs_dcache_lruhead = de->de_lrunext;
+	}
+	if (de->de_lrunext != NULL) {
+		de->de_lrunext->de_lruprev = de->de_lruprev;
+	}
+	else {
+		vfs_dcache_lrutail = de->de_lruprev;
+	}
+	de->de_lruprev = de->de_lrunext = NULL;
+}
+
+/* Put DE at the most recently used end. */
+static
+void
+dcache_lru_append(struct dcache_entry *de)
+{
+	de->de_lrunext = NULL;
+	de->de_lruprev = vfs_dcache_lrutail;
+	if (vfs_dcache_lrutail != NULL) {
+		vfs_dcache_lrutail->de_lrunext = de;
+	}
+	else {
+		vfs_dcache_lruhead = de;
+	}
+	vfs_dcache_lrutail = de;
+}
+
+/* Put DE at the least recently used end, to be recycled first. */
+static
+void
+dcache_lru_prepend(struct dcache_entry *de)
+{
+	de->de_lruprev = NULL;
+	de->de_lrunext = vfs_dcache_lruhead;
+	if (vfs_dcache_lruhead != NULL) {
+		vfs_dcache_lruhead->de_lruprev = de;
+	}
+	else {
+		vfs_dcache_lrutail = de;
+	}
+	vfs_dcache_lruhead = de;
+}
+
+static
+struct dcache_entry *
+dcache_find(struct vnode *dir, const char *name)
+{
+	struct dcache_entry *de;
+
+	for (de = vfs_dcache_hash[dcache_hashfn(dir, name)];
+	     de != NULL; de = de->de_hashnext) {
+		if (de->de_dir == dir && !strcmp(de->de_name, name)) {
+			return de;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take DE out of the cache and make it free. The references it held
+ * are handed back in *DIR and *VN for the caller to drop once
+ * vfs_dcache_lock is released.
+ */
+static
+void
+dcache_kill(struct dcache_entry *de, struct vnode **dir, struct vnode **vn)
+{
+	struct dcache_entry **dep;
+
+	KASSERT(de->de_dir != NULL);
+
+	for (dep = &vfs_dcache_hash[dcache_hashfn(de->de_dir, de->de_name)];
+	     *dep != de; dep = &(*dep)->de_hashnext) {
+		KASSERT(*dep != NULL);
+	}
+	*dep = de->de_hashnext;
+	de->de_hashnext = NULL;
+
+	*dir = de->de_dir;
+	*vn = de->de_vn;
+	de->de_dir = NULL;
+	de->de_vn = NULL;
+	de->de_name[0] = 0;
+
+	dcache_lru_remove(de);
+	dcache_lru_prepend(de);
+}
+
+/* Drop references handed back by dcache_kill. */
+static
+void
+dcache_drop(struct vnode *dir, struct vnode *vn)
+{
+	if (vn != NULL) {
+		VOP_DECREF(vn);
+	}
+	if (dir != NULL) {
+		VOP_DECREF(dir);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+bool
+vfs_dcache_lookup(struct vnode *dir, const char *name, struct vnode **ret)
+{
+	struct dcache_entry *de;
+
+	if (strlen(name) >= DCACHE_NAMELEN) {
+		return false;
+	}
+
+	lock_acquire(vfs_dcache_lock);
+	de = dcache_find(dir, name);
+	if (de == NULL) {
+		vfs_dcache_misses++;
+		lock_release(vfs_dcache_lock);
+		return false;
+	}
+	dcache_lru_remove(de);
+	dcache_lru_append(de);
+	if (de->de_vn == NULL) {
+		vfs_dcache_neghits++;
+		lock_release(vfs_dcache_lock);
+		*ret = NULL;
+		return true;
+	}
+	vfs_dcache_hits++;
+	VOP_INCREF(de->de_vn);
+	*ret = de->de_vn;
+	lock_release(vfs_dcache_lock);
+	return true;
+}
+
+void
+vfs_dcache_enter(struct vnode *dir, const char *name, struct vnode *vn)
+{
+	struct dcache_entry *de;
+	struct vnode *olddir = NULL, *oldvn = NULL;
+
+	if (strlen(name) >= DCACHE_NAMELEN ||
+	    !strcmp(name, ".") || !strcmp(name, "..")) {
+		/* too long, or would make a reference loop */
+		return;
+	}
+
+	lock_acquire(vfs_dcache_lock);
+	de = dcache_find(dir, name);
+	if (de == NULL) {
+		de = vfs_dcache_lruhead;
+		KASSERT(de != NULL);
+		if (de->de_dir != NULL) {
+			dcache_kill(de, &olddir, &oldvn);
+		}
+		de->de_dir = dir;
+		strcpy(de->de_name, name);
+		VOP_INCREF(dir);
+		de->de_hashnext = vfs_dcache_hash[dcache_hashfn(dir, name)];
+		vfs_dcache_hash[dcache_hashfn(dir, name)] = de;
+	}
+	else {
+		/* replace what it said before */
+		oldvn = de->de_vn;
+	}
+	de->de_vn = vn;
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	dcache_lru_remove(de);
+	dcache_lru_append(de);
+	lock_release(vfs_dcache_lock);
+
+	dcache_drop(olddir, oldvn);
+}
+
+void
+vfs_dcache_remove(struct vnode *dir, const char *name)
+{
+	struct dcache_entry *de;
+	struct vnode *olddir = NULL, *oldvn = NULL;
+
+	lock_acquire(vfs_dcache_lock);
+	de = dcache_find(dir, name);
+	if (de != NULL) {
+		dcache_kill(de, &olddir, &oldvn);
+	}
+	lock_release(vfs_dcache_lock);
+
+	dcache_drop(olddir, oldvn);
+}
+
+void
+vfs_dcache_purgefs(struct fs *fs)
+{
+	struct dcache_entry *de;
+	struct vnode *olddir, *oldvn;
+	unsigned i;
+
+	/*
+	 * Dropping a reference may reclaim a vnode, which may sleep,
+	 * so kill one entry at a time and start over.
+	 */
+ again:
+	lock_acquire(vfs_dcache_lock);
+	for (i=0; i<DCACHE_SIZE; i++) {
+		de = &vfs_dcache_pool[i];
+		if (de->de_dir != NULL && de->de_dir->vn_fs == fs) {
+			dcache_kill(de, &olddir, &oldvn);
+			lock_release(vfs_dcache_lock);
+			dcache_drop(olddir, oldvn);
+			goto again;
+		}
+	}
+	lock_release(vfs_dcache_lock);
+}
+
+void
+vfs_dcache_printstats(void)
+{
+	lock_acquire(vfs_dcache_lock);
+	kprintf("dcache: %u entries; hits %u, negative hits %u, misses %u\n",
+		DCACHE_SIZE, vfs_dcache_hits, vfs_dcache_neghits,
+		vfs_dcache_misses);
+	lock_release(vfs_dcache_lock);
+}
+
+void
+vfs_dcache_bootstrap(void)
+{
+	unsigned i;
+
+	vfs_dcache_lock = lock_create("dcache");
+	if (vfs_dcache_lock == NULL) {
+		panic("vfs_dcache_bootstrap: Out of memory\n");
+	}
+
+	for (i=0; i<DCACHE_SIZE; i++) {
+		vfs_dcache_pool[i].de_hashnext = NULL;
+		vfs_dcache_pool[i].de_dir = NULL;
+		vfs_dcache_pool[i].de_vn = NULL;
+		vfs_dcache_pool[i].de_name[0] = 0;
+		dcache_lru_append(&vfs_dcache_pool[i]);
+	}
+}
@@ -85,12 +85,22 @@ struct knowndev {
 /* A placeholder for kd_fs for devices used as swap */
 #define SWAP_FS	((struct fs *)-1)
 
+/* A placeholder for kd_fs for devices claimed by another device */
+#define CLAIMED_FS	((struct fs *)-2)
+
+/* True if kd_fs is a filesystem, not nothing or a placeholder */
+#define REAL_FS(fs)	((fs) != NULL && (fs) != SWAP_FS && (fs) != CLAIMED_FS)
+
 DECLARRAY(knowndev, static __UNUSED inline);
 DEFARRAY(knowndev, static __UNUSED inline);
 
 static struct knowndevarray *knowndevs;
 
-/* The big lock for all FS ops. Remove for filesystem assignment. */
+/*
+ * The big lock. This covers the list of known devices, mounting and
+ * unmounting, and the boot filesystem; file systems do their own
+ * locking for everything else.
+ */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
 
@@ -112,6 +122,8 @@ vfs_bootstrap(void)
 	}
 	vfs_biglock_depth = 0;
 
+	vfs_dcache_bootstrap();
+
 	devnull_create();
 	semfs_bootstrap();
 }
@@ -180,7 +192,7 @@ vfs_sync(void)
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		dev = knowndevarray_get(knowndevs, i);
-		if (dev->kd_fs != NULL && dev->kd_fs != SWAP_FS) {
+		if (REAL_FS(dev->kd_fs)) {
 			/*result =*/ FSOP_SYNC(dev->kd_fs);
 		}
 	}
@@ -215,7 +227,7 @@ vfs_getroot(const char *devname, struct vnode **ret)
 		 * and DEVNAME names the device, return ENXIO.
 		 */
 
-		if (kd->kd_fs != NULL && kd->kd_fs != SWAP_FS) {
+		if (REAL_FS(kd->kd_fs)) {
 			const char *volname;
 			volname = FSOP_GETVOLNAME(kd->kd_fs);
 
@@ -364,7 +376,7 @@ badnames(const char *n1, const char *n2, const char *n3)
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
 
-		if (kd->kd_fs != NULL && kd->kd_fs != SWAP_FS) {
+		if (REAL_FS(kd->kd_fs)) {
 			volname = FSOP_GETVOLNAME(kd->kd_fs);
 			if (samestring3(volname, n1, n2, n3)) {
 				return 1;
@@ -565,7 +577,8 @@ vfs_mount(const char *devname, void *data,
 	}
 
 	KASSERT(fs != NULL);
-	KASSERT(fs != SWAP_FS); 
+	KASSERT(fs != SWAP_FS);
+	KASSERT(fs != CLAIMED_FS);
 
 	kd->kd_fs = fs;
 
@@ -647,13 +660,16 @@ vfs_unmount(const char *devname)
 		goto fail;
 	}
 
-	if (kd->kd_fs == NULL || kd->kd_fs == SWAP_FS) {
+	if (!REAL_FS(kd->kd_fs)) {
 		result = EINVAL;
 		goto fail;
 	}
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+	/* drop the name cache's references to its vnodes */
+	vfs_dcache_purgefs(kd->kd_fs);
+
 	/* sync the fs */
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
@@ -714,6 +730,66 @@ vfs_swapoff(const char *devname)
 	return result;
 }
 
+/*
+ * Claim a mountable device for the exclusive use of another device
+ * (such as a RAID built on it), handing back the device. Like swapon,
+ * this keeps it from being mounted or used for swap.
+ */
+int
+vfs_claimdev(const char *devname, struct device **ret)
+{
+	struct knowndev *kd;
+	int result;
+
+	vfs_biglock_acquire();
+
+	result = findmount(devname, &kd);
+	if (result) {
+		goto out;
+	}
+
+	if (kd->kd_fs != NULL) {
+		result = EBUSY;
+		goto out;
+	}
+	KASSERT(kd->kd_rawname != NULL);
+	KASSERT(kd->kd_device != NULL);
+
+	kd->kd_fs = CLAIMED_FS;
+	*ret = kd->kd_device;
+
+ out:
+	vfs_biglock_release();
+	return result;
+}
+
+/*
+ * Let go of a device claimed with vfs_claimdev.
+ */
+int
+vfs_releasedev(const char *devname)
+{
+	struct knowndev *kd;
+	int result;
+
+	vfs_biglock_acquire();
+
+	result = findmount(devname, &kd);
+	if (result) {
+		goto out;
+	}
+
+	if (kd->kd_fs != CLAIMED_FS) {
+		result = EINVAL;
+		goto out;
+	}
+	kd->kd_fs = NULL;
+
+ out:
+	vfs_biglock_release();
+	return result;
+}
+
 /*
  * Global unmount function.
  */
@@ -737,7 +813,7 @@ vfs_unmountall(void)
 			/* not mounted */
 			continue;
 		}
-		if (dev->kd_fs == SWAP_FS) {
+		if (dev->kd_fs == SWAP_FS || dev->kd_fs == CLAIMED_FS) {
 			/* just drop it */
 			dev->kd_fs = NULL;
 			continue;
@@ -745,6 +821,8 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+		vfs_dcache_purgefs(dev->kd_fs);
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
@@ -246,11 +246,14 @@ vfs_lookparent(char *path, struct vnode **retval,
 	struct vnode *startvn;
 	int result;
 
+	/*
+	 * The big lock covers only finding where to start; the file
+	 * system does its own locking for the rest.
+	 */
 	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
+	vfs_biglock_release();
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -268,7 +271,6 @@ vfs_lookparent(char *path, struct vnode **retval,
 
 	VOP_DECREF(startvn);
 
-	vfs_biglock_release();
 	return result;
 }
 
@@ -278,23 +280,21 @@ vfs_lookup(char *path, struct vnode **retval)
 	struct vnode *startvn;
 	int result;
 
+	/* As above, the big lock is only for getdevice. */
 	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
+	vfs_biglock_release();
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	if (strlen(path)==0) {
 		*retval = startvn;
-		vfs_biglock_release();
 		return 0;
 	}
 
 	result = VOP_LOOKUP(startvn, path, retval);
 
 	VOP_DECREF(startvn);
-	vfs_biglock_release();
 	return result;
 }
@@ -27,15 +27,27 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <err.h>
+#include <fbatch.h>
 
 /*
  * cat - concatenate and print
  * Usage: cat [files]
  */
 
+/* Buffers, and reads, per batch when printing a named file. */
+#define NBUFS 8
+
+/* Ring for batched reads and writes; usable only if fbatch_init worked. */
+static struct fbatch fb;
+static bool havefb;
+static char bufs[NBUFS][1024];
 
 
 /* Print a file that's already been opened. */
@@ -74,11 +86,87 @@ docat(const char *name, int fd)
 	}
 }
 
+/*
+ * Print a file that's already been opened, through the batch ring:
+ * queue reads into all the buffers at once, then writes of whatever
+ * they got, so each round costs two system calls instead of two per
+ * buffer. The reads run in order, each at the file position the one
+ * before left, so the buffers come back in file order. Only used for
+ * files, where a read that comes up short means EOF; reading ahead
+ * from a terminal or pipe would wait for input cat doesn't need yet.
+ */
+static
+void
+fbcat(const char *name, int fd)
+{
+	struct fbatch_sqe *sqe;
+	struct fbatch_cqe *cqe;
+	int len[NBUFS];
+	int i, n;
+	bool eof = false;
+
+	while (!eof) {
+		for (i=0; i<NBUFS; i++) {
+			sqe = fbatch_get_sqe(&fb);
+			fbatch_prep_read(sqe, fd, bufs[i], sizeof(bufs[i]));
+			sqe->fs_cookie = i;
+		}
+		if (fbatch_submit(&fb) < 0) {
+			err(1, "%s", name);
+		}
+		while ((cqe = fbatch_peek_cqe(&fb)) != NULL) {
+			if (cqe->fc_error) {
+				errno = cqe->fc_error;
+				err(1, "%s", name);
+			}
+			len[cqe->fc_cookie] = cqe->fc_result;
+			fbatch_cqe_seen(&fb);
+		}
+
+		for (n=0; n<NBUFS && !eof; n++) {
+			if (len[n] == 0) {
+				break;
+			}
+			if (len[n] < (int)sizeof(bufs[n])) {
+				eof = true;
+			}
+			sqe = fbatch_get_sqe(&fb);
+			fbatch_prep_write(sqe, STDOUT_FILENO, bufs[n], len[n]);
+			sqe->fs_cookie = n;
+		}
+		if (n < NBUFS) {
+			eof = true;
+		}
+		if (n == 0) {
+			break;
+		}
+		if (fbatch_submit(&fb) < 0) {
+			err(1, "stdout");
+		}
+		while ((cqe = fbatch_peek_cqe(&fb)) != NULL) {
+			if (cqe->fc_error) {
+				errno = cqe->fc_error;
+				err(1, "stdout");
+			}
+			/*
+			 * Later writes have already gone out, so the rest
+			 * can't be written now. Short writes only happen
+			 * when nobody is reading any more.
+			 */
+			if (cqe->fc_result != len[cqe->fc_cookie]) {
+				errx(1, "stdout: Short write");
+			}
+			fbatch_cqe_seen(&fb);
+		}
+	}
+}
+
 /* Print a file by name. */
 static
 void
 cat(const char *file)
 {
+	struct stat st;
 	int fd;
 
 	/*
@@ -97,7 +185,12 @@ cat(const char *file)
 	if (fd<0) {
 		err(1, "%s", file);
 	}
-	docat(file, fd);
+	if (havefb && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		fbcat(file, fd);
+	}
+	else {
+		docat(file, fd);
+	}
 	close(fd);
 }
 
@@ -112,9 +205,15 @@ main(int argc, char *argv[])
 	else {
 		/* Print all the files specified on the command line. */
 		int i;
+
+		/* If there's no ring to be had, do without. */
+		havefb = fbatch_init(&fb, 2*NBUFS) == 0;
 		for (i=1; i<argc; i++) {
 			cat(argv[i]);
 		}
+		if (havefb) {
+			fbatch_fini(&fb);
+		}
 	}
 	return 0;
 }
@@ -29,11 +29,13 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 #include <err.h>
+#include <dirent.h>
 
 /*
  * ls - list files.
@@ -45,6 +47,9 @@
  *    -s   (with -l) Show block counts.
  */
 
+/* Size of the buffer directory entries are read into, a batch at a time. */
+#define DIRBUFSIZE 2048
+
 /* Flags for which options we're using. */
 static int aopt=0;
 static int dopt=0;
@@ -193,9 +198,10 @@ void
 listdir(const char *path, int showheader)
 {
 	int fd;
-	char buf[1024];
+	uint64_t buf[DIRBUFSIZE / sizeof(uint64_t)];
 	char newpath[1024];
-	ssize_t len;
+	struct dirent *ent;
+	ssize_t len, pos;
 
 	if (showheader) {
 		printheader(path);
@@ -212,19 +218,22 @@ listdir(const char *path, int showheader)
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
+	while ((len = getdirentries(fd, buf, sizeof(buf), 0)) > 0) {
+		for (pos = 0; pos < len; pos += ent->d_reclen) {
+			ent = (struct dirent *)((char *)buf + pos);
 
-		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+			/* Assemble the full name of the new item */
+			snprintf(newpath, sizeof(newpath), "%s/%s", path,
+				 ent->d_name);
 
-		if (aopt || buf[0]!='.') {
-			/* Print it */
-			print(newpath);
+			if (aopt || ent->d_name[0]!='.') {
+				/* Print it */
+				print(newpath);
+			}
 		}
 	}
 	if (len<0) {
-		err(1, "%s: getdirentry", path);
+		err(1, "%s: getdirentries", path);
 	}
 
 	/* Done */
@@ -236,9 +245,10 @@ void
 recursedir(const char *path)
 {
 	int fd;
-	char buf[1024];
+	uint64_t buf[DIRBUFSIZE / sizeof(uint64_t)];
 	char newpath[1024];
-	int len;
+	struct dirent *ent;
+	ssize_t len, pos;
 
 	/*
 	 * Open it.
@@ -251,29 +261,39 @@ recursedir(const char *path)
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
-
-		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
-
-		if (!aopt && buf[0]=='.') {
-			/* skip this one */
-			continue;
-		}
+	/*
+	 * Ask for the type of each entry too, so we don't need to
+	 * stat every file to find the subdirectories.
+	 */
+	while ((len = getdirentries(fd, buf, sizeof(buf),
+				    GETDIRENT_STAT)) > 0) {
+		for (pos = 0; pos < len; pos += ent->d_reclen) {
+			ent = (struct dirent *)((char *)buf + pos);
+
+			/* Assemble the full name of the new item */
+			snprintf(newpath, sizeof(newpath), "%s/%s", path,
+				 ent->d_name);
+
+			if (!aopt && ent->d_name[0]=='.') {
+				/* skip this one */
+				continue;
+			}
 
-		if (!strcmp(buf, ".") || !strcmp(buf, "..")) {
-			/* always skip these */
-			continue;
-		}
+			if (!strcmp(ent->d_name, ".") ||
+			    !strcmp(ent->d_name, "..")) {
+				/* always skip these */
+				continue;
+			}
 
-		if (!isdir(newpath)) {
-			continue;
-		}
+			if (ent->d_type != 0 ?
+			    ent->d_type != (S_IFDIR >> 12) : !isdir(newpath)) {
+				continue;
+			}
 
-		listdir(newpath, 1 /*showheader*/);
-		if (Ropt) {
-			recursedir(newpath);
+			listdir(newpath, 1 /*showheader*/);
+			if (Ropt) {
+				recursedir(newpath);
+			}
 		}
 	}
 	if (len<0) {
@@ -0,0 +1,18 @@
+#ifndef _DIRENT_H_
+#define _DIRENT_H_
+
+/*
+ * Get ssize_t, and struct dirent and GETDIRENT_* from the kernel.
+ */
+#include <sys/types.h>
+#include <kern/dirent.h>
+
+/*
+ * Batched directory read. Fills buf with struct dirent records for as
+ * many entries as fit, starting at the current position, and returns
+ * the number of bytes used (0 at the end of the directory). buflen
+ * must be at least DIRENT_RECLEN(NAME_MAX).
+ */
+ssize_t getdirentries(int filehandle, void *buf, size_t buflen, int flags);
+
+#endif /* _DIRENT_H_ */
@@ -0,0 +1,74 @@
+#ifndef _FBATCH_H_
+#define _FBATCH_H_
+
+/*
+ * Batched file operations: libc wrapper over the __fbatch_setup and
+ * __fbatch_enter system calls. The ring format is in <kern/fbatch.h>.
+ *
+ * Typical use:
+ *
+ *	struct fbatch fb;
+ *	struct fbatch_sqe *sqe;
+ *	struct fbatch_cqe *cqe;
+ *
+ *	fbatch_init(&fb, 64);
+ *	while ((sqe = fbatch_get_sqe(&fb)) != NULL && more work) {
+ *		fbatch_prep_read(sqe, fd, buf, len);
+ *	}
+ *	fbatch_submit(&fb);
+ *	while ((cqe = fbatch_peek_cqe(&fb)) != NULL) {
+ *		... look at cqe->fc_result / cqe->fc_error ...
+ *		fbatch_cqe_seen(&fb);
+ *	}
+ *	fbatch_fini(&fb);
+ *
+ * Only one ring can be registered per process at a time.
+ */
+
+#include <sys/types.h>
+#include <kern/fbatch.h>
+
+struct fbatch {
+	struct fbatch_ring *fb_ring;
+	struct fbatch_sqe *fb_sqes;
+	struct fbatch_cqe *fb_cqes;
+	unsigned fb_entries;
+	unsigned fb_queued;	/* sqes filled in but not yet submitted */
+};
+
+/* System call backends. */
+int __fbatch_setup(struct fbatch_ring *ring, unsigned entries);
+int __fbatch_enter(unsigned to_submit);
+
+/* Allocate and register a ring; returns 0 or -1 with errno set. */
+int fbatch_init(struct fbatch *fb, unsigned entries);
+
+/* Unregister and free the ring. */
+void fbatch_fini(struct fbatch *fb);
+
+/* Get the next free submission entry, or NULL if the queue is full. */
+struct fbatch_sqe *fbatch_get_sqe(struct fbatch *fb);
+
+/* Hand all queued entries to the kernel; returns the number run, or -1. */
+int fbatch_submit(struct fbatch *fb);
+
+/* Look at the oldest unconsumed completion, or NULL if there is none. */
+struct fbatch_cqe *fbatch_peek_cqe(struct fbatch *fb);
+
+/* Release the completion returned by fbatch_peek_cqe. */
+void fbatch_cqe_seen(struct fbatch *fb);
+
+/* Fill in submission entries. */
+void fbatch_prep_open(struct fbatch_sqe *sqe, const char *path, int flags,
+		      mode_t mode);
+void fbatch_prep_close(struct fbatch_sqe *sqe, int fd);
+void fbatch_prep_read(struct fbatch_sqe *sqe, int fd, void *buf, size_t len);
+void fbatch_prep_write(struct fbatch_sqe *sqe, int fd, const void *buf,
+		       size_t len);
+void fbatch_prep_pread(struct fbatch_sqe *sqe, int fd, void *buf, size_t len,
+		       off_t pos);
+void fbatch_prep_pwrite(struct fbatch_sqe *sqe, int fd, const void *buf,
+			size_t len, off_t pos);
+void fbatch_prep_lseek(struct fbatch_sqe *sqe, int fd, off_t pos, int whence);
+
+#endif /* _FBATCH_H_ */
@@ -0,0 +1,21 @@
+#ifndef _SYS_UIO_H_
+#define _SYS_UIO_H_
+
+/*
+ * Get ssize_t/off_t, and struct iovec from the kernel.
+ */
+#include <sys/types.h>
+#include <kern/iovec.h>
+
+/*
+ * Scatter/gather I/O. Each call transfers all iovcnt buffers (at most
+ * IOV_MAX) in a single system call. readv and writev use and advance
+ * the current seek position; preadv and pwritev use pos instead and
+ * leave the seek position alone.
+ */
+ssize_t readv(int filehandle, const struct iovec *iov, int iovcnt);
+ssize_t writev(int filehandle, const struct iovec *iov, int iovcnt);
+ssize_t preadv(int filehandle, const struct iovec *iov, int iovcnt, off_t pos);
+ssize_t pwritev(int filehandle, const struct iovec *iov, int iovcnt, off_t pos);
+
+#endif /* _SYS_UIO_H_ */
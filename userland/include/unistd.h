@@ -146,6 +146,10 @@ int symlink(const char *target, const char *linkname);
 ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
+ssize_t pread(int filehandle, void *buf, size_t size, off_t pos);
+ssize_t pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+ssize_t copy_file_range(int infile, off_t *inpos, int outfile, off_t *outpos,
+			size_t size);
 int __time(time_t *seconds, unsigned long *nanoseconds);
 ssize_t __getcwd(char *buf, size_t buflen);
 /* stat - see sys/stat.h */
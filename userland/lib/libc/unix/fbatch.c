@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fbatch.h>
+
+/*
+ * Userlevel side of the batched file operation ring. The kernel only
+ * touches the ring inside __fbatch_enter(), so no locking or memory
+ * barriers are needed here as long as a ring is used by one thread.
+ */
+
+int
+fbatch_init(struct fbatch *fb, unsigned entries)
+{
+	char *mem;
+
+	if (entries == 0 || entries > FBATCH_MAX_ENTRIES) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	mem = malloc(FBATCH_RING_SIZE(entries));
+	if (mem == NULL) {
+		return -1;
+	}
+	memset(mem, 0, FBATCH_RING_SIZE(entries));
+
+	if (__fbatch_setup((struct fbatch_ring *)mem, entries) < 0) {
+		free(mem);
+		return -1;
+	}
+
+	fb->fb_ring = (struct fbatch_ring *)mem;
+	fb->fb_sqes = (struct fbatch_sqe *)(mem + FBATCH_SQES_OFFSET);
+	fb->fb_cqes = (struct fbatch_cqe *)(mem + FBATCH_CQES_OFFSET(entries));
+	fb->fb_entries = entries;
+	fb->fb_queued = 0;
+	return 0;
+}
+
+void
+fbatch_fini(struct fbatch *fb)
+{
+	__fbatch_setup(NULL, 0);
+	free(fb->fb_ring);
+	fb->fb_ring = NULL;
+	fb->fb_sqes = NULL;
+	fb->fb_cqes = NULL;
+	fb->fb_entries = 0;
+	fb->fb_queued = 0;
+}
+
+struct fbatch_sqe *
+fbatch_get_sqe(struct fbatch *fb)
+{
+	struct fbatch_ring *r = fb->fb_ring;
+	struct fbatch_sqe *sqe;
+
+	if (r->fr_sq_tail - r->fr_sq_head >= fb->fb_entries) {
+		return NULL;
+	}
+	sqe = &fb->fb_sqes[r->fr_sq_tail % fb->fb_entries];
+	memset(sqe, 0, sizeof(*sqe));
+	r->fr_sq_tail++;
+	fb->fb_queued++;
+	return sqe;
+}
+
+int
+fbatch_submit(struct fbatch *fb)
+{
+	int r;
+
+	r = __fbatch_enter(fb->fb_queued);
+	if (r < 0) {
+		return -1;
+	}
+	fb->fb_queued -= r;
+	return r;
+}
+
+struct fbatch_cqe *
+fbatch_peek_cqe(struct fbatch *fb)
+{
+	struct fbatch_ring *r = fb->fb_ring;
+
+	if (r->fr_cq_head == r->fr_cq_tail) {
+		return NULL;
+	}
+	return &fb->fb_cqes[r->fr_cq_head % fb->fb_entries];
+}
+
+void
+fbatch_cqe_seen(struct fbatch *fb)
+{
+	fb->fb_ring->fr_cq_head++;
+}
+
+void
+fbatch_prep_open(struct fbatch_sqe *sqe, const char *path, int flags,
+		 mode_t mode)
+{
+	sqe->fs_op = FBATCH_OP_OPEN;
+	sqe->fs_buf = (void *)path;
+	sqe->fs_flags = flags;
+	sqe->fs_mode = mode;
+}
+
+void
+fbatch_prep_close(struct fbatch_sqe *sqe, int fd)
+{
+	sqe->fs_op = FBATCH_OP_CLOSE;
+	sqe->fs_fd = fd;
+}
+
+void
+fbatch_prep_read(struct fbatch_sqe *sqe, int fd, void *buf, size_t len)
+{
+	sqe->fs_op = FBATCH_OP_READ;
+	sqe->fs_fd = fd;
+	sqe->fs_buf = buf;
+	sqe->fs_len = len;
+}
+
+void
+fbatch_prep_write(struct fbatch_sqe *sqe, int fd, const void *buf,
+		  size_t len)
+{
+	sqe->fs_op = FBATCH_OP_WRITE;
+	sqe->fs_fd = fd;
+	sqe->fs_buf = (void *)buf;
+	sqe->fs_len = len;
+}
+
+void
+fbatch_prep_pread(struct fbatch_sqe *sqe, int fd, void *buf, size_t len,
+		  off_t pos)
+{
+	fbatch_prep_read(sqe, fd, buf, len);
+	sqe->fs_op = FBATCH_OP_PREAD;
+	sqe->fs_pos = pos;
+}
+
+void
+fbatch_prep_pwrite(struct fbatch_sqe *sqe, int fd, const void *buf,
+		   size_t len, off_t pos)
+{
+	fbatch_prep_write(sqe, fd, buf, len);
+	sqe->fs_op = FBATCH_OP_PWRITE;
+	sqe->fs_pos = pos;
+}
+
+void
+fbatch_prep_lseek(struct fbatch_sqe *sqe, int fd, off_t pos, int whence)
+{
+	sqe->fs_op = FBATCH_OP_LSEEK;
+	sqe->fs_fd = fd;
+	sqe->fs_pos = pos;
+	sqe->fs_flags = whence;
+}
@@ -476,6 +476,20 @@ dumpinode(uint32_t ino, const char *name)
 	}
 	printf("    Indirect block: %u (0x%x)\n",
 	       SWAP32(sfi.sfi_indirect), SWAP32(sfi.sfi_indirect));
+	for (i=0; i<SFS_DIRINDEX_NBLOCKS; i++) {
+		if (sfi.sfi_dirindex[i] != 0) {
+			printf("    Directory index block %u: %u (0x%x)\n", i,
+			       SWAP32(sfi.sfi_dirindex[i]),
+			       SWAP32(sfi.sfi_dirindex[i]));
+		}
+	}
+	if (sfi.sfi_dirfreemap != 0) {
+		printf("    Directory free slot map: %u (0x%x)\n",
+		       SWAP32(sfi.sfi_dirfreemap),
+		       SWAP32(sfi.sfi_dirfreemap));
+		printf("    Deleted index entries: %u\n",
+		       SWAP32(sfi.sfi_dirdeleted));
+	}
 	for (i=0; i<ARRAYCOUNT(sfi.sfi_waste); i++) {
 		if (sfi.sfi_waste[i] != 0) {
 			printf("    Word %u in waste area: 0x%x\n",
@@ -0,0 +1,129 @@
+/*
+ * ktrace - print the kernel's system call trace.
+ * Usage: ktrace
+ *
+ * Reads and prints every record pending in trace:, then exits.
+ * Records are consumed as they are read, so running ktrace again
+ * shows only calls made since.
+ *
+ * To trace a program, use "trace on" at the kernel menu before
+ * starting it, or have the program write "on" to trace: itself.
+ * ktrace switches tracing off for itself so it does not log its own
+ * reads.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <kern/syscall.h>
+#include <kern/trace.h>
+
+#define NRECS 64
+
+static struct trace_record recs[NRECS];
+
+static const struct {
+	int num;
+	const char *name;
+} callnames[] = {
+	{ SYS_reboot,		"reboot" },
+	{ SYS___time,		"__time" },
+	{ SYS_open,		"open" },
+	{ SYS_pipe,		"pipe" },
+	{ SYS_dup2,		"dup2" },
+	{ SYS_close,		"close" },
+	{ SYS_read,		"read" },
+	{ SYS_write,		"write" },
+	{ SYS_pread,		"pread" },
+	{ SYS_pwrite,		"pwrite" },
+	{ SYS_readv,		"readv" },
+	{ SYS_writev,		"writev" },
+	{ SYS_preadv,		"preadv" },
+	{ SYS_pwritev,		"pwritev" },
+	{ SYS_lseek,		"lseek" },
+	{ SYS_copy_file_range,	"copy_file_range" },
+	{ SYS_getdirentries,	"getdirentries" },
+	{ SYS___fbatch_setup,	"__fbatch_setup" },
+	{ SYS___fbatch_enter,	"__fbatch_enter" },
+};
+
+static
+const char *
+callname(int num)
+{
+	static char buf[16];
+	unsigned i;
+
+	for (i=0; i<sizeof(callnames)/sizeof(callnames[0]); i++) {
+		if (callnames[i].num == num) {
+			return callnames[i].name;
+		}
+	}
+	snprintf(buf, sizeof(buf), "syscall%d", num);
+	return buf;
+}
+
+static
+void
+printrec(const struct trace_record *tr)
+{
+	unsigned i;
+
+	printf("cpu%u #%-6u %s(", (unsigned)tr->tr_cpu, tr->tr_seq,
+	       callname(tr->tr_callno));
+	for (i=0; i<tr->tr_nargs && i<TRACE_MAXARGS; i++) {
+		if (i > 0) {
+			printf(", ");
+		}
+		/* 64-bit arguments are offsets and lengths; show them in decimal */
+		if (tr->tr_wide & (1 << i)) {
+			printf("%lld", (long long)tr->tr_args[i]);
+		}
+		else {
+			printf("0x%x", (unsigned)tr->tr_args[i]);
+		}
+	}
+	printf(")");
+	if (tr->tr_err) {
+		printf(" = -1 %s", strerror(tr->tr_err));
+	}
+	else {
+		printf(" = %lld", (long long)tr->tr_retval);
+	}
+	printf(" [%u cycles]\n", tr->tr_exit - tr->tr_enter);
+}
+
+int
+main(int argc, char *argv[])
+{
+	ssize_t len;
+	unsigned i, n;
+	int fd;
+
+	if (argc != 1) {
+		errx(1, "Usage: %s", argv[0]);
+	}
+
+	fd = open("trace:", O_RDWR);
+	if (fd < 0) {
+		err(1, "trace:");
+	}
+	if (write(fd, "off", 3) < 0) {
+		err(1, "trace: write");
+	}
+
+	while ((len = read(fd, recs, sizeof(recs))) > 0) {
+		n = len / sizeof(recs[0]);
+		for (i=0; i<n; i++) {
+			printrec(&recs[i]);
+		}
+	}
+	if (len < 0) {
+		err(1, "trace: read");
+	}
+	close(fd);
+	return 0;
+}
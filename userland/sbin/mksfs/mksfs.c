@@ -73,6 +73,13 @@ check(void)
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	assert(SFS_DIRINDEX_PERBLOCK * sizeof(uint32_t) == SFS_BLOCKSIZE);
+	/* every slot of the largest directory must fit in its index */
+	assert((SFS_NDIRECT + SFS_NINDIRECT * SFS_DBPERIDB) * SFS_BLOCKSIZE /
+	       sizeof(struct sfs_direntry) < SFS_DIRINDEX_NENTRIES);
+	/* and in its free slot map */
+	assert((SFS_NDIRECT + SFS_NINDIRECT * SFS_DBPERIDB) * SFS_BLOCKSIZE /
+	       sizeof(struct sfs_direntry) <= SFS_BITSPERBLOCK);
 }
 
 /*
@@ -173,7 +180,7 @@ writerootdir(void)
 {
 	struct sfs_dinode sfi;
 
-	/* Initialize the dinode */
+	/* Initialize the dinode (with no directory index) */
 	bzero((void *)&sfi, sizeof(sfi));
 	sfi.sfi_size = SWAP32(0);
 	sfi.sfi_type = SWAP16(SFS_TYPE_DIR);
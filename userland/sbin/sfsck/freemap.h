@@ -44,6 +44,7 @@ typedef enum {
 	B_INODE,	/* Block that is an inode */
 	B_IBLOCK,	/* Indirect (or doubly-indirect etc.) block */
 	B_DIRDATA,	/* Data block of a directory */
+	B_DIRINDEX,	/* Index block of a directory */
 	B_DATA,		/* Data block */
 	B_PASTEND,	/* Block off the end of the fs */
 } blockusage_t;
@@ -281,6 +281,17 @@ pass1_inode(uint32_t ino, struct sfs_dinode *sfi, int alreadychanged)
 		changed = 1;
 	}
 
+	if (!isdir && (checkzeroed(sfi->sfi_dirindex,
+				   sizeof(sfi->sfi_dirindex)) ||
+		       sfi->sfi_dirfreemap != 0 || sfi->sfi_dirdeleted != 0)) {
+		warnx("Inode %lu: directory index on a regular file "
+		      "(cleared)", (unsigned long) ino);
+		sfi->sfi_dirfreemap = 0;
+		sfi->sfi_dirdeleted = 0;
+		setbadness(EXIT_RECOV);
+		changed = 1;
+	}
+
 	if (changed) {
 		sfs_writeinode(ino, sfi);
 	}
@@ -350,6 +361,220 @@ pass1_direntry(const char *path, uint32_t index, struct sfs_direntry *sfd)
 	return dchanged;
 }
 
+/*
+ * Hash function for the directory index; see <kern/sfs.h>.
+ */
+static
+uint32_t
+dirindex_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	while (*name) {
+		h = (h ^ (unsigned char)*name++) * 16777619U;
+	}
+	return h;
+}
+
+/*
+ * Look for the index entry for slot SLOT of directory DIRENTRIES by
+ * probing as the kernel does. Returns NULL if it is found, and otherwise
+ * a description of what's wrong.
+ */
+static
+const char *
+dirindex_probe(const uint32_t *index, struct sfs_direntry *direntries,
+	       uint32_t slot)
+{
+	const char *name = direntries[slot].sfd_name;
+	uint32_t hash, ent, pos, n, other;
+
+	hash = dirindex_hash(name);
+	pos = hash % SFS_DIRINDEX_NENTRIES;
+	for (n=0; n<SFS_DIRINDEX_NENTRIES; n++) {
+		ent = index[pos];
+		if (ent == SFS_DIRINDEX_EMPTY) {
+			break;
+		}
+		if (ent != SFS_DIRINDEX_DELETED &&
+		    SFS_DIRINDEX_TAG(ent) == SFS_DIRINDEX_TAG(hash)) {
+			other = SFS_DIRINDEX_SLOT(ent);
+			if (other == slot) {
+				return NULL;
+			}
+			if (!strcmp(direntries[other].sfd_name, name)) {
+				/* pass 2 will rename one of them */
+				return "has duplicate names";
+			}
+		}
+		pos = (pos + 1) % SFS_DIRINDEX_NENTRIES;
+	}
+	return "is missing entries";
+}
+
+/*
+ * Check the index and free slot map of directory INO, whose inode is
+ * SFI and whose entries (already checked) are DIRENTRIES. The index is
+ * only an accelerator, so if anything about it is wrong it is thrown
+ * away rather than fixed; the kernel makes a new one the next time a
+ * name is added. This includes the cases where pass 2 would add or
+ * rename entries, since it doesn't update the index. A wrong count of
+ * deleted entries is just corrected.
+ *
+ * Returns nonzero if SFI has been modified and needs to be written
+ * back.
+ */
+static
+int
+pass1_dirindex(uint32_t ino, const char *pathsofar, struct sfs_dinode *sfi,
+	       struct sfs_direntry *direntries, uint32_t ndirentries,
+	       int dchanged)
+{
+	uint32_t *index;
+	uint8_t *seen, *freemap;
+	uint32_t volblocks, block, ent, slot, i, ndeleted = 0;
+	const char *problem = NULL;
+	int present = 0, dotseen = 0, dotdotseen = 0, isfree, markedfree;
+	int changed = 0;
+
+	volblocks = sb_totalblocks();
+	for (i=0; i<SFS_DIRINDEX_NBLOCKS; i++) {
+		if (sfi->sfi_dirindex[i] != 0) {
+			present = 1;
+		}
+		if (sfi->sfi_dirindex[i] >= volblocks) {
+			problem = "block pointer outside of volume";
+		}
+	}
+	if (sfi->sfi_dirfreemap != 0 || sfi->sfi_dirdeleted != 0) {
+		present = 1;
+	}
+	if (!present) {
+		return 0;
+	}
+	if (sfi->sfi_dirfreemap == 0) {
+		problem = "has no free slot map";
+	}
+	else if (sfi->sfi_dirfreemap >= volblocks) {
+		problem = "free slot map outside of volume";
+	}
+	else if (ndirentries > SFS_BITSPERBLOCK) {
+		problem = "is on a directory too big for its free slot map";
+	}
+	if (dchanged) {
+		problem = "refers to entries changed above";
+	}
+	if (problem != NULL) {
+		goto drop;
+	}
+
+	index = domalloc(SFS_DIRINDEX_NENTRIES * sizeof(uint32_t));
+	seen = domalloc(ndirentries + 1);
+	bzero(seen, ndirentries + 1);
+
+	for (i=0; i<SFS_DIRINDEX_NBLOCKS; i++) {
+		block = sfi->sfi_dirindex[i];
+		if (block == 0) {
+			bzero(&index[i*SFS_DIRINDEX_PERBLOCK], SFS_BLOCKSIZE);
+		}
+		else {
+			sfs_readindirect(block, &index[i*SFS_DIRINDEX_PERBLOCK]);
+		}
+	}
+
+	/* Each entry must name a different live slot, with the right hash. */
+	for (i=0; i<SFS_DIRINDEX_NENTRIES && problem == NULL; i++) {
+		ent = index[i];
+		if (ent == SFS_DIRINDEX_DELETED) {
+			ndeleted++;
+		}
+		if (ent == SFS_DIRINDEX_EMPTY || ent == SFS_DIRINDEX_DELETED) {
+			continue;
+		}
+		slot = SFS_DIRINDEX_SLOT(ent);
+		if (slot >= ndirentries ||
+		    direntries[slot].sfd_ino == SFS_NOINO) {
+			problem = "has entries for unused slots";
+		}
+		else if (SFS_DIRINDEX_TAG(ent) !=
+			 SFS_DIRINDEX_TAG(dirindex_hash(
+					direntries[slot].sfd_name))) {
+			problem = "has entries with the wrong hash";
+		}
+		else if (seen[slot]) {
+			problem = "has duplicate entries";
+		}
+		else {
+			seen[slot] = 1;
+		}
+	}
+
+	/* Each live slot must be found where the kernel will look. */
+	for (i=0; i<ndirentries && problem == NULL; i++) {
+		if (direntries[i].sfd_ino == SFS_NOINO) {
+			continue;
+		}
+		if (!strcmp(direntries[i].sfd_name, ".")) {
+			dotseen = 1;
+		}
+		else if (!strcmp(direntries[i].sfd_name, "..")) {
+			dotdotseen = 1;
+		}
+		problem = dirindex_probe(index, direntries, i);
+	}
+	if (problem == NULL && (!dotseen || !dotdotseen)) {
+		problem = "is missing entries";
+	}
+
+	/* Exactly the empty slots must be marked free. */
+	freemap = domalloc(SFS_BLOCKSIZE);
+	if (problem == NULL) {
+		sfs_readdirfreemap(sfi->sfi_dirfreemap, freemap);
+	}
+	for (i=0; i<SFS_BITSPERBLOCK && problem == NULL; i++) {
+		isfree = i < ndirentries &&
+			direntries[i].sfd_ino == SFS_NOINO;
+		markedfree = (freemap[i / CHAR_BIT] &
+			      (1 << (i % CHAR_BIT))) != 0;
+		if (isfree != markedfree) {
+			problem = "has a wrong free slot map";
+		}
+	}
+
+	free(freemap);
+	free(seen);
+	free(index);
+
+	if (problem == NULL) {
+		for (i=0; i<SFS_DIRINDEX_NBLOCKS; i++) {
+			if (sfi->sfi_dirindex[i] != 0) {
+				freemap_blockinuse(sfi->sfi_dirindex[i],
+						   B_DIRINDEX, ino);
+			}
+		}
+		freemap_blockinuse(sfi->sfi_dirfreemap, B_DIRINDEX, ino);
+		if (sfi->sfi_dirdeleted != ndeleted) {
+			setbadness(EXIT_RECOV);
+			warnx("Directory %s: index deleted count %lu should "
+			      "be %lu (fixed)", pathsofar,
+			      (unsigned long) sfi->sfi_dirdeleted,
+			      (unsigned long) ndeleted);
+			sfi->sfi_dirdeleted = ndeleted;
+			changed = 1;
+		}
+		return changed;
+	}
+
+ drop:
+	/* freemap_check frees the blocks, since they aren't marked in use */
+	setbadness(EXIT_RECOV);
+	warnx("Directory %s: index %s (removed)", pathsofar, problem);
+	bzero(sfi->sfi_dirindex, sizeof(sfi->sfi_dirindex));
+	sfi->sfi_dirfreemap = 0;
+	sfi->sfi_dirdeleted = 0;
+	return 1;
+}
+
 /*
  * Check a directory. INO is the inode number; PATHSOFAR is the path
  * to this directory. This traverses the volume directory tree
@@ -435,6 +660,11 @@ pass1_dir(uint32_t ino, const char *pathsofar)
 		}
 	}
 
+	if (pass1_dirindex(ino, pathsofar, &sfi, direntries, ndirentries,
+			   dchanged)) {
+		sfs_writeinode(ino, &sfi);
+	}
+
 	if (dchanged) {
 		sfs_writedir(&sfi, direntries, ndirentries);
 	}
@@ -97,6 +97,12 @@ swapinode(struct sfs_dinode *sfi)
 	for (i=0; i<NUM_III; i++) {
 		SET_III(sfi, i) = SWAP32(GET_III(sfi, i));
 	}
+
+	for (i=0; i<SFS_DIRINDEX_NBLOCKS; i++) {
+		sfi->sfi_dirindex[i] = SWAP32(sfi->sfi_dirindex[i]);
+	}
+	sfi->sfi_dirfreemap = SWAP32(sfi->sfi_dirfreemap);
+	sfi->sfi_dirdeleted = SWAP32(sfi->sfi_dirdeleted);
 }
 
 static
@@ -264,6 +270,17 @@ sfs_writeindirect(uint32_t blocknum, uint32_t *entries)
 	swapindir(entries);
 }
 
+/*
+ * directory free slot map - a plain bitmap, like the freemap.
+ */
+
+void
+sfs_readdirfreemap(uint32_t blocknum, uint8_t *bits)
+{
+	diskread(bits, blocknum);
+	swapbits(bits);
+}
+
 ////////////////////////////////////////////////////////////
 // directory I/O
 
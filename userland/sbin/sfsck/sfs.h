@@ -65,6 +65,9 @@ void sfs_writeinode(uint32_t inum, struct sfs_dinode *sfi);
 void sfs_readindirect(uint32_t blocknum, uint32_t *entries);
 void sfs_writeindirect(uint32_t blocknum, uint32_t *entries);
 
+/* directory free slot map */
+void sfs_readdirfreemap(uint32_t blocknum, uint8_t *bits);
+
 /* directory - ND should be the number of directory entries D points to */
 void sfs_readdir(struct sfs_dinode *sfi, struct sfs_direntry *d, unsigned nd);
 void sfs_writedir(const struct sfs_dinode *sfi,
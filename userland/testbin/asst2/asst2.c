@@ -1,11 +1,14 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <err.h>
 #include <errno.h>
+#include <dirent.h>
+#include <fbatch.h>
 
 #define MAX_BUF 500
 char teststr[] = "The quick brown fox jumped over the lazy dog.";
@@ -13,11 +16,209 @@ char teststr2[] = "The five boxing wizards jump quickly";
 char buf[MAX_BUF];
 int failed_tests = 0;
 
+/* top of user space on MIPS; the stack ends just below it */
+#define USERTOP 0x80000000
+
+/*
+ * checks the next completion in fb has the given cookie, error and result.
+ */
+static void
+fbatch_expect(struct fbatch *fb, unsigned cookie, int error, off_t result)
+{
+        struct fbatch_cqe *cqe;
+
+        cqe = fbatch_peek_cqe(fb);
+        if (cqe == NULL) {
+                printf("ERROR fbatch completion %u missing\n", cookie);
+                failed_tests++;
+                return;
+        }
+        if (cqe->fc_cookie != cookie || cqe->fc_error != error ||
+            (result >= 0 && cqe->fc_result != result)) {
+                printf("ERROR fbatch completion %u: got cookie %u error %d result %lld, "
+                       "expected error %d result %lld\n", cookie, cqe->fc_cookie,
+                       cqe->fc_error, (long long) cqe->fc_result, error, (long long) result);
+                failed_tests++;
+        }
+        fbatch_cqe_seen(fb);
+}
+
+/*
+ * runs mixed batches through the fbatch ring and checks every completion, then checks
+ * that bad ring counters are refused and that an op whose completion can't be
+ * written is not run.
+ */
+static void
+fbatch_test(void)
+{
+        struct fbatch fb;
+        struct fbatch_sqe *sqe;
+        struct fbatch_cqe *cqe;
+        struct fbatch_ring *ring;
+        char rbuf[MAX_BUF];
+        int fd, fd2, len, r;
+
+        len = strlen(teststr);
+
+        if (fbatch_init(&fb, 8) < 0) {
+                printf("ERROR fbatch_init: %s\n", strerror(errno));
+                failed_tests++;
+                return;
+        }
+
+        /* the ops in a batch can't use an fd opened in the same batch, so open first */
+        sqe = fbatch_get_sqe(&fb);
+        fbatch_prep_open(sqe, "fbatch.file", O_RDWR | O_CREAT | O_TRUNC, 0664);
+        sqe->fs_cookie = 100;
+        sqe = fbatch_get_sqe(&fb);
+        sqe->fs_cookie = 101;
+        r = fbatch_submit(&fb);
+        if (r != 2) {
+                printf("ERROR fbatch_submit ran %d of 2: %s\n", r, strerror(errno));
+                failed_tests++;
+                fbatch_fini(&fb);
+                return;
+        }
+        cqe = fbatch_peek_cqe(&fb);
+        fd = cqe->fc_error ? -1 : (int) cqe->fc_result;
+        fbatch_expect(&fb, 100, 0, -1);
+        fbatch_expect(&fb, 101, 0, 0);
+        if (fd < 0) {
+                printf("ERROR fbatch open failed\n");
+                failed_tests++;
+                fbatch_fini(&fb);
+                return;
+        }
+        printf("* fbatch open got fd %d\n", fd);
+
+        /* a full ring of mixed operations, including two that must fail */
+        sqe = fbatch_get_sqe(&fb);
+        fbatch_prep_write(sqe, fd, teststr, len);
+        sqe->fs_cookie = 200;
+        sqe = fbatch_get_sqe(&fb);
+        fbatch_prep_lseek(sqe, fd, 0, SEEK_END);
+        sqe->fs_cookie = 201;
+        sqe = fbatch_get_sqe(&fb);
+        fbatch_prep_pread(sqe, fd, rbuf, MAX_BUF, 0);
+        sqe->fs_cookie = 202;
+        sqe = fbatch_get_sqe(&fb);
+        fbatch_prep_lseek(sqe, fd, (off_t) 1 << 32, SEEK_SET);
+        sqe->fs_cookie = 203;
+        sqe = fbatch_get_sqe(&fb);
+        fbatch_prep_read(sqe, 99, rbuf, MAX_BUF);
+        sqe->fs_cookie = 204;
+        sqe = fbatch_get_sqe(&fb);
+        sqe->fs_reserved = 1;
+        sqe->fs_cookie = 205;
+        sqe = fbatch_get_sqe(&fb);
+        fbatch_prep_close(sqe, fd);
+        sqe->fs_cookie = 206;
+        sqe = fbatch_get_sqe(&fb);
+        fbatch_prep_open(sqe, "fbatch.file", O_RDONLY, 0);
+        sqe->fs_cookie = 207;
+        if (fbatch_get_sqe(&fb) != NULL) {
+                printf("ERROR fbatch_get_sqe on a full ring did not return NULL\n");
+                failed_tests++;
+        }
+        r = fbatch_submit(&fb);
+        printf("* fbatch_submit ran %d operations\n", r);
+        if (r != 8) {
+                printf("ERROR fbatch_submit: %s\n", strerror(errno));
+                failed_tests++;
+        }
+        fbatch_expect(&fb, 200, 0, len);
+        fbatch_expect(&fb, 201, 0, len);
+        fbatch_expect(&fb, 202, 0, len);
+        fbatch_expect(&fb, 203, 0, (off_t) 1 << 32);
+        fbatch_expect(&fb, 204, EBADF, -1);
+        fbatch_expect(&fb, 205, EINVAL, -1);
+        fbatch_expect(&fb, 206, 0, 0);
+        cqe = fbatch_peek_cqe(&fb);
+        fd2 = (cqe == NULL || cqe->fc_error) ? -1 : (int) cqe->fc_result;
+        fbatch_expect(&fb, 207, 0, -1);
+        if (memcmp(rbuf, teststr, len) != 0) {
+                printf("ERROR fbatch pread contents mismatch\n");
+                failed_tests++;
+        }
+
+        /* read it back at the file pointer and close it */
+        if (fd2 >= 0) {
+                memset(rbuf, 0, sizeof(rbuf));
+                sqe = fbatch_get_sqe(&fb);
+                fbatch_prep_read(sqe, fd2, rbuf, MAX_BUF);
+                sqe->fs_cookie = 300;
+                sqe = fbatch_get_sqe(&fb);
+                fbatch_prep_close(sqe, fd2);
+                sqe->fs_cookie = 301;
+                r = fbatch_submit(&fb);
+                if (r != 2) {
+                        printf("ERROR fbatch_submit ran %d of 2: %s\n", r, strerror(errno));
+                        failed_tests++;
+                }
+                fbatch_expect(&fb, 300, 0, len);
+                fbatch_expect(&fb, 301, 0, 0);
+                if (memcmp(rbuf, teststr, len) != 0) {
+                        printf("ERROR fbatch read contents mismatch\n");
+                        failed_tests++;
+                }
+        }
+
+        /* a submission tail more than a ring ahead of the head can't be valid */
+        ring = fb.fb_ring;
+        ring->fr_sq_tail = ring->fr_sq_head + fb.fb_entries + 1;
+        r = __fbatch_enter(1);
+        if (r != -1 || errno != EINVAL) {
+                printf("ERROR fbatch_enter with a corrupt sq tail did not fail with EINVAL\n");
+                failed_tests++;
+        }
+        ring->fr_sq_tail = ring->fr_sq_head;
+        fbatch_fini(&fb);
+
+        /*
+         * register a one-entry ring at the very top of the stack, so its completion
+         * slot lies past the end of user space. the write must not be run, since it
+         * could never be reported; the stack top only holds our unused argv strings.
+         */
+        fd = open("fbatch.file", O_RDWR | O_TRUNC);
+        if (fd < 0) {
+                printf("ERROR reopening fbatch.file: %s\n", strerror(errno));
+                failed_tests++;
+                return;
+        }
+        ring = (struct fbatch_ring *) (USERTOP - FBATCH_CQES_OFFSET(1));
+        if (__fbatch_setup(ring, 1) < 0) {
+                printf("ERROR fbatch_setup at the stack top: %s\n", strerror(errno));
+                failed_tests++;
+        } else {
+                sqe = (struct fbatch_sqe *) ((char *) ring + FBATCH_SQES_OFFSET);
+                memset(sqe, 0, sizeof(*sqe));
+                fbatch_prep_write(sqe, fd, teststr, len);
+                ring->fr_sq_tail = 1;
+                r = __fbatch_enter(1);
+                if (r != -1 || errno != EFAULT) {
+                        printf("ERROR fbatch_enter with no room for the completion returned %d\n", r);
+                        failed_tests++;
+                }
+                if (ring->fr_sq_head != 0 || lseek(fd, 0, SEEK_END) != 0) {
+                        printf("ERROR fbatch ran an op it could not complete\n");
+                        failed_tests++;
+                }
+                __fbatch_setup(NULL, 0);
+        }
+        close(fd);
+        remove("fbatch.file");
+        printf("* fbatch test done\n");
+}
+
 int
 main(int argc, char * argv[])
 {
         int iter;
         int fd, newfd, r, i, j , k;
+        int pipefds[2];
+        uint64_t dirbuf[1024 / sizeof(uint64_t)];
+        struct dirent *ent;
+        int found;
         (void) argc;
         (void) argv;
 
@@ -484,6 +685,89 @@ main(int argc, char * argv[])
                 }
         }
 
+        /* pipe test */
+        printf("**********\n* testing pipe\n");
+        r = pipe(pipefds);
+        if (r < 0) {
+                printf("ERROR pipe: %s\n", strerror(errno));
+                failed_tests++;
+        } else {
+                printf("* pipe() got read fd %d and write fd %d\n", pipefds[0], pipefds[1]);
+                r = write(pipefds[1], teststr, strlen(teststr));
+                printf("* wrote %d bytes into pipe\n", r);
+                if (r != (int) strlen(teststr)) {
+                        printf("ERROR writing pipe: %s\n", strerror(errno));
+                        failed_tests++;
+                }
+                r = read(pipefds[0], buf, MAX_BUF);
+                printf("* read %d bytes from pipe\n", r);
+                if (r != (int) strlen(teststr) || memcmp(buf, teststr, r) != 0) {
+                        printf("ERROR pipe contents mismatch\n");
+                        failed_tests++;
+                }
+                r = lseek(pipefds[0], 0, SEEK_SET);
+                if (r != -1) {
+                        printf("ERROR lseek on pipe did not produce error\n");
+                        failed_tests++;
+                }
+                r = write(pipefds[0], teststr, strlen(teststr));
+                if (r != -1) {
+                        printf("ERROR write to read end of pipe did not produce error\n");
+                        failed_tests++;
+                }
+                printf("* closing write end, read should return EOF\n");
+                close(pipefds[1]);
+                r = read(pipefds[0], buf, MAX_BUF);
+                if (r != 0) {
+                        printf("ERROR read after writer closed returned %d\n", r);
+                        failed_tests++;
+                }
+                close(pipefds[0]);
+                printf("* pipe test okay\n");
+        }
+
+        /* batched directory read test */
+        printf("**********\n* testing getdirentries\n");
+        fd = open(".", O_RDONLY);
+        if (fd < 0) {
+                printf("ERROR opening .: %s\n", strerror(errno));
+                failed_tests++;
+        } else {
+                r = getdirentries(fd, dirbuf, 16, 0);
+                if (r != -1) {
+                        printf("ERROR too small buffer did not produce error\n");
+                        failed_tests++;
+                }
+                found = 0;
+                while ((r = getdirentries(fd, dirbuf, sizeof(dirbuf), GETDIRENT_STAT)) > 0) {
+                        printf("* getdirentries returned %d bytes\n", r);
+                        for (i = 0; i < r; i += ent->d_reclen) {
+                                ent = (struct dirent *)((char *)dirbuf + i);
+                                if (strcmp(ent->d_name, "test.file") == 0) {
+                                        found = 1;
+                                        if (ent->d_type != (S_IFREG >> 12)) {
+                                                printf("ERROR test.file has type %u\n", ent->d_type);
+                                                failed_tests++;
+                                        }
+                                }
+                        }
+                }
+                if (r < 0) {
+                        printf("ERROR getdirentries: %s\n", strerror(errno));
+                        failed_tests++;
+                } else if (!found) {
+                        printf("ERROR test.file not listed\n");
+                        failed_tests++;
+                } else {
+                        printf("* getdirentries test okay\n");
+                }
+                close(fd);
+        }
+
+        /* batched file operation test */
+        printf("**********\n* testing fbatch\n");
+        fbatch_test();
+
         if (failed_tests) {
                 printf("* FAILED TESTS %d\n", failed_tests);
         } else {
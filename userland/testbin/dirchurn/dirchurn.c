@@ -0,0 +1,177 @@
+/*
+ * dirchurn - unlink and re-create files in a big directory, across
+ * a remount.
+ *
+ * Usage: dirchurn create
+ *        (unmount and remount the volume)
+ *        dirchurn check
+ *
+ * Run it in the top directory of an SFS volume. "create" makes
+ * NFILES files, enough for SFS to index the directory, and then
+ * repeatedly unlinks half of them and makes them again, checking that
+ * every file is still found with the right contents and that the
+ * directory never grows: every new name must go in a slot an unlinked
+ * one left free. There are enough rounds that the index fills up with
+ * deleted entries and is rebuilt more than once. "check" does the
+ * same again after a remount, starting from what "create" left, and
+ * then removes all the files. Afterwards the volume should pass sfsck
+ * with no complaints.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define NFILES   100	/* more than SFS_DIRINDEX_MIN */
+#define NROUNDS  24	/* rounds of unlinking and re-creating */
+
+static
+void
+mkname(char *buf, size_t len, unsigned i)
+{
+	snprintf(buf, len, "churn.%03u", i);
+}
+
+static
+void
+makefile(unsigned i)
+{
+	char name[32];
+	int fd;
+
+	mkname(name, sizeof(name), i);
+	fd = open(name, O_WRONLY|O_CREAT|O_EXCL, 0664);
+	if (fd < 0) {
+		err(1, "%s: create", name);
+	}
+	if (write(fd, &i, sizeof(i)) != sizeof(i)) {
+		err(1, "%s: write", name);
+	}
+	close(fd);
+}
+
+static
+void
+checkfile(unsigned i)
+{
+	char name[32];
+	unsigned val;
+	int fd;
+
+	mkname(name, sizeof(name), i);
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open", name);
+	}
+	if (read(fd, &val, sizeof(val)) != sizeof(val)) {
+		err(1, "%s: read", name);
+	}
+	if (val != i) {
+		errx(1, "%s: holds %u", name, val);
+	}
+	close(fd);
+}
+
+static
+void
+removefile(unsigned i)
+{
+	char name[32];
+
+	mkname(name, sizeof(name), i);
+	if (remove(name) < 0) {
+		err(1, "%s: remove", name);
+	}
+}
+
+static
+off_t
+dirsize(void)
+{
+	struct stat st;
+	int fd;
+
+	fd = open(".", O_RDONLY);
+	if (fd < 0) {
+		err(1, ".: open");
+	}
+	if (fstat(fd, &st) < 0) {
+		err(1, ".: fstat");
+	}
+	close(fd);
+	return st.st_size;
+}
+
+static
+void
+checkall(void)
+{
+	unsigned i;
+
+	for (i=0; i<NFILES; i++) {
+		checkfile(i);
+	}
+}
+
+/*
+ * Each round removes every other file, alternating which half, and
+ * makes them again in the opposite order so they land in different
+ * slots than they had.
+ */
+static
+void
+churn(void)
+{
+	unsigned round, i;
+	off_t size;
+
+	size = dirsize();
+	for (round=0; round<NROUNDS; round++) {
+		for (i=round % 2; i<NFILES; i+=2) {
+			removefile(i);
+		}
+		for (i=NFILES; i-- > 0; ) {
+			if (i % 2 == round % 2) {
+				makefile(i);
+			}
+		}
+		checkall();
+		if (dirsize() != size) {
+			errx(1, "Round %u: directory grew from %lld to %lld",
+			     round, (long long)size, (long long)dirsize());
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned i;
+
+	if (argc == 2 && !strcmp(argv[1], "create")) {
+		for (i=0; i<NFILES; i++) {
+			makefile(i);
+		}
+		checkall();
+		churn();
+		printf("dirchurn: created %u files; remount and run "
+		       "dirchurn check\n", NFILES);
+	}
+	else if (argc == 2 && !strcmp(argv[1], "check")) {
+		checkall();
+		churn();
+		for (i=0; i<NFILES; i++) {
+			removefile(i);
+		}
+		printf("dirchurn: passed; run sfsck on the volume\n");
+	}
+	else {
+		errx(1, "Usage: dirchurn create | check");
+	}
+	return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * pipetest - stream data through a pipe and report the throughput.
+ *
+ * Usage: pipetest [kilobytes]
+ *
+ * If fork works, a child process writes and the parent reads, so
+ * the two ends run concurrently. Otherwise a single process
+ * alternates between writing and reading one PIPE_BUF-sized chunk
+ * at a time. Every byte is checked on the way out.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <err.h>
+
+#define DEFAULT_KB 4096
+
+static char wbuf[PIPE_BUF];
+static char rbuf[PIPE_BUF];
+
+/* Fill a chunk with a pattern that depends on its position in the stream. */
+static
+void
+fill(char *buf, unsigned long pos)
+{
+	unsigned i;
+
+	for (i=0; i<PIPE_BUF; i++) {
+		buf[i] = (char)((pos + i) * 7);
+	}
+}
+
+static
+void
+check(const char *buf, size_t len, unsigned long pos)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		if (buf[i] != (char)((pos + i) * 7)) {
+			errx(1, "Wrong data at byte %lu", pos + i);
+		}
+	}
+}
+
+static
+void
+writeall(int fd, unsigned long total)
+{
+	unsigned long pos;
+	ssize_t r;
+
+	for (pos=0; pos<total; pos+=PIPE_BUF) {
+		fill(wbuf, pos);
+		r = write(fd, wbuf, PIPE_BUF);
+		if (r < 0) {
+			err(1, "write");
+		}
+		if (r != PIPE_BUF) {
+			/* writes of PIPE_BUF bytes are atomic */
+			errx(1, "write: short count %zd", r);
+		}
+	}
+}
+
+static
+unsigned long
+readall(int fd, unsigned long base, unsigned long total)
+{
+	unsigned long pos = 0;
+	ssize_t r;
+
+	while (pos < total) {
+		r = read(fd, rbuf, sizeof(rbuf));
+		if (r < 0) {
+			err(1, "read");
+		}
+		if (r == 0) {
+			break;
+		}
+		check(rbuf, r, base + pos);
+		pos += r;
+	}
+	return pos;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long total, got, pos;
+	time_t s0, s1;
+	unsigned long ns0, ns1, ms;
+	int fds[2], status;
+	pid_t pid;
+
+	total = DEFAULT_KB;
+	if (argc == 2) {
+		total = atoi(argv[1]);
+	}
+	else if (argc > 2) {
+		errx(1, "Usage: pipetest [kilobytes]");
+	}
+	total *= 1024;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	__time(&s0, &ns0);
+
+	pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		writeall(fds[1], total);
+		close(fds[1]);
+		_exit(0);
+	}
+	else if (pid > 0) {
+		close(fds[1]);
+		got = readall(fds[0], 0, total);
+		close(fds[0]);
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+	}
+	else {
+		/* No fork; ping-pong through the pipe in one process. */
+		for (pos=got=0; pos<total; pos+=PIPE_BUF) {
+			fill(wbuf, pos);
+			if (write(fds[1], wbuf, PIPE_BUF) != PIPE_BUF) {
+				err(1, "write");
+			}
+			got += readall(fds[0], pos, PIPE_BUF);
+		}
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	__time(&s1, &ns1);
+
+	if (got != total) {
+		errx(1, "Got %lu bytes, expected %lu", got, total);
+	}
+
+	ms = (unsigned long)(s1 - s0) * 1000;
+	ms = ms + ns1 / 1000000 - ns0 / 1000000;
+	if (ms == 0) {
+		ms = 1;
+	}
+	printf("pipetest: %lu bytes in %lu ms (%lu KB/s)%s\n", total, ms,
+	       total / ms * 1000 / 1024, pid < 0 ? " [no fork]" : "");
+	return 0;
+}